@@ -40,13 +40,14 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "window/themes/window_theme.h"
 #include "window/notifications_manager.h"
 #include "platform/platform_notifications_manager.h"
+#include "base/flat_hash_map.h"
 
 namespace {
 	App::LaunchState _launchState = App::Launched;
 
 	UserData *self = nullptr;
 
-	using PeersData = QHash<PeerId, PeerData*>;
+	using PeersData = base::flat_hash_map<PeerId, PeerData*>;
 	PeersData peersData;
 
 	using MutedPeers = QMap<not_null<PeerData*>, bool>;
@@ -77,12 +78,15 @@ namespace {
 
 	Histories histories;
 
-	using MsgsData = QHash<MsgId, HistoryItem*>;
+	struct FullMsgIdHash {
+		uint64 operator()(const FullMsgId &id) const {
+			return (uint64(uint32(id.channel)) << 32) | uint32(id.msg);
+		}
+	};
+	using MsgsData = base::flat_hash_map<FullMsgId, HistoryItem*, FullMsgIdHash>;
 	MsgsData msgsData;
-	using ChannelMsgsData = QMap<ChannelId, MsgsData>;
-	ChannelMsgsData channelMsgsData;
 
-	using RandomData = QMap<uint64, FullMsgId>;
+	using RandomData = base::flat_hash_map<uint64, FullMsgId>;
 	RandomData randomData;
 
 	using SentData = QMap<uint64, QPair<PeerId, QString>>;
@@ -1034,33 +1038,16 @@ namespace {
 		}
 	}
 
-	inline MsgsData *fetchMsgsData(ChannelId channelId, bool insert = true) {
-		if (channelId == NoChannel) return &msgsData;
-		ChannelMsgsData::iterator i = channelMsgsData.find(channelId);
-		if (i == channelMsgsData.cend()) {
-			if (insert) {
-				i = channelMsgsData.insert(channelId, MsgsData());
-			} else {
-				return 0;
-			}
-		}
-		return &(*i);
-	}
-
 	void feedWereDeleted(ChannelId channelId, const QVector<MTPint> &msgsIds) {
-		const auto data = fetchMsgsData(channelId, false);
-		if (!data) return;
-
 		const auto channelHistory = (channelId != NoChannel)
 			? App::history(peerFromChannel(channelId))->asChannelHistory()
 			: nullptr;
 
 		base::flat_set<not_null<History*>> historiesToCheck;
 		for (const auto msgId : msgsIds) {
-			auto j = data->constFind(msgId.v);
-			if (j != data->cend()) {
-				const auto h = (*j)->history();
-				(*j)->destroy();
+			if (const auto item = histItemById(channelId, msgId.v)) {
+				const auto h = item->history();
+				item->destroy();
 				if (!h->lastMsg) {
 					historiesToCheck.emplace(h);
 				}
@@ -1136,7 +1123,7 @@ namespace {
 	}
 
 	PhotoData *feedPhoto(const MTPPhoto &photo, const PreparedPhotoThumbs &thumbs) {
-		const QPixmap *thumb = 0, *medium = 0, *full = 0;
+		const QImage *thumb = 0, *medium = 0, *full = 0;
 		int32 thumbLevel = -1, mediumLevel = -1, fullLevel = -1;
 		for (PreparedPhotoThumbs::const_iterator i = thumbs.cbegin(), e = thumbs.cend(); i != e; ++i) {
 			int32 newThumbLevel = -1, newMediumLevel = -1, newFullLevel = -1;
@@ -1173,7 +1160,7 @@ namespace {
 		switch (photo.type()) {
 		case mtpc_photo: {
 			const auto &ph(photo.c_photo());
-			return App::photoSet(ph.vid.v, 0, ph.vaccess_hash.v, ph.vdate.v, ImagePtr(*thumb, "JPG"), ImagePtr(*medium, "JPG"), ImagePtr(*full, "JPG"));
+			return App::photoSet(ph.vid.v, 0, ph.vaccess_hash.v, ph.vdate.v, ImagePtr(QPixmap::fromImage(*thumb, Qt::ColorOnly), "JPG"), ImagePtr(QPixmap::fromImage(*medium, Qt::ColorOnly), "JPG"), ImagePtr(QPixmap::fromImage(*full, Qt::ColorOnly), "JPG"));
 		} break;
 		case mtpc_photoEmpty: return App::photo(photo.c_photoEmpty().vid.v);
 		}
@@ -1233,11 +1220,11 @@ namespace {
 		return App::photoSet(photo.vid.v, convert, 0, 0, ImagePtr(), ImagePtr(), ImagePtr());
 	}
 
-	DocumentData *feedDocument(const MTPdocument &document, const QPixmap &thumb) {
+	DocumentData *feedDocument(const MTPdocument &document, const QImage &thumb) {
 		switch (document.type()) {
 		case mtpc_document: {
 			auto &d = document.c_document();
-			return App::documentSet(d.vid.v, 0, d.vaccess_hash.v, d.vversion.v, d.vdate.v, d.vattributes.v, qs(d.vmime_type), ImagePtr(thumb, "JPG"), d.vdc_id.v, d.vsize.v, StorageImageLocation());
+			return App::documentSet(d.vid.v, 0, d.vaccess_hash.v, d.vversion.v, d.vdate.v, d.vattributes.v, qs(d.vmime_type), ImagePtr(QPixmap::fromImage(thumb, Qt::ColorOnly), "JPG"), d.vdc_id.v, d.vsize.v, StorageImageLocation());
 		} break;
 		case mtpc_documentEmpty: return App::document(document.c_documentEmpty().vid.v);
 		}
@@ -1327,8 +1314,8 @@ namespace {
 	PeerData *peer(const PeerId &id, PeerData::LoadedStatus restriction) {
 		if (!id) return nullptr;
 
-		auto i = peersData.constFind(id);
-		if (i == peersData.cend()) {
+		auto i = peersData.find(id);
+		if (i == peersData.end()) {
 			PeerData *newData = nullptr;
 			if (peerIsUser(id)) {
 				newData = new UserData(id);
@@ -1340,29 +1327,35 @@ namespace {
 			Assert(newData != nullptr);
 
 			newData->input = MTPinputPeer(MTP_inputPeerEmpty());
-			i = peersData.insert(id, newData);
+			i = peersData.emplace(id, newData).first;
 		}
+		const auto result = i->second;
 		switch (restriction) {
 		case PeerData::MinimalLoaded: {
-			if (i.value()->loadedStatus == PeerData::NotLoaded) {
+			if (result->loadedStatus == PeerData::NotLoaded) {
 				return nullptr;
 			}
 		} break;
 		case PeerData::FullLoaded: {
-			if (i.value()->loadedStatus != PeerData::FullLoaded) {
+			if (result->loadedStatus != PeerData::FullLoaded) {
 				return nullptr;
 			}
 		} break;
 		}
-		return i.value();
+		return result;
 	}
 
 	void enumerateUsers(base::lambda<void(UserData*)> action) {
-		for_const (auto peer, peersData) {
-			if (auto user = peer->asUser()) {
-				action(user);
+		// The action could create a peer, that invalidates the iterators.
+		auto users = std::vector<UserData*>();
+		for (auto i = peersData.cbegin(), e = peersData.cend(); i != e; ++i) {
+			if (const auto user = i->second->asUser()) {
+				users.push_back(user);
 			}
 		}
+		for_const (auto user, users) {
+			action(user);
+		}
 	}
 
 	UserData *self() {
@@ -1371,9 +1364,9 @@ namespace {
 
 	PeerData *peerByName(const QString &username) {
 		QString uname(username.trimmed());
-		for_const (PeerData *peer, peersData) {
-			if (!peer->userName().compare(uname, Qt::CaseInsensitive)) {
-				return peer;
+		for (auto i = peersData.cbegin(), e = peersData.cend(); i != e; ++i) {
+			if (!i->second->userName().compare(uname, Qt::CaseInsensitive)) {
+				return i->second;
 			}
 		}
 		return nullptr;
@@ -1792,25 +1785,18 @@ namespace {
 	HistoryItem *histItemById(ChannelId channelId, MsgId itemId) {
 		if (!itemId) return nullptr;
 
-		auto data = fetchMsgsData(channelId, false);
-		if (!data) return nullptr;
-
-		auto i = data->constFind(itemId);
-		if (i != data->cend()) {
-			return i.value();
-		}
-		return nullptr;
+		const auto i = msgsData.find(FullMsgId(channelId, itemId));
+		return (i != msgsData.end()) ? i->second : nullptr;
 	}
 
 	void historyRegItem(HistoryItem *item) {
-		MsgsData *data = fetchMsgsData(item->channelId());
-		MsgsData::const_iterator i = data->constFind(item->id);
-		if (i == data->cend()) {
-			data->insert(item->id, item);
-		} else if (i.value() != item) {
+		const auto i = msgsData.find(item->fullId());
+		if (i == msgsData.end()) {
+			msgsData.emplace(item->fullId(), item);
+		} else if (i->second != item) {
 			LOG(("App Error: trying to historyRegItem() an already registered item"));
-			i.value()->destroy();
-			data->insert(item->id, item);
+			i->second->destroy();
+			msgsData[item->fullId()] = item;
 		}
 	}
 
@@ -1836,14 +1822,9 @@ namespace {
 	}
 
 	void historyUnregItem(HistoryItem *item) {
-		auto data = fetchMsgsData(item->channelId(), false);
-		if (!data) return;
-
-		auto i = data->find(item->id);
-		if (i != data->cend()) {
-			if (i.value() == item) {
-				data->erase(i);
-			}
+		const auto i = msgsData.find(item->fullId());
+		if (i != msgsData.end() && i->second == item) {
+			msgsData.erase(item->fullId());
 		}
 		historyItemDetached(item);
 		auto j = ::dependentItems.find(item);
@@ -1880,20 +1861,12 @@ namespace {
 		::dependentItems.clear();
 
 		QVector<HistoryItem*> toDelete;
-		for_const (auto item, msgsData) {
-			if (item->detached()) {
-				toDelete.push_back(item);
-			}
-		}
-		for_const (auto &chMsgsData, channelMsgsData) {
-			for_const (auto item, chMsgsData) {
-				if (item->detached()) {
-					toDelete.push_back(item);
-				}
+		for (auto i = msgsData.cbegin(), e = msgsData.cend(); i != e; ++i) {
+			if (i->second->detached()) {
+				toDelete.push_back(i->second);
 			}
 		}
 		msgsData.clear();
-		channelMsgsData.clear();
 		for_const (auto item, toDelete) {
 			delete item;
 		}
@@ -1909,8 +1882,8 @@ namespace {
 		cSetSavedPeersByTime(SavedPeersByTime());
 		cSetRecentInlineBots(RecentInlineBots());
 
-		for_const (auto peer, ::peersData) {
-			delete peer;
+		for (auto i = ::peersData.cbegin(), e = ::peersData.cend(); i != e; ++i) {
+			delete i->second;
 		}
 		::peersData.clear();
 		for_const (auto game, ::gamesData) {
@@ -1964,20 +1937,31 @@ namespace {
 		}
 	}
 
+	bool historyHasDependentOutside(
+			HistoryItem *dependency,
+			const HistoryBlock *block) {
+		const auto i = ::dependentItems.constFind(dependency);
+		if (i != ::dependentItems.cend()) {
+			for_const (auto dependent, i.value()) {
+				if (dependent->block() != block) {
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
 	void historyRegRandom(uint64 randomId, const FullMsgId &itemId) {
-		randomData.insert(randomId, itemId);
+		randomData[randomId] = itemId;
 	}
 
 	void historyUnregRandom(uint64 randomId) {
-		randomData.remove(randomId);
+		randomData.erase(randomId);
 	}
 
 	FullMsgId histItemByRandom(uint64 randomId) {
-		RandomData::const_iterator i = randomData.constFind(randomId);
-		if (i != randomData.cend()) {
-			return i.value();
-		}
-		return FullMsgId();
+		const auto i = randomData.find(randomId);
+		return (i != randomData.end()) ? i->second : FullMsgId();
 	}
 
 	void historyRegSentData(uint64 randomId, const PeerId &peerId, const QString &text) {
@@ -65,7 +65,7 @@ namespace App {
 	PhotoData *feedPhoto(const MTPPhoto &photo, const PreparedPhotoThumbs &thumbs);
 	PhotoData *feedPhoto(const MTPPhoto &photo, PhotoData *convert = nullptr);
 	PhotoData *feedPhoto(const MTPDphoto &photo, PhotoData *convert = nullptr);
-	DocumentData *feedDocument(const MTPdocument &document, const QPixmap &thumb);
+	DocumentData *feedDocument(const MTPdocument &document, const QImage &thumb);
 	DocumentData *feedDocument(const MTPdocument &document, DocumentData *convert = nullptr);
 	DocumentData *feedDocument(const MTPDdocument &document, DocumentData *convert = nullptr);
 	WebPageData *feedWebPage(const MTPDwebPage &webpage, WebPageData *convert = nullptr);
@@ -197,6 +197,9 @@ namespace App {
 	void historyClearItems();
 	void historyRegDependency(HistoryItem *dependent, HistoryItem *dependency);
 	void historyUnregDependency(HistoryItem *dependent, HistoryItem *dependency);
+	bool historyHasDependentOutside(
+		HistoryItem *dependency,
+		const HistoryBlock *block);
 
 	void historyRegRandom(uint64 randomId, const FullMsgId &itemId);
 	void historyUnregRandom(uint64 randomId);
@@ -62,6 +62,14 @@ public:
 	base::Observable<ItemVisibilityQuery> &queryItemVisibility() {
 		return _queryItemVisibility;
 	}
+	struct ItemUsageQuery {
+		not_null<HistoryItem*> item;
+		not_null<bool*> isUsed;
+		not_null<bool*> isShown;
+	};
+	base::Observable<ItemUsageQuery> &queryItemUsage() {
+		return _queryItemUsage;
+	}
 	void markItemLayoutChanged(not_null<const HistoryItem*> item);
 	rpl::producer<not_null<const HistoryItem*>> itemLayoutChanged() const;
 	void requestItemRepaint(not_null<const HistoryItem*> item);
@@ -299,6 +307,7 @@ private:
 	base::Observable<void> _moreChatsLoaded;
 	base::Observable<void> _pendingHistoryResize;
 	base::Observable<ItemVisibilityQuery> _queryItemVisibility;
+	base::Observable<ItemUsageQuery> _queryItemUsage;
 	rpl::event_stream<not_null<const HistoryItem*>> _itemLayoutChanged;
 	rpl::event_stream<not_null<const HistoryItem*>> _itemRepaintRequest;
 	rpl::event_stream<not_null<const HistoryItem*>> _itemRemoved;
@@ -0,0 +1,284 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+#include <vector>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <cstdint>
+
+namespace base {
+
+// Open addressing hash map with linear probing in a single array.
+//
+// Erasing moves the following elements of the probe sequence back,
+// so any modification of the map invalidates iterators and pointers
+// and the elements can't be erased while iterating over the map.
+// Inserting can grow the array, so no callbacks that may insert should
+// be called from such loop: for example App::peer() creates a peer in
+// App::enumerateUsers() callbacks, so that one collects the users first.
+// Key and Value should be cheap to default construct and to move.
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class flat_hash_map {
+	struct slot {
+		std::pair<Key, Value> value;
+		bool used = false;
+	};
+
+	template <typename SlotIterator, typename Reference>
+	class iterator_base {
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = std::pair<Key, Value>;
+		using difference_type = std::ptrdiff_t;
+		using pointer = std::remove_reference_t<Reference>*;
+		using reference = Reference;
+
+		iterator_base() = default;
+		iterator_base(SlotIterator current, SlotIterator end)
+		: _current(current)
+		, _end(end) {
+			skipUnused();
+		}
+
+		reference operator*() const {
+			return _current->value;
+		}
+		pointer operator->() const {
+			return std::addressof(_current->value);
+		}
+		iterator_base &operator++() {
+			++_current;
+			skipUnused();
+			return *this;
+		}
+		iterator_base operator++(int) {
+			auto result = *this;
+			++*this;
+			return result;
+		}
+		friend bool operator==(
+				const iterator_base &a,
+				const iterator_base &b) {
+			return (a._current == b._current);
+		}
+		friend bool operator!=(
+				const iterator_base &a,
+				const iterator_base &b) {
+			return (a._current != b._current);
+		}
+
+	private:
+		void skipUnused() {
+			while (_current != _end && !_current->used) {
+				++_current;
+			}
+		}
+
+		SlotIterator _current = SlotIterator();
+		SlotIterator _end = SlotIterator();
+
+		friend class flat_hash_map;
+
+	};
+
+public:
+	using key_type = Key;
+	using mapped_type = Value;
+	using value_type = std::pair<Key, Value>;
+	using size_type = std::size_t;
+	using iterator = iterator_base<
+		typename std::vector<slot>::iterator,
+		value_type&>;
+	using const_iterator = iterator_base<
+		typename std::vector<slot>::const_iterator,
+		const value_type&>;
+
+	flat_hash_map() = default;
+
+	size_type size() const {
+		return _size;
+	}
+	bool empty() const {
+		return (_size == 0);
+	}
+
+	// Occupancy statistics.
+	size_type capacity() const {
+		return _slots.size();
+	}
+	double load_factor() const {
+		return _slots.empty()
+			? 0.
+			: (double(_size) / double(_slots.size()));
+	}
+	size_type memory_usage() const {
+		return sizeof(*this) + _slots.capacity() * sizeof(slot);
+	}
+	size_type max_probe_length() const {
+		auto result = size_type(0);
+		for (auto i = size_type(0), count = _slots.size(); i != count; ++i) {
+			if (_slots[i].used) {
+				const auto distance = (i + count - ideal(_slots[i].value.first))
+					& (count - 1);
+				if (result < distance + 1) {
+					result = distance + 1;
+				}
+			}
+		}
+		return result;
+	}
+
+	iterator begin() {
+		return iterator(_slots.begin(), _slots.end());
+	}
+	iterator end() {
+		return iterator(_slots.end(), _slots.end());
+	}
+	const_iterator begin() const {
+		return const_iterator(_slots.cbegin(), _slots.cend());
+	}
+	const_iterator end() const {
+		return const_iterator(_slots.cend(), _slots.cend());
+	}
+	const_iterator cbegin() const {
+		return begin();
+	}
+	const_iterator cend() const {
+		return end();
+	}
+
+	iterator find(const Key &key) {
+		const auto index = lookup(key);
+		return (index < _slots.size())
+			? iterator(_slots.begin() + index, _slots.end())
+			: end();
+	}
+	const_iterator find(const Key &key) const {
+		const auto index = lookup(key);
+		return (index < _slots.size())
+			? const_iterator(_slots.cbegin() + index, _slots.cend())
+			: end();
+	}
+	bool contains(const Key &key) const {
+		return (lookup(key) < _slots.size());
+	}
+
+	std::pair<iterator, bool> emplace(const Key &key, Value value) {
+		if (const auto index = lookup(key); index < _slots.size()) {
+			return { iterator(_slots.begin() + index, _slots.end()), false };
+		}
+		reserve(_size + 1);
+		const auto index = insertUnique(key, std::move(value));
+		return { iterator(_slots.begin() + index, _slots.end()), true };
+	}
+	Value &operator[](const Key &key) {
+		return emplace(key, Value()).first->second;
+	}
+
+	size_type erase(const Key &key) {
+		const auto index = lookup(key);
+		if (index >= _slots.size()) {
+			return 0;
+		}
+		eraseAt(index);
+		return 1;
+	}
+
+	void reserve(size_type count) {
+		if (count * kMaxLoadDenominator
+			<= _slots.size() * kMaxLoadNumerator) {
+			return;
+		}
+		auto capacity = _slots.empty() ? kMinCapacity : _slots.size();
+		while (count * kMaxLoadDenominator > capacity * kMaxLoadNumerator) {
+			capacity *= 2;
+		}
+		rehash(capacity);
+	}
+	void clear() {
+		_slots.clear();
+		_shift = 0;
+		_size = 0;
+	}
+
+private:
+	static constexpr size_type kMinCapacity = 16;
+	static constexpr size_type kMaxLoadNumerator = 3;
+	static constexpr size_type kMaxLoadDenominator = 4;
+
+	size_type ideal(const Key &key) const {
+		// Fibonacci hashing spreads sequential ids over the whole table.
+		const auto hash = std::uint64_t(Hash()(key));
+		return size_type((hash * 0x9E3779B97F4A7C15ULL) >> _shift);
+	}
+	size_type lookup(const Key &key) const {
+		if (_slots.empty()) {
+			return _slots.size();
+		}
+		const auto mask = _slots.size() - 1;
+		for (auto index = ideal(key); _slots[index].used; index = (index + 1) & mask) {
+			if (_slots[index].value.first == key) {
+				return index;
+			}
+		}
+		return _slots.size();
+	}
+	size_type insertUnique(const Key &key, Value &&value) {
+		const auto mask = _slots.size() - 1;
+		auto index = ideal(key);
+		while (_slots[index].used) {
+			index = (index + 1) & mask;
+		}
+		auto &slot = _slots[index];
+		slot.value.first = key;
+		slot.value.second = std::move(value);
+		slot.used = true;
+		++_size;
+		return index;
+	}
+	void eraseAt(size_type index) {
+		const auto mask = _slots.size() - 1;
+		auto hole = index;
+		for (auto next = (hole + 1) & mask; _slots[next].used; next = (next + 1) & mask) {
+			// Move the element back if the hole is between its ideal
+			// position and its current position in the probe sequence.
+			const auto wanted = ideal(_slots[next].value.first);
+			if (((next - wanted) & mask) >= ((next - hole) & mask)) {
+				_slots[hole].value = std::move(_slots[next].value);
+				hole = next;
+			}
+		}
+		_slots[hole] = slot();
+		--_size;
+	}
+	void rehash(size_type capacity) {
+		auto old = std::move(_slots);
+		_slots = std::vector<slot>(capacity);
+		_shift = 64;
+		for (auto i = capacity; i > 1; i /= 2) {
+			--_shift;
+		}
+		_size = 0;
+		for (auto &slot : old) {
+			if (slot.used) {
+				insertUnique(slot.value.first, std::move(slot.value.second));
+			}
+		}
+	}
+
+	std::vector<slot> _slots;
+	int _shift = 0;
+	size_type _size = 0;
+
+};
+
+} // namespace base
@@ -0,0 +1,161 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "catch.hpp"
+
+#include "base/flat_hash_map.h"
+
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct colliding_hash {
+	std::size_t operator()(int value) const {
+		return std::size_t(value % 4);
+	}
+};
+
+TEST_CASE("flat_hash_maps should find inserted items", "[flat_hash_map]") {
+	base::flat_hash_map<int, std::string> v;
+	REQUIRE(v.empty());
+	REQUIRE(v.find(0) == v.end());
+
+	REQUIRE(v.emplace(0, "a").second);
+	REQUIRE(v.emplace(5, "b").second);
+	REQUIRE(v.emplace(4, "c").second);
+	REQUIRE(!v.emplace(5, "d").second);
+	REQUIRE(v.size() == 3);
+	REQUIRE(v.find(5)->second == "b");
+
+	SECTION("operator[] adds a default value") {
+		REQUIRE(v[7].empty());
+		REQUIRE(v.size() == 4);
+		v[7] = "e";
+		REQUIRE(v.find(7)->second == "e");
+	}
+
+	SECTION("erase removes only the given key") {
+		REQUIRE(v.erase(5) == 1);
+		REQUIRE(v.erase(5) == 0);
+		REQUIRE(!v.contains(5));
+		REQUIRE(v.contains(0));
+		REQUIRE(v.contains(4));
+		REQUIRE(v.size() == 2);
+	}
+
+	SECTION("iteration visits every item once") {
+		auto sum = 0;
+		for (const auto &[key, value] : v) {
+			sum += key;
+		}
+		REQUIRE(sum == 9);
+	}
+}
+
+TEST_CASE("flat_hash_maps with colliding keys", "[flat_hash_map]") {
+	base::flat_hash_map<int, int, colliding_hash> v;
+	for (auto i = 0; i != 100; ++i) {
+		v.emplace(i, i * 2);
+	}
+	REQUIRE(v.size() == 100);
+	REQUIRE(v.load_factor() <= 0.75);
+
+	for (auto i = 0; i < 100; i += 3) {
+		REQUIRE(v.erase(i) == 1);
+	}
+	for (auto i = 0; i != 100; ++i) {
+		const auto found = v.find(i);
+		if (i % 3) {
+			REQUIRE(found != v.end());
+			REQUIRE(found->second == i * 2);
+		} else {
+			REQUIRE(found == v.end());
+		}
+	}
+}
+
+TEST_CASE("flat_hash_maps match std::map", "[flat_hash_map]") {
+	auto engine = std::mt19937(42);
+	auto keys = std::uniform_int_distribution<int>(0, 2000);
+	auto actions = std::uniform_int_distribution<int>(0, 2);
+
+	base::flat_hash_map<int, int> v;
+	std::map<int, int> check;
+	for (auto i = 0; i != 20000; ++i) {
+		const auto key = keys(engine);
+		switch (actions(engine)) {
+		case 0: v.emplace(key, i); check.emplace(key, i); break;
+		case 1: v[key] = i; check[key] = i; break;
+		case 2: REQUIRE(v.erase(key) == check.erase(key)); break;
+		}
+	}
+	REQUIRE(v.size() == check.size());
+	for (const auto &[key, value] : check) {
+		const auto found = v.find(key);
+		REQUIRE(found != v.end());
+		REQUIRE(found->second == value);
+	}
+	auto visited = std::size_t(0);
+	for (const auto &[key, value] : v) {
+		REQUIRE(check.find(key) != check.end());
+		++visited;
+	}
+	REQUIRE(visited == check.size());
+
+	v.clear();
+	REQUIRE(v.empty());
+	REQUIRE(v.begin() == v.end());
+}
+
+TEST_CASE("flat_hash_map lookup benchmark", "[.][benchmark][flat_hash_map]") {
+	// Like App::histItemById(): a hundred thousand items by full ids,
+	// looked up much more often than they are added or removed.
+	constexpr auto kItems = 100000;
+	constexpr auto kLookups = 10000000;
+
+	auto random = std::mt19937(42);
+	auto keys = std::vector<std::uint64_t>();
+	keys.reserve(kItems);
+	for (auto i = 0; i != kItems; ++i) {
+		keys.push_back((std::uint64_t(random()) << 32) | std::uint64_t(i));
+	}
+	auto lookups = std::vector<std::uint64_t>();
+	lookups.reserve(kLookups);
+	auto index = std::uniform_int_distribution<int>(0, kItems - 1);
+	for (auto i = 0; i != kLookups; ++i) {
+		lookups.push_back(keys[index(random)]);
+	}
+
+	const auto measure = [&](auto &&map) {
+		for (const auto key : keys) {
+			map.emplace(key, int(key));
+		}
+		const auto started = std::chrono::steady_clock::now();
+		auto found = std::int64_t(0);
+		for (const auto key : lookups) {
+			const auto i = map.find(key);
+			if (i != map.end()) {
+				found += i->second;
+			}
+		}
+		const auto finished = std::chrono::steady_clock::now();
+		std::cout
+			<< std::chrono::duration_cast<std::chrono::milliseconds>(
+				finished - started).count()
+			<< "ms" << std::endl;
+		return found;
+	};
+	std::cout << "base::flat_hash_map: ";
+	const auto flat = measure(base::flat_hash_map<std::uint64_t, int>());
+	std::cout << "std::unordered_map: ";
+	const auto node = measure(std::unordered_map<std::uint64_t, int>());
+	REQUIRE(flat == node);
+}
@@ -553,6 +553,7 @@ for restype in typesList:
   friendDecl = '';
   getters = '';
   reader = '';
+  skipper = '';
   writer = '';
   sizeList = [];
   sizeFast = '';
@@ -576,6 +577,7 @@ for restype in typesList:
     creatorParams = [];
     creatorParamsList = [];
     readText = '';
+    skipText = '';
     writeText = '';
 
     if (hasFlags != ''):
@@ -638,9 +640,16 @@ for restype in typesList:
         prmsInit.append('v' + paramName + '(_' + paramName + ')');
         if (withType):
           readText += '\t\t';
+          skipText += '\t\t';
           writeText += '\t\t';
+        if (paramName == hasFlags): # flags are needed to skip the conditional fields
+          skipText += '\tauto v' + paramName + ' = MTP' + paramType + '(); v' + paramName + '.read(from, end);\n';
+        elif (paramName in conditions):
+          skipText += '\tif (v' + hasFlags + '.v & MTPD' + name + '::Flag::f_' + paramName + ') MTP' + paramType + '::skip(from, end);\n';
+        else:
+          skipText += '\tMTP' + paramType + '::skip(from, end);\n';
         if (paramName in conditions):
-          readText += '\tif (v->has_' + paramName + '()) { v->v' + paramName + '.read(from, end); } else { v->v' + paramName + ' = MTP' + paramType + '(); }\n';
+          readText += '\tif (v->has_' + paramName + '()) v->v' + paramName + '.read(from, end);\n'; # absent fields are left default constructed
           writeText += '\tif (v.has_' + paramName + '()) v.v' + paramName + '.write(to);\n';
           sizeList.append('(v.has_' + paramName + '() ? v.v' + paramName + '.innerLength() : 0)');
         else:
@@ -693,23 +702,30 @@ for restype in typesList:
       reader += '\t\tcase mtpc_' + name + ': _type = cons; '; # read switch line
       if (len(prms) > len(trivialConditions)):
         reader += '{\n';
-        reader += '\t\t\tauto v = new MTPD' + name + '();\n';
+        reader += '\t\t\tauto v = MTP::internal::CreateTypeData<MTPD' + name + '>();\n';
         reader += '\t\t\tsetData(v);\n';
         reader += readText;
         reader += '\t\t} break;\n';
 
+        skipper += '\t\tcase mtpc_' + name + ': {\n';
+        skipper += skipText;
+        skipper += '\t\t} break;\n';
+
         writer += '\t\tcase mtpc_' + name + ': {\n'; # write switch line
         writer += '\t\t\tauto &v = c_' + name + '();\n';
         writer += writeText;
         writer += '\t\t} break;\n';
       else:
         reader += 'break;\n';
+        skipper += '\t\tcase mtpc_' + name + ': break;\n';
     else:
       if (len(prms) > len(trivialConditions)):
-        reader += '\n\tauto v = new MTPD' + name + '();\n';
+        reader += '\n\tauto v = MTP::internal::CreateTypeData<MTPD' + name + '>();\n';
         reader += '\tsetData(v);\n';
         reader += readText;
 
+        skipper += skipText;
+
         writer += '\tauto &v = c_' + name + '();\n';
         writer += writeText;
 
@@ -776,6 +792,23 @@ for restype in typesList:
     methods += reader;
   methods += '}\n';
 
+  typesText += '\tstatic void skip(const mtpPrime *&from, const mtpPrime *end, mtpTypeId cons'; # skip method
+  if (not withType):
+    typesText += ' = mtpc_' + name;
+  typesText += ');\n';
+  methods += 'void MTP' + restype + '::skip(const mtpPrime *&from, const mtpPrime *end, mtpTypeId cons) {\n';
+  if (withData):
+    if not (withType):
+      methods += '\tif (cons != mtpc_' + v[0][0] + ') throw mtpErrorUnexpected(cons, "MTP' + restype + '");\n';
+  if (withType):
+    methods += '\tswitch (cons) {\n'
+    methods += skipper;
+    methods += '\t\tdefault: throw mtpErrorUnexpected(cons, "MTP' + restype + '");\n';
+    methods += '\t}\n';
+  else:
+    methods += skipper;
+  methods += '}\n';
+
   typesText += '\tvoid write(mtpBuffer &to) const;\n'; # write method
   methods += 'void MTP' + restype + '::write(mtpBuffer &to) const {\n';
   if (withType and writer != ''):
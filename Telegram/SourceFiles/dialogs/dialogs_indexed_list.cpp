@@ -19,6 +19,7 @@ RowsByLetter IndexedList::addToEnd(History *history) {
 	RowsByLetter result;
 	if (!_list.contains(history->peer->id)) {
 		result.emplace(0, _list.addToEnd(history));
+		_words.add(history->peer->id, history->peer->nameWords());
 		for (auto ch : history->peer->nameFirstChars()) {
 			auto j = _index.find(ch);
 			if (j == _index.cend()) {
@@ -38,6 +39,7 @@ Row *IndexedList::addByName(History *history) {
 	}
 
 	Row *result = _list.addByName(history);
+	_words.add(history->peer->id, history->peer->nameWords());
 	for (auto ch : history->peer->nameFirstChars()) {
 		auto j = _index.find(ch);
 		if (j == _index.cend()) {
@@ -93,6 +95,9 @@ void IndexedList::movePinned(Row *row, int deltaSign) {
 
 void IndexedList::peerNameChanged(not_null<PeerData*> peer, const PeerData::NameFirstChars &oldChars) {
 	Assert(_sortMode != SortMode::Date);
+	if (_list.contains(peer->id)) {
+		_words.add(peer->id, peer->nameWords());
+	}
 	if (_sortMode == SortMode::Name) {
 		adjustByName(peer, oldChars);
 	} else {
@@ -102,6 +107,9 @@ void IndexedList::peerNameChanged(not_null<PeerData*> peer, const PeerData::Name
 
 void IndexedList::peerNameChanged(Mode list, not_null<PeerData*> peer, const PeerData::NameFirstChars &oldChars) {
 	Assert(_sortMode == SortMode::Date);
+	if (_list.contains(peer->id)) {
+		_words.add(peer->id, peer->nameWords());
+	}
 	adjustNames(list, peer, oldChars);
 }
 
@@ -180,6 +188,7 @@ void IndexedList::adjustNames(Mode list, not_null<PeerData*> peer, const PeerDat
 
 void IndexedList::del(not_null<const PeerData*> peer, Row *replacedBy) {
 	if (_list.del(peer->id, replacedBy)) {
+		_words.remove(peer->id);
 		for (auto ch : peer->nameFirstChars()) {
 			if (auto it = _index.find(ch); it != _index.cend()) {
 				it->second->del(peer->id, replacedBy);
@@ -190,6 +199,23 @@ void IndexedList::del(not_null<const PeerData*> peer, Row *replacedBy) {
 
 void IndexedList::clear() {
 	_index.clear();
+	_words.clear();
+}
+
+std::vector<Row*> IndexedList::filtered(const QStringList &words) const {
+	if (_list.isEmpty()) {
+		return {};
+	}
+	auto result = std::vector<Row*>();
+	for (const auto peerId : _words.find(words)) {
+		if (const auto row = _list.getRow(peerId)) {
+			result.push_back(row);
+		}
+	}
+
+	// Keep the order of the list.
+	ranges::sort(result, std::less<>(), &Row::pos);
+	return result;
 }
 
 IndexedList::~IndexedList() {
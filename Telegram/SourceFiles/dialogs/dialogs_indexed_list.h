@@ -9,6 +9,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 
 #include "dialogs/dialogs_common.h"
 #include "dialogs/dialogs_list.h"
+#include "dialogs/dialogs_words_index.h"
 
 class History;
 
@@ -45,6 +46,9 @@ public:
 		return &_empty;
 	}
 
+	// Rows having for each of the words a name word starting with it.
+	std::vector<Row*> filtered(const QStringList &words) const;
+
 	~IndexedList();
 
 	// Part of List interface is duplicated here for all() list.
@@ -76,6 +80,7 @@ private:
 	SortMode _sortMode;
 	List _list, _empty;
 	base::flat_map<QChar, std::unique_ptr<List>> _index;
+	WordsIndex _words;
 
 };
 
@@ -88,6 +88,14 @@ DialogsInner::DialogsInner(QWidget *parent, not_null<Window::Controller*> contro
 	) | rpl::start_with_next(
 		[this](auto item) { itemRemoved(item); },
 		lifetime());
+	subscribe(Auth().data().queryItemUsage(), [this](const AuthSessionData::ItemUsageQuery &query) {
+		for (const auto &result : _searchResults) {
+			if (result->item() == query.item) {
+				*query.isUsed = true;
+				return;
+			}
+		}
+	});
 	Auth().data().itemRepaintRequest(
 	) | rpl::start_with_next([this](auto item) {
 		if (item->history()->lastMsg == item) {
@@ -1318,77 +1326,17 @@ void DialogsInner::onFilterUpdate(QString newFilter, bool force) {
 		if (_filter.isEmpty() && !_searchFromUser) {
 			clearFilter();
 		} else {
-			QStringList::const_iterator fb = words.cbegin(), fe = words.cend(), fi;
-
 			_state = FilteredState;
 			_filterResults.clear();
 			if (!_searchInPeer && !words.isEmpty()) {
-				const Dialogs::List *toFilter = nullptr;
-				if (!_dialogs->isEmpty()) {
-					for (fi = fb; fi != fe; ++fi) {
-						auto found = _dialogs->filtered(fi->at(0));
-						if (found->isEmpty()) {
-							toFilter = nullptr;
-							break;
-						}
-						if (!toFilter || toFilter->size() > found->size()) {
-							toFilter = found;
-						}
-					}
-				}
-				const Dialogs::List *toFilterContacts = nullptr;
-				if (!_contactsNoDialogs->isEmpty()) {
-					for (fi = fb; fi != fe; ++fi) {
-						auto found = _contactsNoDialogs->filtered(fi->at(0));
-						if (found->isEmpty()) {
-							toFilterContacts = nullptr;
-							break;
-						}
-						if (!toFilterContacts || toFilterContacts->size() > found->size()) {
-							toFilterContacts = found;
-						}
-					}
+				const auto dialogs = _dialogs->filtered(words);
+				const auto contacts = _contactsNoDialogs->filtered(words);
+				_filterResults.reserve(dialogs.size() + contacts.size());
+				for (const auto row : dialogs) {
+					_filterResults.push_back(row);
 				}
-				_filterResults.reserve((toFilter ? toFilter->size() : 0) + (toFilterContacts ? toFilterContacts->size() : 0));
-				if (toFilter) {
-					for_const (auto row, *toFilter) {
-						const auto &nameWords = row->history()->peer->nameWords();
-						auto nb = nameWords.cbegin(), ne = nameWords.cend(), ni = nb;
-						for (fi = fb; fi != fe; ++fi) {
-							auto filterWord = *fi;
-							for (ni = nb; ni != ne; ++ni) {
-								if (ni->startsWith(filterWord)) {
-									break;
-								}
-							}
-							if (ni == ne) {
-								break;
-							}
-						}
-						if (fi == fe) {
-							_filterResults.push_back(row);
-						}
-					}
-				}
-				if (toFilterContacts) {
-					for_const (auto row, *toFilterContacts) {
-						const auto &nameWords = row->history()->peer->nameWords();
-						auto nb = nameWords.cbegin(), ne = nameWords.cend(), ni = nb;
-						for (fi = fb; fi != fe; ++fi) {
-							auto filterWord = *fi;
-							for (ni = nb; ni != ne; ++ni) {
-								if (ni->startsWith(filterWord)) {
-									break;
-								}
-							}
-							if (ni == ne) {
-								break;
-							}
-						}
-						if (fi == fe) {
-							_filterResults.push_back(row);
-						}
-					}
+				for (const auto row : contacts) {
+					_filterResults.push_back(row);
 				}
 			}
 			refresh(true);
@@ -0,0 +1,167 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "dialogs/dialogs_words_index.h"
+
+namespace Dialogs {
+namespace {
+
+constexpr auto kWordsAddedSortedMax = 64;
+
+bool MatchesAll(
+		const WordsIndex::Words &nameWords,
+		const QStringList &words) {
+	for (const auto &word : words) {
+		const auto found = std::find_if(
+			nameWords.begin(),
+			nameWords.end(),
+			[&](const QString &name) { return name.startsWith(word); });
+		if (found == nameWords.end()) {
+			return false;
+		}
+	}
+	return true;
+}
+
+} // namespace
+
+void WordsIndex::add(Id id, const Words &words) {
+	auto &indexed = _indexed[id];
+	_stale += int(indexed.words.size());
+
+	// Each add gets a new generation, so the words of an old name are
+	// not taken for the new ones, even if the peer was removed between.
+	indexed.generation = ++_generation;
+	indexed.words = words;
+	for (const auto &word : words) {
+		auto entry = Entry();
+		entry.word = word;
+		entry.id = id;
+		entry.generation = indexed.generation;
+		_wordsAdded.push_back(std::move(entry));
+	}
+}
+
+void WordsIndex::remove(Id id) {
+	const auto i = _indexed.find(id);
+	if (i != _indexed.end()) {
+		_stale += int(i->second.words.size());
+		_indexed.erase(i);
+	}
+}
+
+void WordsIndex::clear() {
+	_words.clear();
+	_wordsAdded.clear();
+	_stale = 0;
+	_indexed.clear();
+}
+
+int WordsIndex::size() const {
+	return int(_words.size() + _wordsAdded.size());
+}
+
+int WordsIndex::staleCount() const {
+	return _stale;
+}
+
+auto WordsIndex::current(const Entry &entry) const -> const Indexed* {
+	const auto i = _indexed.find(entry.id);
+	return (i != _indexed.end() && i->second.generation == entry.generation)
+		? &i->second
+		: nullptr;
+}
+
+void WordsIndex::prepare() const {
+	const auto byWord = [](const Entry &a, const Entry &b) {
+		return (a.word < b.word);
+	};
+	if (_stale * 2 > size()) {
+		const auto stale = [&](const Entry &entry) {
+			return !current(entry);
+		};
+		_words.erase(
+			std::remove_if(_words.begin(), _words.end(), stale),
+			_words.end());
+		_wordsAdded.erase(
+			std::remove_if(_wordsAdded.begin(), _wordsAdded.end(), stale),
+			_wordsAdded.end());
+		_stale = 0;
+	}
+	if (_wordsAdded.size() > kWordsAddedSortedMax || _words.empty()) {
+		std::sort(_wordsAdded.begin(), _wordsAdded.end(), byWord);
+		const auto middle = _words.size();
+		_words.insert(
+			_words.end(),
+			std::make_move_iterator(_wordsAdded.begin()),
+			std::make_move_iterator(_wordsAdded.end()));
+		std::inplace_merge(
+			_words.begin(),
+			_words.begin() + middle,
+			_words.end(),
+			byWord);
+		_wordsAdded.clear();
+	}
+}
+
+std::vector<WordsIndex::Id> WordsIndex::find(
+		const QStringList &words) const {
+	if (words.isEmpty() || _indexed.empty()) {
+		return {};
+	}
+	prepare();
+
+	// Take the candidates by the word with the least indexed matches,
+	// all the other words are checked by the indexed name words.
+	auto from = _words.end(), till = _words.end();
+	auto selected = QString();
+	for (const auto &word : words) {
+		const auto begin = std::lower_bound(
+			_words.begin(),
+			_words.end(),
+			word,
+			[](const Entry &entry, const QString &word) {
+				return (entry.word < word);
+			});
+		const auto end = std::upper_bound(
+			begin,
+			_words.end(),
+			word,
+			[](const QString &word, const Entry &entry) {
+				return entry.word.leftRef(word.size()).compare(word) > 0;
+			});
+		if (selected.isEmpty() || (end - begin) < (till - from)) {
+			from = begin;
+			till = end;
+			selected = word;
+		}
+	}
+
+	auto result = std::vector<Id>();
+	const auto check = [&](const Entry &entry) {
+		if (const auto indexed = current(entry)) {
+			if (MatchesAll(indexed->words, words)) {
+				result.push_back(entry.id);
+			}
+		}
+	};
+	for (auto i = from; i != till; ++i) {
+		check(*i);
+	}
+	for (const auto &entry : _wordsAdded) {
+		if (entry.word.startsWith(selected)) {
+			check(entry);
+		}
+	}
+
+	// A peer could match by several of its words.
+	std::sort(result.begin(), result.end());
+	result.erase(std::unique(result.begin(), result.end()), result.end());
+	return result;
+}
+
+} // namespace Dialogs
@@ -0,0 +1,62 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <vector>
+
+#include "base/flat_map.h"
+#include "base/flat_set.h"
+
+namespace Dialogs {
+
+// Name words of the peers sorted for the search by word prefixes.
+// The words indexed for an old name or for a removed peer are left in
+// the index and skipped until they are a half of it.
+class WordsIndex {
+public:
+	using Id = quint64;
+	using Words = base::flat_set<QString>;
+
+	// Replaces the words indexed for the id before, if any.
+	void add(Id id, const Words &words);
+	void remove(Id id);
+	void clear();
+
+	// Ids having for each of the words a name word starting with it.
+	std::vector<Id> find(const QStringList &words) const;
+
+	// Words in the index, including the ones left for old names.
+	int size() const;
+	int staleCount() const;
+
+private:
+	struct Entry {
+		QString word;
+		Id id = 0;
+		int generation = 0;
+	};
+	struct Indexed {
+		int generation = 0;
+		Words words;
+	};
+	const Indexed *current(const Entry &entry) const;
+	void prepare() const;
+
+	// Sorted by word, the recently added words are sorted on search.
+	mutable std::vector<Entry> _words;
+	mutable std::vector<Entry> _wordsAdded;
+	mutable int _stale = 0;
+
+	base::flat_map<Id, Indexed> _indexed;
+	int _generation = 0;
+
+};
+
+} // namespace Dialogs
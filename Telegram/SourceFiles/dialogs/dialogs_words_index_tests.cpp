@@ -0,0 +1,219 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "catch.hpp"
+
+#include "dialogs/dialogs_words_index.h"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+using Dialogs::WordsIndex;
+
+namespace {
+
+WordsIndex::Words Words(std::initializer_list<const char*> list) {
+	auto result = WordsIndex::Words();
+	for (const auto word : list) {
+		result.insert(QString::fromLatin1(word));
+	}
+	return result;
+}
+
+QStringList Query(std::initializer_list<const char*> list) {
+	auto result = QStringList();
+	for (const auto word : list) {
+		result.push_back(QString::fromLatin1(word));
+	}
+	return result;
+}
+
+using Ids = std::vector<WordsIndex::Id>;
+
+} // namespace
+
+TEST_CASE("words index finds peers by word prefixes", "[dialogs_words_index]") {
+	auto index = WordsIndex();
+	index.add(1, Words({ "alice", "cooper" }));
+	index.add(2, Words({ "alex", "smith" }));
+	index.add(3, Words({ "bob", "smithson" }));
+
+	REQUIRE(index.find(Query({ "al" })) == Ids({ 1, 2 }));
+	REQUIRE(index.find(Query({ "alice" })) == Ids({ 1 }));
+	REQUIRE(index.find(Query({ "smith" })) == Ids({ 2, 3 }));
+	REQUIRE(index.find(Query({ "carl" })).empty());
+	REQUIRE(index.find(QStringList()).empty());
+
+	SECTION("all the query words must match") {
+		REQUIRE(index.find(Query({ "al", "smi" })) == Ids({ 2 }));
+		REQUIRE(index.find(Query({ "smi", "al" })) == Ids({ 2 }));
+		REQUIRE(index.find(Query({ "bob", "smith" })) == Ids({ 3 }));
+		REQUIRE(index.find(Query({ "alice", "smith" })).empty());
+	}
+
+	SECTION("a peer matching by several words is found once") {
+		index.add(4, Words({ "smiley", "smith" }));
+		REQUIRE(index.find(Query({ "smi" })) == Ids({ 2, 3, 4 }));
+	}
+}
+
+TEST_CASE("words index skips the words of old names", "[dialogs_words_index]") {
+	auto index = WordsIndex();
+	index.add(1, Words({ "alice", "cooper" }));
+	index.add(2, Words({ "bob" }));
+	REQUIRE(index.find(Query({ "al" })) == Ids({ 1 }));
+
+	SECTION("renamed peer is found by the new name only") {
+		index.add(1, Words({ "carol" }));
+		REQUIRE(index.staleCount() == 2);
+		REQUIRE(index.find(Query({ "al" })).empty());
+		REQUIRE(index.find(Query({ "coop" })).empty());
+		REQUIRE(index.find(Query({ "car" })) == Ids({ 1 }));
+	}
+
+	SECTION("renamed back peer is found once") {
+		index.add(1, Words({ "carol" }));
+		index.add(1, Words({ "alice", "cooper" }));
+		REQUIRE(index.staleCount() == 3);
+		REQUIRE(index.find(Query({ "al" })) == Ids({ 1 }));
+		REQUIRE(index.find(Query({ "car" })).empty());
+	}
+
+	SECTION("removed peer is not found") {
+		index.remove(1);
+		index.remove(1);
+		REQUIRE(index.staleCount() == 2);
+		REQUIRE(index.find(Query({ "al" })).empty());
+		REQUIRE(index.find(Query({ "bob" })) == Ids({ 2 }));
+	}
+
+	SECTION("removed and added back peer is found once") {
+		index.remove(1);
+		index.add(1, Words({ "alice", "cooper" }));
+		REQUIRE(index.find(Query({ "al" })) == Ids({ 1 }));
+		REQUIRE(index.find(Query({ "alice", "coop" })) == Ids({ 1 }));
+	}
+
+	SECTION("clear drops everything") {
+		index.add(1, Words({ "carol" }));
+		index.clear();
+		REQUIRE(index.size() == 0);
+		REQUIRE(index.staleCount() == 0);
+		REQUIRE(index.find(Query({ "car" })).empty());
+	}
+}
+
+TEST_CASE("words index drops the old words when they are a half", "[dialogs_words_index]") {
+	auto index = WordsIndex();
+	for (auto id = 1; id <= 100; ++id) {
+		index.add(id, Words({ "name", "other" }));
+	}
+	REQUIRE(index.find(Query({ "name" })).size() == 100);
+	REQUIRE(index.size() == 200);
+
+	// 100 old words of 300 in the index are kept.
+	for (auto id = 1; id <= 50; ++id) {
+		index.add(id, Words({ "renamed", "other" }));
+	}
+	REQUIRE(index.staleCount() == 100);
+	REQUIRE(index.find(Query({ "name" })).size() == 50);
+	REQUIRE(index.size() == 300);
+	REQUIRE(index.staleCount() == 100);
+
+	// 200 old words of 400 are still kept, 202 of 401 are dropped.
+	for (auto id = 51; id <= 100; ++id) {
+		index.add(id, Words({ "renamed", "other" }));
+	}
+	REQUIRE(index.find(Query({ "name" })).empty());
+	REQUIRE(index.size() == 400);
+	index.add(1, Words({ "last" }));
+	REQUIRE(index.staleCount() == 202);
+	REQUIRE(index.find(Query({ "ren" })).size() == 99);
+	REQUIRE(index.staleCount() == 0);
+	REQUIRE(index.size() == 199);
+	REQUIRE(index.find(Query({ "last" })) == Ids({ 1 }));
+	REQUIRE(index.find(Query({ "other" })).size() == 99);
+}
+
+TEST_CASE("words index search benchmark", "[.][benchmark][dialogs_words_index]") {
+	constexpr auto kPeers = 5000;
+	constexpr auto kQueries = 1000;
+
+	auto random = std::mt19937(42);
+	auto letter = std::uniform_int_distribution<int>('a', 'z');
+	auto length = std::uniform_int_distribution<int>(3, 10);
+	const auto word = [&] {
+		auto result = QString();
+		for (auto i = length(random); i != 0; --i) {
+			result.push_back(QChar(letter(random)));
+		}
+		return result;
+	};
+
+	auto index = WordsIndex();
+	auto names = std::vector<WordsIndex::Words>();
+	for (auto id = 0; id != kPeers; ++id) {
+		auto words = WordsIndex::Words();
+		for (auto i = 0; i != 3; ++i) {
+			words.insert(word());
+		}
+		index.add(id, words);
+		names.push_back(std::move(words));
+	}
+	auto queries = std::vector<QStringList>();
+	for (auto i = 0; i != kQueries; ++i) {
+		const auto &name = names[i % kPeers];
+		auto query = QStringList();
+		for (const auto &word : name) {
+			query.push_back(word.left(2));
+		}
+		queries.push_back(query);
+	}
+
+	const auto measure = [&](auto &&method) {
+		const auto started = std::chrono::steady_clock::now();
+		auto found = std::size_t(0);
+		for (const auto &query : queries) {
+			found += method(query);
+		}
+		const auto finished = std::chrono::steady_clock::now();
+		std::cout
+			<< std::chrono::duration_cast<std::chrono::microseconds>(
+				finished - started).count() / kQueries
+			<< "us per query" << std::endl;
+		return found;
+	};
+
+	index.find(Query({ "a" }));
+	std::cout << "Index: ";
+	const auto indexed = measure([&](const QStringList &query) {
+		return index.find(query).size();
+	});
+	std::cout << "Scan: ";
+	const auto scanned = measure([&](const QStringList &query) {
+		auto result = std::size_t(0);
+		for (const auto &name : names) {
+			const auto matches = std::all_of(
+				query.begin(),
+				query.end(),
+				[&](const QString &word) {
+					return std::any_of(
+						name.begin(),
+						name.end(),
+						[&](const QString &part) {
+							return part.startsWith(word);
+						});
+				});
+			if (matches) {
+				++result;
+			}
+		}
+		return result;
+	});
+	REQUIRE(indexed == scanned);
+}
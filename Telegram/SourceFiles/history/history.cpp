@@ -45,6 +45,10 @@ constexpr auto kStatusShowClientsideChooseContact = 6000;
 constexpr auto kStatusShowClientsidePlayGame = 10000;
 constexpr auto kSetMyActionForMs = 10000;
 constexpr auto kNewBlockEachMessage = 50;
+constexpr auto kCheckResidentItemsDelay = TimeMs(10000);
+constexpr auto kHistoryResidentItemsMax = 2000;
+constexpr auto kResidentItemsMax = 20000;
+constexpr auto kKeepBlocksAroundScrollState = 4;
 
 auto GlobalPinnedIndex = 0;
 
@@ -761,6 +765,80 @@ void Histories::checkSelfDestructItems() {
 	}
 }
 
+int Histories::residentItemsCount() const {
+	auto result = 0;
+	for_const (auto history, map) {
+		result += history->residentItemsCount();
+	}
+	return result;
+}
+
+void Histories::checkResidentItemsDelayed() {
+	if (!_residentItemsTimer.isActive()) {
+		_residentItemsTimer.callOnce(kCheckResidentItemsDelay);
+	}
+}
+
+void Histories::checkResidentItems() {
+	// Messages referenced by drafts and pinned messages are not unloaded.
+	auto keep = base::flat_set<FullMsgId>();
+	auto loaded = std::vector<not_null<History*>>();
+	auto count = 0;
+	for_const (auto history, map) {
+		const auto channelId = history->channelId();
+		const auto drafts = {
+			history->localDraft(),
+			history->cloudDraft(),
+			history->editDraft()
+		};
+		for (const auto draft : drafts) {
+			if (draft && draft->msgId) {
+				keep.emplace(channelId, draft->msgId);
+			}
+		}
+		for (const auto &itemId : history->forwardDraft()) {
+			keep.emplace(itemId);
+		}
+		if (const auto channel = history->peer->asChannel()) {
+			if (const auto pinnedId = channel->pinnedMessageId()) {
+				keep.emplace(channelId, pinnedId);
+			}
+		}
+		if (const auto resident = history->residentItemsCount()) {
+			count += resident;
+			loaded.push_back(history);
+		}
+	}
+
+	auto unloaded = 0;
+	for (const auto history : loaded) {
+		if (history->residentItemsCount() > kHistoryResidentItemsMax) {
+			unloaded += history->unloadFarBlocks(
+				kHistoryResidentItemsMax,
+				keep);
+		}
+	}
+	if (count - unloaded > kResidentItemsMax) {
+		// Unload the chats with the oldest last messages first.
+		ranges::sort(loaded, [](
+				not_null<History*> a,
+				not_null<History*> b) {
+			return (a->lastMsgDate < b->lastMsgDate);
+		});
+		for (const auto history : loaded) {
+			if (count - unloaded <= kResidentItemsMax) {
+				break;
+			}
+			unloaded += history->unloadFarBlocks(0, keep);
+		}
+	}
+	if (unloaded > 0) {
+		DEBUG_LOG(("History Info: unloaded %1 items, %2 items resident."
+			).arg(unloaded
+			).arg(residentItemsCount()));
+	}
+}
+
 HistoryItem *History::createItem(const MTPMessage &msg, bool applyServiceAction, bool detachExistingItem) {
 	const auto msgId = idFromMessage(msg);
 	if (!msgId) return nullptr;
@@ -1357,6 +1435,7 @@ void History::clearSendAction(not_null<UserData*> from) {
 
 void History::newItemAdded(not_null<HistoryItem*> item) {
 	App::checkImageCacheSize();
+	App::histories().checkResidentItemsDelayed();
 	item->indexAsNewItem();
 	if (const auto from = item->from() ? item->from()->asUser() : nullptr) {
 		if (from == item->author()) {
@@ -1506,6 +1585,8 @@ void History::addOlderSlice(const QVector<MTPMessage> &slice) {
 		return;
 	}
 
+	App::histories().checkResidentItemsDelayed();
+
 	auto firstAdded = (HistoryItem*)nullptr;
 	auto lastAdded = (HistoryItem*)nullptr;
 
@@ -1649,6 +1730,8 @@ void History::addNewerSlice(const QVector<MTPMessage> &slice) {
 
 	Assert(!isBuildingFrontBlock());
 	if (!slice.isEmpty()) {
+		App::histories().checkResidentItemsDelayed();
+
 		auto logged = QStringList();
 		logged.push_back(QString::number(minMsgId()));
 		logged.push_back(QString::number(maxMsgId()));
@@ -2357,24 +2440,64 @@ MsgId History::msgIdForRead() const {
 	return result;
 }
 
-int History::resizeGetHeight(int newWidth) {
-	bool resizeAllItems = (_flags & Flag::f_pending_resize) || (width != newWidth);
-
-	if (!resizeAllItems && !hasPendingResizedItems()) {
+int History::resizeGetHeight(int newWidth, int visibleHeight) {
+	const auto widthChanged = (width != newWidth);
+	const auto resizeAllItems = (_flags & Flag::f_pending_resize)
+		|| (widthChanged && visibleHeight <= 0);
+	if (!resizeAllItems && !widthChanged && !hasPendingResizedItems()) {
 		return height;
 	}
 	_flags &= ~(Flag::f_pending_resize | Flag::f_has_pending_resized_items);
 
+	// Resize the screen around the scroll state and a screen above and
+	// below it, so that the scroll state item keeps its place.
+	auto resizeFrom = 0;
+	auto resizeTill = 0;
+	if (widthChanged && !resizeAllItems) {
+		const auto anchorTop = (scrollTopItem && !scrollTopItem->detached())
+			? (scrollTopItem->block()->y()
+				+ scrollTopItem->y()
+				+ scrollTopOffset)
+			: (height - visibleHeight);
+		resizeFrom = anchorTop - visibleHeight;
+		resizeTill = anchorTop + 2 * visibleHeight;
+	}
+
 	width = newWidth;
-	int y = 0;
+	auto y = 0;
 	for_const (auto block, blocks) {
+		const auto blockTop = block->y();
 		block->setY(y);
-		y += block->resizeGetHeight(newWidth, resizeAllItems);
+		y += block->resizeGetHeight(
+			newWidth,
+			resizeAllItems,
+			resizeFrom - blockTop,
+			resizeTill - blockTop);
 	}
 	height = y;
 	return height;
 }
 
+void History::resizeStaleItemsLater(int top, int bottom) {
+	for (const auto block : blocks) {
+		const auto blockTop = block->y();
+		if (blockTop >= bottom) {
+			break;
+		} else if (blockTop + block->height() <= top) {
+			continue;
+		}
+		for (const auto item : block->items) {
+			const auto itemTop = blockTop + item->y();
+			if (itemTop >= bottom) {
+				break;
+			} else if (itemTop + item->height() > top
+				&& item->width() != width) {
+				item->setPendingResize();
+			}
+		}
+	}
+}
+
 ChannelHistory *History::asChannelHistory() {
 	return isChannel() ? static_cast<ChannelHistory*>(this) : nullptr;
 }
@@ -2449,6 +2572,7 @@ void History::clear(bool leaveItems) {
 		}
 		Auth().storage().remove(Storage::SharedMediaRemoveAll(peer->id));
 		Auth().data().markHistoryCleared(this);
+		destroyUnloadedItems();
 	}
 	clearBlocks(leaveItems);
 	if (leaveItems) {
@@ -2508,6 +2632,182 @@ void History::clearUpTill(MsgId availableMinId) {
 	}
 }
 
+int History::residentItemsCount() const {
+	auto result = 0;
+	for (const auto block : blocks) {
+		result += block->items.size();
+	}
+	return result;
+}
+
+int History::unloadFarBlocks(
+		int itemsLeft,
+		const base::flat_set<FullMsgId> &keep) {
+	releaseUnloadedItems(keep);
+	if (isBuildingFrontBlock()) {
+		return 0;
+	}
+
+	// The migrated history is displayed right above this one and
+	// this one right below the migrated, they can't have a gap.
+	const auto migrated = migrateFrom();
+	auto topBlocked = (migrated && !migrated->isEmpty());
+	auto bottomBlocked = loadedAtBottom() || (peer->migrateTo() != nullptr);
+
+	auto anchor = (scrollTopItem && !scrollTopItem->detached())
+		? scrollTopItem->block()->indexInHistory()
+		: (int(blocks.size()) - 1);
+	auto count = residentItemsCount();
+	auto result = 0;
+	while (count > itemsLeft && !(topBlocked && bottomBlocked)) {
+		const auto above = anchor;
+		const auto below = int(blocks.size()) - 1 - anchor;
+		const auto fromTop = !topBlocked
+			&& (bottomBlocked || above >= below);
+		const auto far = fromTop ? above : below;
+		const auto block = fromTop ? blocks.front() : blocks.back();
+		if (far <= kKeepBlocksAroundScrollState || !canUnloadBlock(block)) {
+			if (fromTop) {
+				topBlocked = true;
+			} else {
+				bottomBlocked = true;
+			}
+			continue;
+		}
+		count -= block->items.size();
+		result += block->items.size();
+		unloadBlock(block, keep);
+		if (fromTop) {
+			--anchor;
+			oldLoaded = false;
+		} else {
+			newLoaded = false;
+		}
+	}
+	if (result > 0) {
+		setHasPendingResizedItems();
+	}
+	return result;
+}
+
+bool History::canUnloadBlock(not_null<HistoryBlock*> block) const {
+	const auto splitsGroup = [&](
+			not_null<HistoryItem*> item,
+			HistoryItem *neighbour) {
+		const auto groupId = item->groupId();
+		return (groupId != MessageGroupId())
+			&& neighbour
+			&& (neighbour->groupId() == groupId);
+	};
+	const auto first = block->items.front();
+	const auto last = block->items.back();
+	if (splitsGroup(first, findPreviousItem(first))
+		|| splitsGroup(last, findNextItem(last))) {
+		return false;
+	}
+
+	// The items that define the scroll state, are shown on the screen
+	// or are listed in shared media and calls keep their block, the
+	// ones used elsewhere are kept alive detached in unloadBlock().
+	for (const auto item : block->items) {
+		if (!IsServerMsgId(item->id)
+			|| item == lastMsg
+			|| item == lastSentMsg
+			|| item == showFrom
+			|| item == unreadBar
+			|| item == scrollTopItem) {
+			return false;
+		}
+
+		// Shared media and calls lists keep pointers to their items
+		// and treat a deleted item as a removed message.
+		const auto media = item->getMedia();
+		if (item->sharedMediaTypes()
+			|| (media && media->type() == MediaTypeCall)) {
+			return false;
+		}
+		auto isUsed = false;
+		auto isShown = false;
+		Auth().data().queryItemUsage().notify(
+			{ item, &isUsed, &isShown },
+			true);
+		if (isShown) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool History::isItemUsed(
+		not_null<HistoryItem*> item,
+		const base::flat_set<FullMsgId> &keep) const {
+	if (item->id == lastKeyboardId
+		|| notifies.contains(item)
+		|| keep.contains(item->fullId())
+		|| App::historyHasDependentOutside(item, item->block())) {
+		return true;
+	}
+	auto isUsed = false;
+	auto isShown = false;
+	Auth().data().queryItemUsage().notify(
+		{ item, &isUsed, &isShown },
+		true);
+	return isUsed || isShown;
+}
+
+void History::unloadBlock(
+		not_null<HistoryBlock*> block,
+		const base::flat_set<FullMsgId> &keep) {
+	auto used = base::flat_set<not_null<HistoryItem*>>();
+	for (const auto item : block->items) {
+		if (isItemUsed(item, keep)) {
+			used.emplace(item);
+		}
+	}
+
+	auto &pending = Global::RefPendingRepaintItems();
+	auto items = base::take(block->items);
+	for (const auto item : items) {
+		pending.remove(item);
+		item->detachFast();
+	}
+	removeBlock(block);
+	delete block.get();
+
+	for (const auto item : items) {
+		if (used.contains(item)) {
+			// createItem() attaches it again if the block is loaded.
+			_unloadedItems.emplace(item->id);
+		} else {
+			delete item;
+		}
+	}
+}
+
+void History::releaseUnloadedItems(const base::flat_set<FullMsgId> &keep) {
+	for (auto i = _unloadedItems.begin(); i != _unloadedItems.end();) {
+		const auto item = App::histItemById(channelId(), *i);
+		if (!item || !item->detached()) {
+			i = _unloadedItems.erase(i);
+		} else if (!isItemUsed(item, keep)) {
+			i = _unloadedItems.erase(i);
+			delete item;
+		} else {
+			++i;
+		}
+	}
+}
+
+void History::destroyUnloadedItems() {
+	for (const auto id : base::take(_unloadedItems)) {
+		if (const auto item = App::histItemById(channelId(), id)) {
+			if (item->detached()) {
+				delete item;
+			}
+		}
+	}
+}
+
 void History::applyGroupAdminChanges(
 		const base::flat_map<UserId, bool> &changes) {
 	for (auto block : blocks) {
@@ -2529,6 +2829,7 @@ void History::clearBlocks(bool leaveItems) {
 }
 
 void History::clearOnDestroy() {
+	destroyUnloadedItems();
 	clearBlocks(false);
 }
 
@@ -2637,11 +2938,21 @@ History::~History() {
 	clearOnDestroy();
 }
 
-int HistoryBlock::resizeGetHeight(int newWidth, bool resizeAllItems) {
+int HistoryBlock::resizeGetHeight(
+		int newWidth,
+		bool resizeAllItems,
+		int resizeFrom,
+		int resizeTill) {
 	auto y = 0;
 	for_const (auto item, items) {
+		const auto itemTop = item->y();
+		const auto resize = resizeAllItems
+			|| item->pendingResize()
+			|| (item->width() != newWidth
+				&& itemTop < resizeTill
+				&& itemTop + item->height() > resizeFrom);
 		item->setY(y);
-		if (resizeAllItems || item->pendingResize()) {
+		if (resize) {
 			y += item->resizeGetHeight(newWidth);
 		} else {
 			y += item->height();
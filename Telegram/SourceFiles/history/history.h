@@ -34,6 +34,7 @@ public:
 
 	Histories() : _a_typings(animation(this, &Histories::step_typings)) {
 		_selfDestructTimer.setCallback([this] { checkSelfDestructItems(); });
+		_residentItemsTimer.setCallback([this] { checkResidentItems(); });
 	}
 
 	void registerSendAction(
@@ -92,8 +93,14 @@ public:
 	}
 	void selfDestructIn(not_null<HistoryItem*> item, TimeMs delay);
 
+	// Unloads the blocks far from the displayed messages a bit later
+	// if the chats hold more items than the per chat or global budget.
+	int residentItemsCount() const;
+	void checkResidentItemsDelayed();
+
 private:
 	void checkSelfDestructItems();
+	void checkResidentItems();
 
 	int _unreadFull = 0;
 	int _unreadMuted = 0;
@@ -103,6 +110,8 @@ private:
 	base::Timer _selfDestructTimer;
 	std::vector<FullMsgId> _selfDestructItems;
 
+	base::Timer _residentItemsTimer;
+
 };
 
 class HistoryBlock;
@@ -200,6 +209,17 @@ public:
 	void clear(bool leaveItems = false);
 	void clearUpTill(MsgId availableMinId);
 
+	int residentItemsCount() const;
+
+	// Destroys the blocks from the edges of the loaded slice which are
+	// far from the scroll state while more than itemsLeft items are
+	// loaded, they are loaded again by addOlderSlice / addNewerSlice.
+	// The items still used elsewhere are kept alive detached.
+	// Returns the count of unloaded items.
+	int unloadFarBlocks(
+		int itemsLeft,
+		const base::flat_set<FullMsgId> &keep);
+
 	void applyGroupAdminChanges(const base::flat_map<UserId, bool> &changes);
 
 	virtual ~History();
@@ -285,7 +305,11 @@ public:
 	MsgId maxMsgId() const;
 	MsgId msgIdForRead() const;
 
-	int resizeGetHeight(int newWidth);
+	// With a positive visibleHeight a width change resizes only the items
+	// around the scroll state, the others keep their heights as estimates
+	// until they are requested by resizeStaleItemsLater().
+	int resizeGetHeight(int newWidth, int visibleHeight = 0);
+	void resizeStaleItemsLater(int top, int bottom);
 
 	void removeNotification(HistoryItem *item) {
 		if (!notifies.isEmpty()) {
@@ -505,6 +529,16 @@ private:
 
 	void clearSendAction(not_null<UserData*> from);
 
+	bool canUnloadBlock(not_null<HistoryBlock*> block) const;
+	bool isItemUsed(
+		not_null<HistoryItem*> item,
+		const base::flat_set<FullMsgId> &keep) const;
+	void unloadBlock(
+		not_null<HistoryBlock*> block,
+		const base::flat_set<FullMsgId> &keep);
+	void releaseUnloadedItems(const base::flat_set<FullMsgId> &keep);
+	void destroyUnloadedItems();
+
 	HistoryItem *findPreviousItem(not_null<HistoryItem*> item) const;
 	HistoryItem *findNextItem(not_null<HistoryItem*> item) const;
 	not_null<HistoryItem*> findGroupFirst(
@@ -573,6 +607,10 @@ private:
 
 	int _pinnedIndex = 0; // > 0 for pinned dialogs
 
+	// Items from the unloaded blocks that were still used somewhere.
+	// They live detached until they are not used or loaded again.
+	base::flat_set<MsgId> _unloadedItems;
+
  };
 
 class HistoryJoined;
@@ -623,7 +661,13 @@ public:
 	}
 	void removeItem(not_null<HistoryItem*> item);
 
-	int resizeGetHeight(int newWidth, bool resizeAllItems);
+	// Resizes pending items and items with a different width that intersect
+	// [resizeFrom, resizeTill) in the old block coordinates.
+	int resizeGetHeight(
+		int newWidth,
+		bool resizeAllItems,
+		int resizeFrom = 0,
+		int resizeTill = 0);
 	int y() const {
 		return _y;
 	}
@@ -151,6 +151,16 @@ HistoryInner::HistoryInner(
 	) | rpl::start_with_next(
 		[this](auto item) { itemRemoved(item); },
 		lifetime());
+	subscribe(Auth().data().queryItemUsage(), [this](const AuthSessionData::ItemUsageQuery &query) {
+		const auto item = query.item.get();
+		if (_selected.find(item) != _selected.end()
+			|| item == _mouseActionItem
+			|| item == _dragStateItem
+			|| item == _dragSelFrom
+			|| item == _dragSelTo) {
+			*query.isUsed = true;
+		}
+	});
 	rpl::merge(
 		Auth().data().historyUnloaded(),
 		Auth().data().historyCleared()
@@ -1759,9 +1769,9 @@ void HistoryInner::recountHistoryGeometry() {
 		accumulate_max(oldHistoryPaddingTop, st::msgMargin.top() + st::msgMargin.bottom() + st::msgPadding.top() + st::msgPadding.bottom() + st::msgNameFont->height + st::botDescSkip + _botAbout->height);
 	}
 
-	_history->resizeGetHeight(_scroll->width());
+	_history->resizeGetHeight(_scroll->width(), _scroll->height());
 	if (_migrated) {
-		_migrated->resizeGetHeight(_scroll->width());
+		_migrated->resizeGetHeight(_scroll->width(), _scroll->height());
 	}
 
 	// with migrated history we perhaps do not need to display first _history message
@@ -1879,13 +1889,13 @@ void HistoryInner::visibleAreaUpdated(int top, int bottom) {
 		return;
 	}
 
+	int htop = historyTop(), mtop = migratedTop();
 	if (bottom >= _historyPaddingTop + historyHeight() + st::historyPaddingBottom) {
 		_history->forgetScrollState();
 		if (_migrated) {
 			_migrated->forgetScrollState();
 		}
 	} else {
-		int htop = historyTop(), mtop = migratedTop();
 		if ((htop >= 0 && top >= htop) || mtop < 0) {
 			_history->countScrollState(top - htop);
 			if (_migrated) {
@@ -1901,6 +1911,15 @@ void HistoryInner::visibleAreaUpdated(int top, int bottom) {
 			}
 		}
 	}
+
+	// Items far from the scroll state keep their heights for the previous
+	// width, the widget resizes the visible ones and restores the scroll.
+	if (htop >= 0) {
+		_history->resizeStaleItemsLater(top - htop, bottom - htop);
+	}
+	if (mtop >= 0) {
+		_migrated->resizeStaleItemsLater(top - mtop, bottom - mtop);
+	}
 	if (scrolledUp) {
 		_scrollDateCheck.call();
 	} else {
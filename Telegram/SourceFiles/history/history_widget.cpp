@@ -636,6 +636,19 @@ HistoryWidget::HistoryWidget(QWidget *parent, not_null<Window::Controller*> cont
 			}
 		}
 	});
+	subscribe(Auth().data().queryItemUsage(), [this](const AuthSessionData::ItemUsageQuery &query) {
+		const auto item = query.item.get();
+		if (item == _replyEditMsg
+			|| item == _replyReturn
+			|| item == _kbReplyTo
+			|| (_pinnedBar && item == _pinnedBar->msg)
+			|| ranges::find(_toForward, item) != _toForward.end()) {
+			*query.isUsed = true;
+		}
+		if (!isItemCompletelyHidden(item)) {
+			*query.isShown = true;
+		}
+	});
 	Auth().data().itemLayoutChanged(
 	) | rpl::start_with_next([this](auto item) {
 		if (_peer && _list) {
@@ -2657,6 +2670,23 @@ void HistoryWidget::visibleAreaUpdated() {
 		auto scrollTop = _scroll->scrollTop();
 		auto scrollBottom = scrollTop + _scroll->height();
 		_list->visibleAreaUpdated(scrollTop, scrollBottom);
+		if (hasPendingResizedItems() && !_updatingLazyResize) {
+			// Some of the visible items were not resized for the current
+			// width yet, resize them keeping the scroll state item in place.
+			// The relayout can bring more stale items into view, they are
+			// marked by the nested visibleAreaUpdated(), so repeat it.
+			const auto canUpdateGeometry = [&] {
+				return _historyInited
+					&& !_firstLoadRequest
+					&& !_a_show.animating();
+			};
+			_updatingLazyResize = true;
+			while (hasPendingResizedItems() && canUpdateGeometry()) {
+				updateHistoryGeometry();
+			}
+			_updatingLazyResize = false;
+			return;
+		}
 		if (_history->loadedAtBottom() && (_history->unreadCount() > 0 || (_migrated && _migrated->unreadCount() > 0))) {
 			auto showFrom = (_migrated && _migrated->showFrom) ? _migrated->showFrom : (_history ? _history->showFrom : nullptr);
 			auto showFromVisible = (showFrom && !showFrom->detached() && scrollBottom > _list->itemTop(showFrom));
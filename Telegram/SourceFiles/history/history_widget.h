@@ -747,6 +747,7 @@ private:
 	History *_history = nullptr;
 	bool _historyInited = false; // Initial updateHistoryGeometry() was called.
 	bool _updateHistoryGeometryRequired = false; // If updateListSize() was called without updateHistoryGeometry().
+	bool _updatingLazyResize = false;
 	int _addToScroll = 0;
 
 	int _lastScrollTop = 0; // gifs optimization
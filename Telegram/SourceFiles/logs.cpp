@@ -12,6 +12,22 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "core/crash_reports.h"
 #include "core/launcher.h"
 
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace {
+
+// Threads writing debug logs wait while this much is not written yet.
+constexpr auto kPendingSizeMax = 16 * 1024 * 1024;
+
+// A debug log is continued in a new file when it gets this large and the
+// oldest debug logs are removed while all of them take more than the limit.
+constexpr auto kDebugLogPartSizeMax = qint64(64) * 1024 * 1024;
+constexpr auto kDebugLogsSizeMax = qint64(1024) * 1024 * 1024;
+
+} // namespace
+
 enum LogDataType {
 	LogDataMain,
 	LogDataDebug,
@@ -92,19 +108,208 @@ public:
 	}
 
 	void write(LogDataType type, const QString &msg) {
+		if (type == LogDataMain) {
+			// Main log is written right away to be complete in case of a crash.
+			writeNow(type, msg);
+		} else {
+			writeLater(type, msg);
+		}
+	}
+
+	// The data is serialized to text only when it is written.
+	void writeLater(
+			LogDataType type,
+			const QString &msg,
+			const mtpBuffer &data,
+			int offset,
+			int size) {
+		auto entry = Pending();
+		entry.text = msg;
+		entry.data = data;
+		entry.offset = offset;
+		entry.size = size;
+
+		std::unique_lock<std::mutex> lock(_pendingMutex);
+		startWritingThread();
+		waitForPendingSpace(lock);
+		_pendingSize += msg.size() * sizeof(QChar) + size * sizeof(mtpPrime);
+		_pending[type].push_back(std::move(entry));
+		_pendingCondition.notify_one();
+	}
+
+	~LogsDataFields() {
+		if (_writingThread.joinable()) {
+			{
+				std::unique_lock<std::mutex> lock(_pendingMutex);
+				_pendingFinish = true;
+				_pendingCondition.notify_one();
+			}
+			_writingThread.join();
+		}
+	}
+
+private:
+	std::unique_ptr<QFile> files[LogDataCount];
+	QTextStream streams[LogDataCount];
+
+	int32 part = -1;
+
+	// Plain text is appended to the last entry, the MTP data is kept as
+	// a shared buffer and serialized on the writing thread.
+	struct Pending {
+		QString text;
+		mtpBuffer data;
+		int offset = 0;
+		int size = 0;
+	};
+
+	// Debug logs are written in batches by a separate thread, so that
+	// the threads writing them don't wait for the disk.
+	std::thread _writingThread;
+	std::mutex _pendingMutex;
+	std::condition_variable _pendingCondition;
+	std::condition_variable _pendingWritten;
+	std::vector<Pending> _pending[LogDataCount];
+	int _pendingSize = 0; // Including the batch being written.
+	bool _pendingFinish = false;
+
+	// Postfix of the debug logs for the current part of the day and the
+	// count of the files it was continued in because of their size.
+	int32 debugDayIndex = 0;
+	QString debugPostfix;
+	int debugSizeParts[LogDataCount] = { 0 };
+
+	static QString Format(const std::vector<Pending> &entries) {
+		auto result = QString();
+		for (const auto &entry : entries) {
+			result += entry.text;
+			if (!entry.data.isEmpty()) {
+				auto from = entry.data.constData() + entry.offset;
+				result += mtpTextSerialize(from, from + entry.size);
+				result += '\n';
+			}
+		}
+		return result;
+	}
+
+	void writeNow(LogDataType type, const QString &msg) {
 		QMutexLocker lock(_logsMutex(type));
+		writeLocked(type, msg);
+	}
+
+	void writeLocked(LogDataType type, const QString &msg) {
 		if (type != LogDataMain) reopenDebug();
 		if (!streams[type].device()) return;
 
 		streams[type] << msg;
 		streams[type].flush();
+
+		if (type != LogDataMain
+			&& files[type]->size() >= kDebugLogPartSizeMax) {
+			rotateDebug(type);
+		}
 	}
 
-private:
-	std::unique_ptr<QFile> files[LogDataCount];
-	QTextStream streams[LogDataCount];
+	void rotateDebug(LogDataType type) {
+		const auto index = ++debugSizeParts[type];
+		reopen(type, debugDayIndex, debugPostfix + QString("_%1").arg(index));
+		trimDebugLogs();
+	}
 
-	int32 part = -1;
+	// Removes the oldest debug logs that are not written now.
+	void trimDebugLogs() {
+		auto opened = std::set<QString>();
+		for (const auto type : { LogDataDebug, LogDataTcp, LogDataMtp }) {
+			opened.emplace(QFileInfo(*files[type]).absoluteFilePath());
+		}
+		const auto directory = QDir(cWorkingDir() + qstr("DebugLogs"));
+		const auto entries = directory.entryInfoList(
+			QDir::Files | QDir::NoDotAndDotDot,
+			QDir::Time | QDir::Reversed);
+		auto total = qint64(0);
+		for (const auto &entry : entries) {
+			total += entry.size();
+		}
+		for (const auto &entry : entries) {
+			if (total <= kDebugLogsSizeMax) {
+				break;
+			}
+			const auto path = entry.absoluteFilePath();
+			if (opened.find(path) == opened.end() && QFile::remove(path)) {
+				total -= entry.size();
+			}
+		}
+	}
+
+	// The writing thread never waits for itself.
+	void waitForPendingSpace(std::unique_lock<std::mutex> &lock) {
+		if (std::this_thread::get_id() == _writingThread.get_id()) {
+			return;
+		}
+		_pendingWritten.wait(lock, [&] {
+			return _pendingFinish || (_pendingSize < kPendingSizeMax);
+		});
+	}
+
+	void startWritingThread() {
+		if (!_writingThread.joinable()) {
+			_writingThread = std::thread([this] { writingThreadLoop(); });
+		}
+	}
+
+	void writeLater(LogDataType type, const QString &msg) {
+		std::unique_lock<std::mutex> lock(_pendingMutex);
+		startWritingThread();
+		waitForPendingSpace(lock);
+		_pendingSize += msg.size() * sizeof(QChar);
+		auto &pending = _pending[type];
+		if (pending.empty() || !pending.back().data.isEmpty()) {
+			pending.push_back(Pending());
+			_pendingCondition.notify_one();
+		}
+		pending.back().text += msg;
+	}
+
+	void writingThreadLoop() {
+		std::vector<Pending> writing[LogDataCount];
+		auto hasPending = [&] {
+			for (const auto &pending : _pending) {
+				if (!pending.empty()) {
+					return true;
+				}
+			}
+			return false;
+		};
+		while (true) {
+			auto finish = false;
+			auto writingSize = 0;
+			{
+				std::unique_lock<std::mutex> lock(_pendingMutex);
+				_pendingCondition.wait(lock, [&] {
+					return _pendingFinish || hasPending();
+				});
+				for (auto i = 0; i != LogDataCount; ++i) {
+					std::swap(writing[i], _pending[i]);
+				}
+				writingSize = _pendingSize;
+				finish = _pendingFinish;
+			}
+			for (auto i = 0; i != LogDataCount; ++i) {
+				if (!writing[i].empty()) {
+					writeNow(LogDataType(i), Format(writing[i]));
+					writing[i].clear();
+				}
+			}
+			{
+				std::unique_lock<std::mutex> lock(_pendingMutex);
+				_pendingSize -= writingSize;
+				_pendingWritten.notify_all();
+			}
+			if (finish) {
+				return;
+			}
+		}
+	}
 
 	bool reopen(LogDataType type, int32 dayIndex, const QString &postfix) {
 		if (streams[type].device()) {
@@ -226,9 +431,16 @@ NEW LOGGING INSTANCE STARTED!!!\n\
 		int32 dayIndex = (tm.tm_year + 1900) * 10000 + (tm.tm_mon + 1) * 100 + tm.tm_mday;
 		QString postfix = QString("_%4_%5").arg((part * switchEach) / 60, 2, 10, QChar('0')).arg((part * switchEach) % 60, 2, 10, QChar('0'));
 
+		debugDayIndex = dayIndex;
+		debugPostfix = postfix;
+		for (auto &sizeParts : debugSizeParts) {
+			sizeParts = 0;
+		}
+
 		reopen(LogDataDebug, dayIndex, postfix);
 		reopen(LogDataTcp, dayIndex, postfix);
 		reopen(LogDataMtp, dayIndex, postfix);
+		trimDebugLogs();
 	}
 
 };
@@ -256,6 +468,22 @@ void _logsWrite(LogDataType type, const QString &msg) {
 	}
 }
 
+void _logsWriteData(
+		LogDataType type,
+		const QString &msg,
+		const mtpBuffer &data,
+		int offset,
+		int size) {
+	if (LogsData && LogsStartIndexChosen < 0) {
+		if (cDebug()) {
+			LogsData->writeLater(type, msg, data, offset, size);
+		}
+	} else {
+		auto from = data.constData() + offset;
+		_logsWrite(type, msg + mtpTextSerialize(from, from + size) + '\n');
+	}
+}
+
 namespace Logs {
 namespace {
 
@@ -537,6 +765,16 @@ void writeMtp(int32 dc, const QString &v) {
 	_logsWrite(LogDataMtp, msg);
 }
 
+void writeMtp(
+		int32 dc,
+		const QString &prefix,
+		const QVector<int32> &data,
+		int offset,
+		int size) {
+	QString msg(QString("%1 (dc:%2) %3").arg(_logsEntryStart()).arg(dc).arg(prefix));
+	_logsWriteData(LogDataMtp, msg, data, offset, size);
+}
+
 QString full() {
 	if (LogsData) {
 		return LogsData->full();
@@ -28,6 +28,14 @@ void writeDebug(const char *file, int32 line, const QString &v);
 void writeTcp(const QString &v);
 void writeMtp(int32 dc, const QString &v);
 
+// The data is serialized as a MTP message when the log is written.
+void writeMtp(
+	int32 dc,
+	const QString &prefix,
+	const QVector<int32> &data,
+	int offset,
+	int size);
+
 QString full();
 
 inline const char *b(bool v) {
@@ -73,3 +81,6 @@ inline MemoryBuffer mb(const void *ptr, uint32 size) {
 
 #define MTP_LOG(dc, msg) { if (cDebug() || !Logs::started()) Logs::writeMtp(dc, QString msg); }
 //usage MTP_LOG(dc, ("log: %1 %2").arg(1).arg(2))
+
+#define MTP_LOG_DATA(dc, prefix, data, offset, size) { if (cDebug() || !Logs::started()) Logs::writeMtp(dc, prefix, data, offset, size); }
+//usage MTP_LOG_DATA(dc, qsl("Send: "), buffer, 4, messageSize)
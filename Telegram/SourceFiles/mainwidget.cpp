@@ -3915,13 +3915,98 @@ bool MainWidget::ptsUpdateAndApply(int32 pts, int32 ptsCount) {
 	return _ptsWaiter.updateAndApply(nullptr, pts, ptsCount);
 }
 
+namespace {
+
+// Received updates larger than that are parsed in the background.
+constexpr auto kParseUpdatesAsyncMinSize = 4096;
+
+// Updates that only set some state, like a user status or a typing
+// action, can be skipped if a later update of the same batch sets it.
+class UpdatesCoalescer {
+public:
+	void add(const MTPUpdate &update) {
+		const auto key = Key(update);
+		if (!std::get<0>(key)) {
+			return;
+		}
+		const auto i = _last.find(key);
+		if (i != _last.end()) {
+			_superseded.insert(base::take(i->second));
+			i->second = &update;
+		} else {
+			_last.emplace(key, &update);
+		}
+	}
+	void add(const MTPVector<MTPUpdate> &updates) {
+		for (const auto &update : updates.v) {
+			add(update);
+		}
+	}
+
+	std::set<const MTPUpdate*> result() {
+		return std::move(_superseded);
+	}
+
+private:
+	using UpdateKey = std::tuple<mtpTypeId, uint64, int32>;
+
+	static UpdateKey Key(const MTPUpdate &update) {
+		switch (update.type()) {
+		case mtpc_updateUserStatus: {
+			const auto &d = update.c_updateUserStatus();
+			return { update.type(), d.vuser_id.v, 0 };
+		}
+		case mtpc_updateUserTyping: {
+			const auto &d = update.c_updateUserTyping();
+			return { update.type(), d.vuser_id.v, 0 };
+		}
+		case mtpc_updateChatUserTyping: {
+			const auto &d = update.c_updateChatUserTyping();
+			return { update.type(), d.vchat_id.v, d.vuser_id.v };
+		}
+		case mtpc_updateReadChannelInbox: {
+			const auto &d = update.c_updateReadChannelInbox();
+			return { update.type(), d.vchannel_id.v, 0 };
+		}
+		case mtpc_updateReadChannelOutbox: {
+			const auto &d = update.c_updateReadChannelOutbox();
+			return { update.type(), d.vchannel_id.v, 0 };
+		}
+		case mtpc_updateReadHistoryInbox: {
+			const auto &d = update.c_updateReadHistoryInbox();
+			return { update.type(), peerFromMTP(d.vpeer), 0 };
+		}
+		case mtpc_updateReadHistoryOutbox: {
+			const auto &d = update.c_updateReadHistoryOutbox();
+			return { update.type(), peerFromMTP(d.vpeer), 0 };
+		}
+		}
+		return { mtpTypeId(0), 0, 0 };
+	}
+
+	std::map<UpdateKey, const MTPUpdate*> _last;
+	std::set<const MTPUpdate*> _superseded;
+
+};
+
+} // namespace
+
 void MainWidget::feedDifference(const MTPVector<MTPUser> &users, const MTPVector<MTPChat> &chats, const MTPVector<MTPMessage> &msgs, const MTPVector<MTPUpdate> &other) {
 	Auth().checkAutoLock();
 	App::feedUsers(users);
 	App::feedChats(chats);
 	feedMessageIds(other);
 	App::feedMsgs(msgs, NewMessageUnread);
+
+	// The difference can be applied in the middle of a received batch.
+	auto coalescer = UpdatesCoalescer();
+	coalescer.add(other);
+	auto batchSuperseded = std::exchange(
+		_supersededUpdates,
+		coalescer.result());
 	feedUpdateVector(other, true);
+	_supersededUpdates = std::move(batchSuperseded);
+
 	_history->peerMessagesUpdated();
 }
 
@@ -4000,7 +4085,7 @@ void MainWidget::getDifference() {
 
 	_ptsWaiter.setRequesting(true);
 
-	MTP::send(MTPupdates_GetDifference(MTP_flags(0), MTP_int(_ptsWaiter.current()), MTPint(), MTP_int(updDate), MTP_int(updQts)), rpcDone(&MainWidget::gotDifference), rpcFail(&MainWidget::failDifference));
+	MTP::send(MTPupdates_GetDifference(MTP_flags(0), MTP_int(_ptsWaiter.current()), MTPint(), MTP_int(updDate), MTP_int(updQts)), rpcDone(&MainWidget::receivedDifference), rpcFail(&MainWidget::failDifference));
 }
 
 void MainWidget::getChannelDifference(ChannelData *channel, ChannelDifferenceRequest from) {
@@ -4589,36 +4674,167 @@ void MainWidget::checkIdleFinish() {
 	}
 }
 
+struct MainWidget::ReceivedUpdates {
+	bool parsed = false;
+	bool newSession = false;
+	bool valid = false;
+	bool decoded = false;
+	bool difference = false;
+	MTPUpdates updates;
+	MTPupdates_Difference differenceData;
+};
+
 void MainWidget::updateReceived(const mtpPrime *from, const mtpPrime *end) {
 	if (end <= from) return;
 
 	Auth().checkAutoLock();
 
+	// While the difference is requested the updates are dropped,
+	// so they are only validated instead of being decoded.
+	const auto decode = !requestingDifference();
+	if (_receivedUpdates.empty() && end - from < kParseUpdatesAsyncMinSize) {
+		applyReceivedUpdates(ParseReceivedUpdates(from, end, decode));
+		update();
+		return;
+	}
+	auto data = mtpBuffer(end - from);
+	memcpy(data.data(), from, (end - from) * sizeof(mtpPrime));
+	parseReceivedAsync(std::move(data), false, decode);
+}
+
+void MainWidget::receivedDifference(
+		const mtpPrime *from,
+		const mtpPrime *end) {
+	if (_receivedUpdates.empty() && end - from < kParseUpdatesAsyncMinSize) {
+		applyReceivedUpdates(ParseReceivedDifference(from, end));
+		return;
+	}
+	auto data = mtpBuffer(end - from);
+	memcpy(data.data(), from, (end - from) * sizeof(mtpPrime));
+	parseReceivedAsync(std::move(data), true, false);
+}
+
+void MainWidget::parseReceivedAsync(
+		mtpBuffer &&data,
+		bool difference,
+		bool decode) {
+	// Keep the place in the queue, so that everything is applied in the
+	// order it was received, and hold the RPC results until it is done.
+	const auto received = std::make_shared<ReceivedUpdates>();
+	_receivedUpdates.push_back(received);
+	if (!_receivedUpdatesPause) {
+		_receivedUpdatesPause = std::make_unique<MTP::PauseHolder>(
+			MTP::PauseHolder::Scope::MainSession);
+	}
+
+	const auto weak = make_weak(this);
+	crl::async([=, data = std::move(data)] {
+		const auto from = data.constData();
+		const auto end = from + data.size();
+		auto parsed = difference
+			? ParseReceivedDifference(from, end)
+			: ParseReceivedUpdates(from, end, decode);
+		crl::on_main(weak, [=, parsed = std::move(parsed)]() mutable {
+			*received = std::move(parsed);
+			applyParsedUpdates();
+		});
+	});
+}
+
+MainWidget::ReceivedUpdates MainWidget::ParseReceivedUpdates(
+		const mtpPrime *from,
+		const mtpPrime *end,
+		bool decode) {
+	auto result = ReceivedUpdates();
+	result.parsed = true;
 	if (mtpTypeId(*from) == mtpc_new_session_created) {
 		try {
 			MTPNewSession newSession;
 			newSession.read(from, end);
 		} catch (mtpErrorUnexpected &) {
 		}
-		updSeq = 0;
-		MTP_LOG(0, ("getDifference { after new_session_created }%1").arg(cTestMode() ? " TESTMODE" : ""));
-		return getDifference();
+		result.newSession = true;
 	} else {
 		try {
-			MTPUpdates updates;
-			updates.read(from, end);
-
-			_lastUpdateTime = getms(true);
-			noUpdatesTimer.start(NoUpdatesTimeout);
-			if (!requestingDifference()) {
-				feedUpdates(updates);
+			if (decode) {
+				MTP::internal::ReadResponse(result.updates, from, end);
+				result.decoded = true;
+			} else {
+				MTPUpdates::skip(from, end);
 			}
+			result.valid = true;
 		} catch (mtpErrorUnexpected &) { // just some other type
 		}
 	}
+	return result;
+}
+
+MainWidget::ReceivedUpdates MainWidget::ParseReceivedDifference(
+		const mtpPrime *from,
+		const mtpPrime *end) {
+	auto result = ReceivedUpdates();
+	result.parsed = true;
+	result.difference = true;
+	try {
+		MTP::internal::ReadResponse(result.differenceData, from, end);
+		result.valid = true;
+	} catch (Exception &e) {
+		LOG(("RPC Error in getDifference: could not parse, %1"
+			).arg(e.what()));
+	}
+	return result;
+}
+
+void MainWidget::applyParsedUpdates() {
+	auto batch = std::vector<std::shared_ptr<ReceivedUpdates>>();
+	while (!_receivedUpdates.empty() && _receivedUpdates.front()->parsed) {
+		batch.push_back(std::move(_receivedUpdates.front()));
+		_receivedUpdates.pop_front();
+	}
+	if (batch.empty()) {
+		return;
+	}
+
+	// Only short updates are coalesced, the others are checked by seq.
+	auto coalescer = UpdatesCoalescer();
+	for (const auto &received : batch) {
+		if (received->decoded
+			&& received->updates.type() == mtpc_updateShort) {
+			coalescer.add(received->updates.c_updateShort().vupdate);
+		}
+	}
+	_supersededUpdates = coalescer.result();
+	for (const auto &received : batch) {
+		applyReceivedUpdates(*received);
+	}
+	_supersededUpdates.clear();
+	if (_receivedUpdates.empty()) {
+		_receivedUpdatesPause = nullptr;
+	}
+
 	update();
 }
 
+void MainWidget::applyReceivedUpdates(const ReceivedUpdates &received) {
+	if (received.difference) {
+		if (received.valid) {
+			gotDifference(received.differenceData);
+		} else {
+			failDifferenceStartTimerFor(nullptr);
+		}
+	} else if (received.newSession) {
+		updSeq = 0;
+		MTP_LOG(0, ("getDifference { after new_session_created }%1").arg(cTestMode() ? " TESTMODE" : ""));
+		getDifference();
+	} else if (received.valid) {
+		_lastUpdateTime = getms(true);
+		noUpdatesTimer.start(NoUpdatesTimeout);
+		if (received.decoded && !requestingDifference()) {
+			feedUpdates(received.updates);
+		}
+	}
+}
+
 namespace {
 
 bool fwdInfoDataLoaded(const MTPMessageFwdHeader &header) {
@@ -4852,6 +5068,20 @@ void MainWidget::feedUpdates(const MTPUpdates &updates, uint64 randomId) {
 }
 
 void MainWidget::feedUpdate(const MTPUpdate &update) {
+	if (_supersededUpdates.find(&update) != _supersededUpdates.end()) {
+		// A later update sets the same state, but the pts still counts.
+		switch (update.type()) {
+		case mtpc_updateReadHistoryInbox: {
+			auto &d = update.c_updateReadHistoryInbox();
+			ptsUpdateAndApply(d.vpts.v, d.vpts_count.v);
+		} break;
+		case mtpc_updateReadHistoryOutbox: {
+			auto &d = update.c_updateReadHistoryOutbox();
+			ptsUpdateAndApply(d.vpts.v, d.vpts_count.v);
+		} break;
+		}
+		return;
+	}
 	switch (update.type()) {
 
 	// New messages.
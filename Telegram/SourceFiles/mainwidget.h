@@ -467,6 +467,7 @@ private:
 	void saveSectionInStack();
 
 	void getChannelDifference(ChannelData *channel, ChannelDifferenceRequest from = ChannelDifferenceRequest::Unknown);
+	void receivedDifference(const mtpPrime *from, const mtpPrime *end);
 	void gotDifference(const MTPupdates_Difference &diff);
 	bool failDifference(const RPCError &e);
 	void feedDifference(const MTPVector<MTPUser> &users, const MTPVector<MTPChat> &chats, const MTPVector<MTPMessage> &msgs, const MTPVector<MTPUpdate> &other);
@@ -482,7 +483,18 @@ private:
 	void deleteHistoryPart(DeleteHistoryRequest request, const MTPmessages_AffectedHistory &result);
 	void deleteAllFromUserPart(DeleteAllFromUserParams params, const MTPmessages_AffectedHistory &result);
 
+	struct ReceivedUpdates;
 	void updateReceived(const mtpPrime *from, const mtpPrime *end);
+	static ReceivedUpdates ParseReceivedUpdates(
+		const mtpPrime *from,
+		const mtpPrime *end,
+		bool decode);
+	static ReceivedUpdates ParseReceivedDifference(
+		const mtpPrime *from,
+		const mtpPrime *end);
+	void parseReceivedAsync(mtpBuffer &&data, bool difference, bool decode);
+	void applyParsedUpdates();
+	void applyReceivedUpdates(const ReceivedUpdates &received);
 	bool updateFail(const RPCError &e);
 
 	void usernameResolveDone(QPair<MsgId, QString> msgIdAndStartToken, const MTPcontacts_ResolvedPeer &result);
@@ -604,6 +616,14 @@ private:
 	QMap<int32, MTPUpdates> _bySeqUpdates;
 	SingleTimer _bySeqTimer;
 
+	// Large updates and differences are parsed in the background and
+	// applied in order, the RPC results are held until they are applied.
+	std::deque<std::shared_ptr<ReceivedUpdates>> _receivedUpdates;
+	std::unique_ptr<MTP::PauseHolder> _receivedUpdatesPause;
+
+	// Updates replaced by a later update of the batch being applied.
+	std::set<const MTPUpdate*> _supersededUpdates;
+
 	SingleTimer _byMinChannelTimer;
 
 	mtpRequestId _onlineRequest = 0;
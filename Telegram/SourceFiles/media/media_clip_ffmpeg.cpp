@@ -9,6 +9,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 
 #include "media/media_audio.h"
 #include "media/media_child_ffmpeg_loader.h"
+#include "media/media_clip_frame_pool.h"
 #include "storage/file_download.h"
 
 namespace Media {
@@ -19,22 +20,34 @@ namespace {
 constexpr int kSkipInvalidDataPackets = 10;
 constexpr int kAlignImageBy = 16;
 
+FramePool &Pool() {
+	// Never destroyed, images may release their buffers after exit().
+	static const auto result = new FramePool();
+	return *result;
+}
+
 void alignedImageBufferCleanupHandler(void *data) {
-	auto buffer = static_cast<uchar*>(data);
-	delete[] buffer;
+	const auto buffer = static_cast<uchar*>(data);
+	auto size = 0;
+	memcpy(&size, buffer, sizeof(size));
+	Pool().release(buffer, size, getms(true));
 }
 
 // Create a QImage of desired size where all the data is aligned to 16 bytes.
+//
+// The buffer size is stored in its first bytes, before the aligned data.
 QImage createAlignedImage(QSize size) {
 	auto width = size.width();
 	auto height = size.height();
 	auto widthalign = kAlignImageBy / 4;
 	auto neededwidth = width + ((width % widthalign) ? (widthalign - (width % widthalign)) : 0);
 	auto bytesperline = neededwidth * 4;
-	auto buffer = new uchar[bytesperline * height + kAlignImageBy];
+	auto buffersize = bytesperline * height + 2 * kAlignImageBy;
+	auto buffer = Pool().take(buffersize, getms(true));
+	memcpy(buffer, &buffersize, sizeof(buffersize));
 	auto cleanupdata = static_cast<void*>(buffer);
-	auto bufferval = reinterpret_cast<uintptr_t>(buffer);
-	auto alignedbuffer = buffer + ((bufferval % kAlignImageBy) ? (kAlignImageBy - (bufferval % kAlignImageBy)) : 0);
+	auto bufferval = reinterpret_cast<uintptr_t>(buffer + kAlignImageBy);
+	auto alignedbuffer = buffer + kAlignImageBy + ((bufferval % kAlignImageBy) ? (kAlignImageBy - (bufferval % kAlignImageBy)) : 0);
 	return QImage(alignedbuffer, width, height, bytesperline, QImage::Format_ARGB32, alignedImageBufferCleanupHandler, cleanupdata);
 }
 
@@ -44,6 +57,10 @@ bool isAlignedImage(const QImage &image) {
 
 } // namespace
 
+void ClearFramePool() {
+	Pool().clear();
+}
+
 FFMpegReaderImplementation::FFMpegReaderImplementation(FileLocation *location, QByteArray *data, const AudioMsgId &audio) : ReaderImplementation(location, data)
 , _audioMsgId(audio) {
 	_frame = av_frame_alloc();
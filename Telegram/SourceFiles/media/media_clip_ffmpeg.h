@@ -20,6 +20,9 @@ namespace Media {
 namespace Clip {
 namespace internal {
 
+// Frees the frame buffers kept for reuse by the FFmpeg clip readers.
+void ClearFramePool();
+
 class FFMpegReaderImplementation : public ReaderImplementation {
 public:
 	FFMpegReaderImplementation(FileLocation *location, QByteArray *data, const AudioMsgId &audio);
@@ -0,0 +1,85 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "media/media_clip_frame_pool.h"
+
+namespace Media {
+namespace Clip {
+namespace internal {
+namespace {
+
+constexpr auto kFramePoolBuffersPerSize = 3;
+constexpr auto kFramePoolSizeMax = 16 * 1024 * 1024;
+constexpr auto kFramePoolUnusedTimeout = qint64(3000);
+
+} // namespace
+
+uchar *FramePool::take(int size, qint64 now) {
+	QMutexLocker lock(&_mutex);
+	auto &buffers = use(size, now);
+	if (buffers.list.empty()) {
+		return new uchar[size];
+	}
+	auto result = buffers.list.back();
+	buffers.list.pop_back();
+	_pooledSize -= size;
+	return result;
+}
+
+void FramePool::release(uchar *buffer, int size, qint64 now) {
+	QMutexLocker lock(&_mutex);
+	auto &buffers = use(size, now);
+	if (int(buffers.list.size()) >= kFramePoolBuffersPerSize
+		|| _pooledSize + size > kFramePoolSizeMax) {
+		delete[] buffer;
+		return;
+	}
+	buffers.list.push_back(buffer);
+	_pooledSize += size;
+}
+
+void FramePool::clear() {
+	QMutexLocker lock(&_mutex);
+	for (const auto &[size, buffers] : _buffers) {
+		for (const auto buffer : buffers.list) {
+			delete[] buffer;
+		}
+	}
+	_buffers.clear();
+	_pooledSize = 0;
+}
+
+int FramePool::pooledSize() const {
+	QMutexLocker lock(&_mutex);
+	return _pooledSize;
+}
+
+FramePool::~FramePool() {
+	clear();
+}
+
+auto FramePool::use(int size, qint64 now) -> Buffers& {
+	for (auto i = _buffers.begin(); i != _buffers.end();) {
+		if (i->first != size
+			&& i->second.used + kFramePoolUnusedTimeout <= now) {
+			for (const auto buffer : i->second.list) {
+				delete[] buffer;
+			}
+			_pooledSize -= int(i->second.list.size()) * i->first;
+			i = _buffers.erase(i);
+		} else {
+			++i;
+		}
+	}
+	auto &result = _buffers[size];
+	result.used = now;
+	return result;
+}
+
+} // namespace internal
+} // namespace Clip
+} // namespace Media
@@ -0,0 +1,50 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+#include <QtCore/QMutex>
+#include <map>
+#include <vector>
+
+namespace Media {
+namespace Clip {
+namespace internal {
+
+// Frame buffers released by the images are kept here and reused for the
+// next frames of the same size, so all clip threads share a few buffers
+// instead of allocating a new one for each rendered frame. The buffers of
+// a size that was not used for a few seconds are freed.
+//
+// The current time is passed by the caller, getms(true) in the readers.
+class FramePool {
+public:
+	uchar *take(int size, qint64 now);
+	void release(uchar *buffer, int size, qint64 now);
+	void clear();
+
+	int pooledSize() const;
+
+	~FramePool();
+
+private:
+	struct Buffers {
+		std::vector<uchar*> list;
+		qint64 used = 0;
+	};
+
+	Buffers &use(int size, qint64 now);
+
+	mutable QMutex _mutex;
+	std::map<int, Buffers> _buffers;
+	int _pooledSize = 0;
+
+};
+
+} // namespace internal
+} // namespace Clip
+} // namespace Media
@@ -0,0 +1,107 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "catch.hpp"
+
+#include "media/media_clip_frame_pool.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+using Media::Clip::internal::FramePool;
+
+namespace {
+
+constexpr auto kFrameSize = 640 * 360 * 4 + 32;
+
+} // namespace
+
+TEST_CASE("frame pool reuses released buffers", "[frame_pool]") {
+	FramePool pool;
+	const auto first = pool.take(kFrameSize, 0);
+	REQUIRE(pool.pooledSize() == 0);
+
+	pool.release(first, kFrameSize, 0);
+	REQUIRE(pool.pooledSize() == kFrameSize);
+
+	const auto second = pool.take(kFrameSize, 10);
+	REQUIRE(second == first);
+	REQUIRE(pool.pooledSize() == 0);
+	pool.release(second, kFrameSize, 10);
+}
+
+TEST_CASE("frame pool keeps only a few buffers per size", "[frame_pool]") {
+	FramePool pool;
+	uchar *buffers[5] = { nullptr };
+	for (auto &buffer : buffers) {
+		buffer = pool.take(kFrameSize, 0);
+	}
+	for (const auto buffer : buffers) {
+		pool.release(buffer, kFrameSize, 0);
+	}
+	REQUIRE(pool.pooledSize() == 3 * kFrameSize);
+}
+
+TEST_CASE("frame pool frees unused sizes", "[frame_pool]") {
+	FramePool pool;
+	const auto small = 1024;
+	pool.release(pool.take(small, 0), small, 0);
+	pool.release(pool.take(kFrameSize, 0), kFrameSize, 0);
+	REQUIRE(pool.pooledSize() == small + kFrameSize);
+
+	SECTION("sizes used recently are kept") {
+		pool.release(pool.take(kFrameSize, 2000), kFrameSize, 2000);
+		REQUIRE(pool.pooledSize() == small + kFrameSize);
+	}
+	SECTION("sizes not used for a few seconds are freed") {
+		pool.release(pool.take(kFrameSize, 5000), kFrameSize, 5000);
+		REQUIRE(pool.pooledSize() == kFrameSize);
+	}
+	SECTION("clear frees everything") {
+		pool.clear();
+		REQUIRE(pool.pooledSize() == 0);
+	}
+}
+
+TEST_CASE("frame pool benchmark", "[.][benchmark][frame_pool]") {
+	// Each frame buffer is filled, like sws_scale() does for the frames.
+	const auto frames = 2000;
+	const auto measure = [&](auto &&take, auto &&release) {
+		const auto start = std::chrono::steady_clock::now();
+		for (auto i = 0; i != frames; ++i) {
+			const auto buffer = take();
+			std::memset(buffer, i & 0xFF, kFrameSize);
+			release(buffer);
+		}
+		const auto time = std::chrono::steady_clock::now() - start;
+		return std::chrono::duration<double, std::micro>(time).count()
+			/ frames;
+	};
+
+	const auto allocated = measure([] {
+		return new uchar[kFrameSize];
+	}, [](uchar *buffer) {
+		delete[] buffer;
+	});
+
+	FramePool pool;
+	auto now = qint64(0);
+	const auto pooled = measure([&] {
+		return pool.take(kFrameSize, now += 40);
+	}, [&](uchar *buffer) {
+		pool.release(buffer, kFrameSize, now);
+	});
+
+	std::cout
+		<< "640x360 frames, allocated: "
+		<< allocated
+		<< " us/frame, pooled: "
+		<< pooled
+		<< " us/frame"
+		<< std::endl;
+}
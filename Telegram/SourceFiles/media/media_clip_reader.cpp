@@ -28,6 +28,29 @@ namespace {
 QVector<QThread*> threads;
 QVector<Manager*> managers;
 
+bool CanCopyOpaqueFrame(const QImage &original) {
+	switch (original.format()) {
+	case QImage::Format_RGB32:
+	case QImage::Format_ARGB32:
+	case QImage::Format_ARGB32_Premultiplied: return true;
+	default: return false;
+	}
+}
+
+void CopyOpaqueFrame(const QImage &original, QImage &cache) {
+	Expects(original.size() == cache.size());
+	Expects(cache.format() == QImage::Format_ARGB32_Premultiplied);
+
+	const auto from = original.constBits();
+	const auto fromPerLine = original.bytesPerLine();
+	const auto to = cache.bits();
+	const auto toPerLine = cache.bytesPerLine();
+	const auto bytesPerLine = original.width() * 4;
+	for (auto y = 0, height = original.height(); y != height; ++y) {
+		memcpy(to + y * toPerLine, from + y * fromPerLine, bytesPerLine);
+	}
+}
+
 QImage PrepareFrameImage(const FrameRequest &request, const QImage &original, bool hasAlpha, QImage &cache) {
 	auto needResize = (original.width() != request.framew) || (original.height() != request.frameh);
 	auto needOuterFill = (request.outerw != request.framew) || (request.outerh != request.frameh);
@@ -42,7 +65,12 @@ QImage PrepareFrameImage(const FrameRequest &request, const QImage &original, bo
 		cache = QImage(request.outerw, request.outerh, QImage::Format_ARGB32_Premultiplied);
 		cache.setDevicePixelRatio(factor);
 	}
-	{
+	if (!needResize && !needOuterFill && !hasAlpha && CanCopyOpaqueFrame(original)) {
+		// Opaque pixels are the same in ARGB32 and premultiplied ARGB32,
+		// so the frame can be copied to the cache row by row and rounded
+		// there without drawing it with QPainter.
+		CopyOpaqueFrame(original, cache);
+	} else {
 		Painter p(&cache);
 		if (needNewCache) {
 			if (request.framew < request.outerw) {
@@ -907,6 +935,7 @@ void Finish() {
 		threads.clear();
 		managers.clear();
 	}
+	internal::ClearFramePool();
 }
 
 } // namespace Clip
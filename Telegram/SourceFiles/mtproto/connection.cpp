@@ -33,6 +33,10 @@ constexpr auto kMaxModExpSize = 256;
 // Don't try to handle messages larger than this size.
 constexpr auto kMaxMessageLength = 16 * 1024 * 1024;
 
+// Keep the encrypted messages buffer for the next requests up to this size,
+// so that uploading file parts doesn't allocate and clear it every time.
+constexpr auto kKeepSendBufferSize = 1024 * 1024;
+
 QString LogIdsVector(const QVector<MTPlong> &ids) {
 	if (!ids.size()) return "[]";
 	auto idsStr = QString("[%1").arg(ids.cbegin()->v);
@@ -192,9 +196,9 @@ ModExpFirst CreateModExp(
 
 void wrapInvokeAfter(mtpRequest &to, const mtpRequest &from, const mtpRequestMap &haveSent, int32 skipBeforeRequest = 0) {
 	mtpMsgId afterId(*(mtpMsgId*)(from->after->data() + 4));
-	mtpRequestMap::const_iterator i = afterId ? haveSent.constFind(afterId) : haveSent.cend();
+	auto i = afterId ? haveSent.find(afterId) : haveSent.cend();
 	int32 size = to->size(), lenInInts = (from.innerLength() >> 2), headlen = 4, fulllen = headlen + lenInInts;
-	if (i == haveSent.constEnd()) { // no invoke after or such msg was not sent or was completed recently
+	if (i == haveSent.cend()) { // no invoke after or such msg was not sent or was completed recently
 		to->resize(size + fulllen + skipBeforeRequest);
 		if (skipBeforeRequest) {
 			memcpy(to->data() + size, from->constData() + 4, headlen * sizeof(mtpPrime));
@@ -477,14 +481,14 @@ void ConnectionPrivate::resetSession() { // recreate all msg_id and msg_seqno
 	mtpRequestMap setSeqNumbers;
 	typedef QMap<mtpMsgId, mtpMsgId> Replaces;
 	Replaces replaces;
-	for (mtpRequestMap::const_iterator i = haveSent.cbegin(), e = haveSent.cend(); i != e; ++i) {
-		if (!mtpRequestData::isSentContainer(i.value())) {
-			if (!*(mtpMsgId*)(i.value()->constData() + 4)) continue;
+	for (auto i = haveSent.cbegin(), e = haveSent.cend(); i != e; ++i) {
+		if (!mtpRequestData::isSentContainer(i->second)) {
+			if (!*(mtpMsgId*)(i->second->constData() + 4)) continue;
 
-			mtpMsgId id = i.key();
+			mtpMsgId id = i->first;
 			if (id > newId) {
 				while (true) {
-					if (toResend.constFind(newId) == toResend.cend() && wereAcked.constFind(newId) == wereAcked.cend() && haveSent.constFind(newId) == haveSent.cend()) {
+					if (!toResend.contains(newId) && !wereAcked.contains(newId) && !haveSent.contains(newId)) {
 						break;
 					}
 					mtpMsgId m = msgid();
@@ -496,22 +500,22 @@ void ConnectionPrivate::resetSession() { // recreate all msg_id and msg_seqno
 				MTP_LOG(_shiftedDcId, ("Replacing msgId %1 to %2!").arg(id).arg(newId));
 				replaces.insert(id, newId);
 				id = newId;
-				*(mtpMsgId*)(i.value()->data() + 4) = id;
+				*(mtpMsgId*)(i->second->data() + 4) = id;
 			}
-			setSeqNumbers.insert(id, i.value());
+			setSeqNumbers[id] = i->second;
 		}
 	}
-	for (mtpRequestIdsMap::const_iterator i = toResend.cbegin(), e = toResend.cend(); i != e; ++i) { // collect all non-container requests
-		mtpPreRequestMap::const_iterator j = toSend.constFind(i.value());
+	for (auto i = toResend.cbegin(), e = toResend.cend(); i != e; ++i) { // collect all non-container requests
+		auto j = toSend.find(i->second);
 		if (j == toSend.cend()) continue;
 
-		if (!mtpRequestData::isSentContainer(j.value())) {
-			if (!*(mtpMsgId*)(j.value()->constData() + 4)) continue;
+		if (!mtpRequestData::isSentContainer(j->second)) {
+			if (!*(mtpMsgId*)(j->second->constData() + 4)) continue;
 
-			mtpMsgId id = i.key();
+			mtpMsgId id = i->first;
 			if (id > newId) {
 				while (true) {
-					if (toResend.constFind(newId) == toResend.cend() && wereAcked.constFind(newId) == wereAcked.cend() && haveSent.constFind(newId) == haveSent.cend()) {
+					if (!toResend.contains(newId) && !wereAcked.contains(newId) && !haveSent.contains(newId)) {
 						break;
 					}
 					mtpMsgId m = msgid();
@@ -523,9 +527,9 @@ void ConnectionPrivate::resetSession() { // recreate all msg_id and msg_seqno
 				MTP_LOG(_shiftedDcId, ("Replacing msgId %1 to %2!").arg(id).arg(newId));
 				replaces.insert(id, newId);
 				id = newId;
-				*(mtpMsgId*)(j.value()->data() + 4) = id;
+				*(mtpMsgId*)(j->second->data() + 4) = id;
 			}
-			setSeqNumbers.insert(id, j.value());
+			setSeqNumbers[id] = j->second;
 		}
 	}
 
@@ -533,35 +537,35 @@ void ConnectionPrivate::resetSession() { // recreate all msg_id and msg_seqno
 	DEBUG_LOG(("MTP Info: creating new session after bad_msg_notification, setting random server_session %1").arg(session));
 	sessionData->setSession(session);
 
-	for (mtpRequestMap::const_iterator i = setSeqNumbers.cbegin(), e = setSeqNumbers.cend(); i != e; ++i) { // generate new seq_numbers
-		bool wasNeedAck = (*(i.value()->data() + 6) & 1);
-		*(i.value()->data() + 6) = sessionData->nextRequestSeqNumber(wasNeedAck);
+	for (auto i = setSeqNumbers.cbegin(), e = setSeqNumbers.cend(); i != e; ++i) { // generate new seq_numbers
+		bool wasNeedAck = (*(i->second->data() + 6) & 1);
+		*(i->second->data() + 6) = sessionData->nextRequestSeqNumber(wasNeedAck);
 	}
 	if (!replaces.isEmpty()) {
 		for (Replaces::const_iterator i = replaces.cbegin(), e = replaces.cend(); i != e; ++i) { // replace msgIds keys in all data structs
-			mtpRequestMap::iterator j = haveSent.find(i.key());
+			auto j = haveSent.find(i.key());
 			if (j != haveSent.cend()) {
-				mtpRequest req = j.value();
+				mtpRequest req = j->second;
 				haveSent.erase(j);
-				haveSent.insert(i.value(), req);
+				haveSent[i.value()] = req;
 			}
-			mtpRequestIdsMap::iterator k = toResend.find(i.key());
+			auto k = toResend.find(i.key());
 			if (k != toResend.cend()) {
-				mtpRequestId req = k.value();
+				mtpRequestId req = k->second;
 				toResend.erase(k);
-				toResend.insert(i.value(), req);
+				toResend[i.value()] = req;
 			}
 			k = wereAcked.find(i.key());
 			if (k != wereAcked.cend()) {
-				mtpRequestId req = k.value();
+				mtpRequestId req = k->second;
 				wereAcked.erase(k);
-				wereAcked.insert(i.value(), req);
+				wereAcked[i.value()] = req;
 			}
 		}
-		for (mtpRequestMap::const_iterator i = haveSent.cbegin(), e = haveSent.cend(); i != e; ++i) { // replace msgIds in saved containers
-			if (mtpRequestData::isSentContainer(i.value())) {
-				mtpMsgId *ids = (mtpMsgId *)(i.value()->data() + 8);
-				for (uint32 j = 0, l = (i.value()->size() - 8) >> 1; j < l; ++j) {
+		for (auto i = haveSent.cbegin(), e = haveSent.cend(); i != e; ++i) { // replace msgIds in saved containers
+			if (mtpRequestData::isSentContainer(i->second)) {
+				mtpMsgId *ids = (mtpMsgId *)(i->second->data() + 8);
+				for (uint32 j = 0, l = (i->second->size() - 8) >> 1; j < l; ++j) {
 					Replaces::const_iterator k = replaces.constFind(ids[j]);
 					if (k != replaces.cend()) {
 						ids[j] = k.value();
@@ -586,11 +590,7 @@ mtpMsgId ConnectionPrivate::prepareToSend(mtpRequest &request, mtpMsgId currentL
 	mtpMsgId msgId = *(mtpMsgId*)(request->constData() + 4);
 	if (msgId) { // resending this request
 		QWriteLocker locker(sessionData->toResendMutex());
-		mtpRequestIdsMap &toResend(sessionData->toResendMap());
-		mtpRequestIdsMap::iterator i = toResend.find(msgId);
-		if (i != toResend.cend()) {
-			toResend.erase(i);
-		}
+		sessionData->toResendMap().remove(msgId);
 	} else {
 		msgId = *(mtpMsgId*)(request->data() + 4) = currentLastId;
 		*(request->data() + 6) = sessionData->nextRequestSeqNumber(mtpRequestData::needAck(request));
@@ -612,7 +612,7 @@ mtpMsgId ConnectionPrivate::replaceMsgId(mtpRequest &request, mtpMsgId newId) {
 			mtpRequestMap &haveSent(sessionData->haveSentMap());
 
 			while (true) {
-				if (toResend.constFind(newId) == toResend.cend() && wereAcked.constFind(newId) == wereAcked.cend() && haveSent.constFind(newId) == haveSent.cend()) {
+				if (!toResend.contains(newId) && !wereAcked.contains(newId) && !haveSent.contains(newId)) {
 					break;
 				}
 				mtpMsgId m = msgid();
@@ -621,29 +621,29 @@ mtpMsgId ConnectionPrivate::replaceMsgId(mtpRequest &request, mtpMsgId newId) {
 				newId = m;
 			}
 
-			mtpRequestIdsMap::iterator i = toResend.find(oldMsgId);
+			auto i = toResend.find(oldMsgId);
 			if (i != toResend.cend()) {
-				mtpRequestId req = i.value();
+				mtpRequestId req = i->second;
 				toResend.erase(i);
-				toResend.insert(newId, req);
+				toResend[newId] = req;
 			}
 
-			mtpRequestIdsMap::iterator j = wereAcked.find(oldMsgId);
+			auto j = wereAcked.find(oldMsgId);
 			if (j != wereAcked.cend()) {
-				mtpRequestId req = j.value();
+				mtpRequestId req = j->second;
 				wereAcked.erase(j);
-				wereAcked.insert(newId, req);
+				wereAcked[newId] = req;
 			}
 
-			mtpRequestMap::iterator k = haveSent.find(oldMsgId);
+			auto k = haveSent.find(oldMsgId);
 			if (k != haveSent.cend()) {
-				mtpRequest req = k.value();
+				mtpRequest req = k->second;
 				haveSent.erase(k);
-				haveSent.insert(newId, req);
+				haveSent[newId] = req;
 			}
 
-			for (k = haveSent.begin(); k != haveSent.cend(); ++k) {
-				mtpRequest req(k.value());
+			for (k = haveSent.begin(); k != haveSent.end(); ++k) {
+				mtpRequest req(k->second);
 				if (mtpRequestData::isSentContainer(req)) {
 					mtpMsgId *ids = (mtpMsgId *)(req->data() + 8);
 					for (uint32 i = 0, l = (req->size() - 8) >> 1; i < l; ++i) {
@@ -751,10 +751,10 @@ void ConnectionPrivate::tryToSend() {
 		{
 			QWriteLocker locker(sessionData->stateRequestMutex());
 			mtpMsgIdsSet &ids(sessionData->stateRequestMap());
-			if (!ids.isEmpty()) {
+			if (!ids.empty()) {
 				stateReq.reserve(ids.size());
-				for (mtpMsgIdsSet::const_iterator i = ids.cbegin(), e = ids.cend(); i != e; ++i) {
-					stateReq.push_back(MTP_long(i.key()));
+				for (const auto msgId : ids) {
+					stateReq.push_back(MTP_long(msgId));
 				}
 			}
 			ids.clear();
@@ -795,7 +795,9 @@ void ConnectionPrivate::tryToSend() {
 	bool needAnyResponse = false;
 	mtpRequest toSendRequest;
 	{
-		QWriteLocker locker1(sessionData->toSendMutex());
+		ContentionWriteLocker locker1(
+			sessionData->toSendMutex(),
+			sessionData->toSendContention());
 
 		mtpPreRequestMap toSendDummy, &toSend(prependOnly ? toSendDummy : sessionData->toSendMap());
 		if (prependOnly) locker1.unlock();
@@ -809,7 +811,7 @@ void ConnectionPrivate::tryToSend() {
 
 		if (!toSendCount) return; // nothing to send
 
-		mtpRequest first = pingRequest ? pingRequest : (ackRequest ? ackRequest : (resendRequest ? resendRequest : (stateRequest ? stateRequest : (httpWaitRequest ? httpWaitRequest : toSend.cbegin().value()))));
+		mtpRequest first = pingRequest ? pingRequest : (ackRequest ? ackRequest : (resendRequest ? resendRequest : (stateRequest ? stateRequest : (httpWaitRequest ? httpWaitRequest : toSend.cbegin()->second))));
 		if (toSendCount == 1 && first->msDate > 0) { // if can send without container
 			toSendRequest = first;
 			if (!prependOnly) {
@@ -831,7 +833,7 @@ void ConnectionPrivate::tryToSend() {
 
 					QWriteLocker locker2(sessionData->haveSentMutex());
 					mtpRequestMap &haveSent(sessionData->haveSentMap());
-					haveSent.insert(msgId, toSendRequest);
+					haveSent[msgId] = toSendRequest;
 
 					if (needsLayer && !toSendRequest->needsLayer) needsLayer = false;
 					if (toSendRequest->after) {
@@ -857,7 +859,7 @@ void ConnectionPrivate::tryToSend() {
 					needAnyResponse = true;
 				} else {
 					QWriteLocker locker3(sessionData->wereAckedMutex());
-					sessionData->wereAckedMap().insert(msgId, toSendRequest->requestId);
+					sessionData->wereAckedMap()[msgId] = toSendRequest->requestId;
 				}
 			}
 		} else { // send in container
@@ -868,9 +870,9 @@ void ConnectionPrivate::tryToSend() {
 			if (resendRequest) containerSize += mtpRequestData::messageSize(resendRequest);
 			if (stateRequest) containerSize += mtpRequestData::messageSize(stateRequest);
 			if (httpWaitRequest) containerSize += mtpRequestData::messageSize(httpWaitRequest);
-			for (mtpPreRequestMap::iterator i = toSend.begin(), e = toSend.end(); i != e; ++i) {
-				containerSize += mtpRequestData::messageSize(i.value());
-				if (needsLayer && i.value()->needsLayer) {
+			for (auto i = toSend.begin(), e = toSend.end(); i != e; ++i) {
+				containerSize += mtpRequestData::messageSize(i->second);
+				if (needsLayer && i->second->needsLayer) {
 					containerSize += initSizeInInts;
 					willNeedInit = true;
 				}
@@ -905,8 +907,8 @@ void ConnectionPrivate::tryToSend() {
 			} else if (resendRequest || stateRequest) {
 				needAnyResponse = true;
 			}
-			for (mtpPreRequestMap::iterator i = toSend.begin(), e = toSend.end(); i != e; ++i) {
-				mtpRequest &req(i.value());
+			for (auto i = toSend.begin(), e = toSend.end(); i != e; ++i) {
+				mtpRequest &req(i->second);
 				mtpMsgId msgId = prepareToSend(req, bigMsgId);
 				if (msgId > bigMsgId) msgId = replaceMsgId(req, bigMsgId);
 				if (msgId >= bigMsgId) bigMsgId = msgid();
@@ -931,11 +933,11 @@ void ConnectionPrivate::tryToSend() {
 							*(toSendRequest->data() + reqNeedsLayer + 3) += initSize;
 							added = true;
 						}
-						haveSent.insert(msgId, req);
+						haveSent[msgId] = req;
 
 						needAnyResponse = true;
 					} else {
-						wereAcked.insert(msgId, req->requestId);
+						wereAcked[msgId] = req->requestId;
 					}
 				}
 				if (!added) {
@@ -947,7 +949,7 @@ void ConnectionPrivate::tryToSend() {
 			if (stateRequest) {
 				mtpMsgId msgId = placeToContainer(toSendRequest, bigMsgId, haveSentArr, stateRequest);
 				stateRequest->msDate = 0; // 0 for state request, do not request state of it
-				haveSent.insert(msgId, stateRequest);
+				haveSent[msgId] = stateRequest;
 			}
 			if (resendRequest) placeToContainer(toSendRequest, bigMsgId, haveSentArr, resendRequest);
 			if (ackRequest) placeToContainer(toSendRequest, bigMsgId, haveSentArr, ackRequest);
@@ -956,7 +958,7 @@ void ConnectionPrivate::tryToSend() {
 			mtpMsgId contMsgId = prepareToSend(toSendRequest, bigMsgId);
 			*(mtpMsgId*)(haveSentIdsWrap->data() + 4) = contMsgId;
 			(*haveSentIdsWrap)[6] = 0; // for container, msDate = 0, seqNo = 0
-			haveSent.insert(contMsgId, haveSentIdsWrap);
+			haveSent[contMsgId] = haveSentIdsWrap;
 			toSend.clear();
 		}
 	}
@@ -1286,19 +1288,20 @@ void ConnectionPrivate::handleReceived() {
 			return restartOnError();
 		}
 
-		auto encryptedInts = ints + kExternalHeaderIntsCount;
+		// Decrypt in place, the received buffer is not shared with anyone.
+		// After that the ints starting from kExternalHeaderIntsCount are plain.
+		auto encryptedInts = intsBuffer.data() + kExternalHeaderIntsCount;
 		auto encryptedIntsCount = (intsCount - kExternalHeaderIntsCount);
 		auto encryptedBytesCount = encryptedIntsCount * kIntSize;
-		auto decryptedBuffer = QByteArray(encryptedBytesCount, Qt::Uninitialized);
 		auto msgKey = *(MTPint128*)(ints + 2);
 
 #ifdef TDESKTOP_MTPROTO_OLD
-		aesIgeDecrypt_oldmtp(encryptedInts, decryptedBuffer.data(), encryptedBytesCount, key, msgKey);
+		aesIgeDecrypt_oldmtp(encryptedInts, encryptedInts, encryptedBytesCount, key, msgKey);
 #else // TDESKTOP_MTPROTO_OLD
-		aesIgeDecrypt(encryptedInts, decryptedBuffer.data(), encryptedBytesCount, key, msgKey);
+		aesIgeDecrypt(encryptedInts, encryptedInts, encryptedBytesCount, key, msgKey);
 #endif // TDESKTOP_MTPROTO_OLD
 
-		auto decryptedInts = reinterpret_cast<const mtpPrime*>(decryptedBuffer.constData());
+		auto decryptedInts = static_cast<const mtpPrime*>(encryptedInts);
 		auto serverSalt = *(uint64*)&decryptedInts[0];
 		auto session = *(uint64*)&decryptedInts[2];
 		auto msgId = *(uint64*)&decryptedInts[4];
@@ -1329,7 +1332,7 @@ void ConnectionPrivate::handleReceived() {
 		constexpr auto kMsgKeyShift_oldmtp = 4U;
 		if (memcmp(&msgKey, sha1ForMsgKeyCheck.data() + kMsgKeyShift_oldmtp, sizeof(msgKey)) != 0) {
 			LOG(("TCP Error: bad SHA1 hash after aesDecrypt in message."));
-			TCP_LOG(("TCP Error: bad message %1").arg(Logs::mb(encryptedInts, encryptedBytesCount).str()));
+			TCP_LOG(("TCP Error: bad decrypted message %1").arg(Logs::mb(decryptedInts, encryptedBytesCount).str()));
 
 			return restartOnError();
 		}
@@ -1349,7 +1352,7 @@ void ConnectionPrivate::handleReceived() {
 		constexpr auto kMsgKeyShift = 8U;
 		if (memcmp(&msgKey, sha256Buffer.data() + kMsgKeyShift, sizeof(msgKey)) != 0) {
 			LOG(("TCP Error: bad SHA256 hash after aesDecrypt in message"));
-			TCP_LOG(("TCP Error: bad message %1").arg(Logs::mb(encryptedInts, encryptedBytesCount).str()));
+			TCP_LOG(("TCP Error: bad decrypted message %1").arg(Logs::mb(decryptedInts, encryptedBytesCount).str()));
 
 			return restartOnError();
 		}
@@ -1357,7 +1360,7 @@ void ConnectionPrivate::handleReceived() {
 
 		if (badMessageLength || (messageLength & 0x03)) {
 			LOG(("TCP Error: bad msg_len received %1, data size: %2").arg(messageLength).arg(encryptedBytesCount));
-			TCP_LOG(("TCP Error: bad message %1").arg(Logs::mb(encryptedInts, encryptedBytesCount).str()));
+			TCP_LOG(("TCP Error: bad decrypted message %1").arg(Logs::mb(decryptedInts, encryptedBytesCount).str()));
 
 			return restartOnError();
 		}
@@ -1411,7 +1414,7 @@ void ConnectionPrivate::handleReceived() {
 		auto from = decryptedInts + kEncryptedHeaderIntsCount;
 		auto end = from + (messageLength / kIntSize);
 		auto sfrom = decryptedInts + 4U; // msg_id + seq_no + length + message
-		MTP_LOG(_shiftedDcId, ("Recv: ") + mtpTextSerialize(sfrom, end));
+		MTP_LOG_DATA(_shiftedDcId, qsl("Recv: "), intsBuffer, sfrom - intsBuffer.constData(), end - sfrom);
 
 		bool needToHandle = false;
 		{
@@ -1419,7 +1422,11 @@ void ConnectionPrivate::handleReceived() {
 			needToHandle = sessionData->receivedIdsSet().registerMsgId(msgId, needAck);
 		}
 		if (needToHandle) {
+			// A top-level rpc_result or updates can take the decrypted
+			// buffer itself instead of copying the data out of it.
+			_receivedBuffer = &intsBuffer;
 			res = handleOneReceived(from, end, msgId, serverTime, serverSalt, badTime);
+			_receivedBuffer = nullptr;
 		}
 		{
 			QWriteLocker lock(sessionData->receivedIdsMutex());
@@ -1469,8 +1476,35 @@ void ConnectionPrivate::handleReceived() {
 	}
 }
 
+mtpBuffer ConnectionPrivate::takeReceivedSlice(const mtpPrime *from, const mtpPrime *end) {
+	Expects(end >= from);
+
+	const auto size = int(end - from);
+	const auto buffer = base::take(_receivedBuffer);
+	if (buffer) {
+		const auto begin = buffer->constData();
+		if (from >= begin && end <= begin + buffer->size()) {
+			auto result = std::move(*buffer);
+			if (size > 0) {
+				memmove(result.data(), from, size * sizeof(mtpPrime));
+			}
+			result.resize(size);
+			return result;
+		}
+	}
+	auto result = mtpBuffer(size);
+	if (size > 0) {
+		memcpy(result.data(), from, size * sizeof(mtpPrime));
+	}
+	return result;
+}
+
 ConnectionPrivate::HandleResult ConnectionPrivate::handleOneReceived(const mtpPrime *from, const mtpPrime *end, uint64 msgId, int32 serverTime, uint64 serverSalt, bool badTime) {
 	mtpTypeId cons = *from;
+	if (cons == mtpc_gzip_packed || cons == mtpc_msg_container) {
+		// The received buffer is shared by several messages now.
+		_receivedBuffer = nullptr;
+	}
 	try {
 
 	switch (cons) {
@@ -1584,11 +1618,11 @@ ConnectionPrivate::HandleResult ConnectionPrivate::handleOneReceived(const mtpPr
 						QWriteLocker locker(sessionData->haveSentMutex());
 						mtpRequestMap &haveSent(sessionData->haveSentMap());
 
-						mtpRequestMap::const_iterator i = haveSent.constFind(resendId);
+						auto i = haveSent.find(resendId);
 						if (i == haveSent.cend()) {
 							LOG(("Message Error: Container not found!"));
 						} else {
-							request = i.value();
+							request = i->second;
 						}
 					}
 					if (request) {
@@ -1705,7 +1739,6 @@ ConnectionPrivate::HandleResult ConnectionPrivate::handleOneReceived(const mtpPr
 
 			QReadLocker locker(sessionData->wereAckedMutex());
 			const mtpRequestIdsMap &wereAcked(sessionData->wereAckedMap());
-			mtpRequestIdsMap::const_iterator wereAckedEnd(wereAcked.cend());
 
 			for (uint32 i = 0, l = idsCount; i < l; ++i) {
 				char state = 0;
@@ -1720,7 +1753,7 @@ ConnectionPrivate::HandleResult ConnectionPrivate::handleOneReceived(const mtpPr
 						state |= 0x02;
 					} else {
 						state |= 0x04;
-						if (wereAcked.constFind(reqMsgId) != wereAckedEnd) {
+						if (wereAcked.contains(reqMsgId)) {
 							state |= 0x80; // we know, that server knows, that we received request
 						}
 						if (msgIdState == ReceivedMsgIds::State::NeedsAck) { // need ack, so we sent ack
@@ -1749,7 +1782,7 @@ ConnectionPrivate::HandleResult ConnectionPrivate::handleOneReceived(const mtpPr
 		{ // find this request in session-shared sent requests map
 			QReadLocker locker(sessionData->haveSentMutex());
 			const mtpRequestMap &haveSent(sessionData->haveSentMap());
-			mtpRequestMap::const_iterator replyTo = haveSent.constFind(reqMsgId);
+			auto replyTo = haveSent.find(reqMsgId);
 			if (replyTo == haveSent.cend()) { // do not look in toResend, because we do not resend msgs_state_req requests
 				DEBUG_LOG(("Message Error: such message was not sent recently %1").arg(reqMsgId));
 				return (badTime ? HandleResult::Ignored : HandleResult::Success);
@@ -1762,7 +1795,7 @@ ConnectionPrivate::HandleResult ConnectionPrivate::handleOneReceived(const mtpPr
 
 				badTime = false;
 			}
-			requestBuffer = replyTo.value();
+			requestBuffer = replyTo->second;
 		}
 		QVector<MTPlong> toAckReq(1, MTP_long(reqMsgId)), toAck;
 		requestsAcked(toAck, true);
@@ -1912,8 +1945,7 @@ ConnectionPrivate::HandleResult ConnectionPrivate::handleOneReceived(const mtpPr
 			}
 			typeId = response[0];
 		} else {
-			response.resize(end - from);
-			memcpy(response.data(), from, (end - from) * sizeof(mtpPrime));
+			response = takeReceivedSlice(from, end);
 		}
 		if (typeId != mtpc_rpc_error) {
 			// An error could be some RPC_CALL_FAIL or other error inside
@@ -1928,7 +1960,9 @@ ConnectionPrivate::HandleResult ConnectionPrivate::handleOneReceived(const mtpPr
 		auto requestId = wasSent(reqMsgId.v);
 		if (requestId && requestId != mtpRequestId(0xFFFFFFFF)) {
 			// Save rpc_result for processing in the main thread.
-			QWriteLocker locker(sessionData->haveReceivedMutex());
+			ContentionWriteLocker locker(
+				sessionData->haveReceivedMutex(),
+				sessionData->haveReceivedContention());
 			sessionData->haveReceivedResponses().insert(requestId, response);
 		} else {
 			DEBUG_LOG(("RPC Info: requestId not found for msgId %1").arg(reqMsgId.v));
@@ -1959,9 +1993,9 @@ ConnectionPrivate::HandleResult ConnectionPrivate::handleOneReceived(const mtpPr
 			QReadLocker locker(sessionData->haveSentMutex());
 			const mtpRequestMap &haveSent(sessionData->haveSentMap());
 			toResend.reserve(haveSent.size());
-			for (mtpRequestMap::const_iterator i = haveSent.cbegin(), e = haveSent.cend(); i != e; ++i) {
-				if (i.key() >= firstMsgId) break;
-				if (i.value()->requestId) toResend.push_back(i.key());
+			for (auto i = haveSent.cbegin(), e = haveSent.cend(); i != e; ++i) {
+				if (i->first >= firstMsgId) break;
+				if (i->second->requestId) toResend.push_back(i->first);
 			}
 		}
 		resendMany(toResend, 10, true);
@@ -2023,12 +2057,13 @@ ConnectionPrivate::HandleResult ConnectionPrivate::handleOneReceived(const mtpPr
 	}
 
 	if (_dcType == DcType::Regular) {
-		mtpBuffer update(end - from);
-		if (end > from) memcpy(update.data(), from, (end - from) * sizeof(mtpPrime));
+		auto update = takeReceivedSlice(from, end);
 
 		// Notify main process about the new updates.
-		QWriteLocker locker(sessionData->haveReceivedMutex());
-		sessionData->haveReceivedUpdates().push_back(SerializedMessage(update));
+		ContentionWriteLocker locker(
+			sessionData->haveReceivedMutex(),
+			sessionData->haveReceivedContention());
+		sessionData->haveReceivedUpdates().push_back(std::move(update));
 
 		if (cons != mtpc_updatesTooLong && cons != mtpc_updateShortMessage && cons != mtpc_updateShortChatMessage && cons != mtpc_updateShortSentMessage && cons != mtpc_updateShort && cons != mtpc_updatesCombined && cons != mtpc_updates) {
 			LOG(("Message Error: unknown constructor %1").arg(cons)); // maybe new api?..
@@ -2118,25 +2153,25 @@ void ConnectionPrivate::requestsAcked(const QVector<MTPlong> &ids, bool byRespon
 
 			for (uint32 i = 0; i < idsCount; ++i) {
 				mtpMsgId msgId = ids[i].v;
-				mtpRequestMap::iterator req = haveSent.find(msgId);
+				auto req = haveSent.find(msgId);
 				if (req != haveSent.cend()) {
-					if (!req.value()->msDate) {
+					if (!req->second->msDate) {
 						DEBUG_LOG(("Message Info: container ack received, msgId %1").arg(ids[i].v));
-						uint32 inContCount = ((*req)->size() - 8) / 2;
-						const mtpMsgId *inContId = (const mtpMsgId *)(req.value()->constData() + 8);
+						uint32 inContCount = (req->second->size() - 8) / 2;
+						const mtpMsgId *inContId = (const mtpMsgId *)(req->second->constData() + 8);
 						toAckMore.reserve(toAckMore.size() + inContCount);
 						for (uint32 j = 0; j < inContCount; ++j) {
 							toAckMore.push_back(MTP_long(*(inContId++)));
 						}
 						haveSent.erase(req);
 					} else {
-						mtpRequestId reqId = req.value()->requestId;
+						mtpRequestId reqId = req->second->requestId;
 						bool moveToAcked = byResponse;
 						if (!moveToAcked) { // ignore ACK, if we need a response (if we have a handler)
 							moveToAcked = !_instance->hasCallbacks(reqId);
 						}
 						if (moveToAcked) {
-							wereAcked.insert(msgId, reqId);
+							wereAcked[msgId] = reqId;
 							haveSent.erase(req);
 						} else {
 							DEBUG_LOG(("Message Info: ignoring ACK for msgId %1 because request %2 requires a response").arg(msgId).arg(reqId));
@@ -2146,9 +2181,9 @@ void ConnectionPrivate::requestsAcked(const QVector<MTPlong> &ids, bool byRespon
 					DEBUG_LOG(("Message Info: msgId %1 was not found in recent sent, while acking requests, searching in resend...").arg(msgId));
 					QWriteLocker locker3(sessionData->toResendMutex());
 					mtpRequestIdsMap &toResend(sessionData->toResendMap());
-					mtpRequestIdsMap::iterator reqIt = toResend.find(msgId);
+					auto reqIt = toResend.find(msgId);
 					if (reqIt != toResend.cend()) {
-						mtpRequestId reqId = reqIt.value();
+						mtpRequestId reqId = reqIt->second;
 						bool moveToAcked = byResponse;
 						if (!moveToAcked) { // ignore ACK, if we need a response (if we have a handler)
 							moveToAcked = !_instance->hasCallbacks(reqId);
@@ -2156,11 +2191,11 @@ void ConnectionPrivate::requestsAcked(const QVector<MTPlong> &ids, bool byRespon
 						if (moveToAcked) {
 							QWriteLocker locker4(sessionData->toSendMutex());
 							mtpPreRequestMap &toSend(sessionData->toSendMap());
-							mtpPreRequestMap::iterator req = toSend.find(reqId);
+							auto req = toSend.find(reqId);
 							if (req != toSend.cend()) {
-								wereAcked.insert(msgId, req.value()->requestId);
-								if (req.value()->requestId != reqId) {
-									DEBUG_LOG(("Message Error: for msgId %1 found resent request, requestId %2, contains requestId %3").arg(msgId).arg(reqId).arg(req.value()->requestId));
+								wereAcked[msgId] = req->second->requestId;
+								if (req->second->requestId != reqId) {
+									DEBUG_LOG(("Message Error: for msgId %1 found resent request, requestId %2, contains requestId %3").arg(msgId).arg(reqId).arg(req->second->requestId));
 								} else {
 									DEBUG_LOG(("Message Info: acked msgId %1 that was prepared to resend, requestId %2").arg(msgId).arg(reqId));
 								}
@@ -2182,14 +2217,15 @@ void ConnectionPrivate::requestsAcked(const QVector<MTPlong> &ids, bool byRespon
 		uint32 ackedCount = wereAcked.size();
 		if (ackedCount > MTPIdsBufferSize) {
 			DEBUG_LOG(("Message Info: removing some old acked sent msgIds %1").arg(ackedCount - MTPIdsBufferSize));
-			clearedBecauseTooOld.reserve(ackedCount - MTPIdsBufferSize);
-			while (ackedCount-- > MTPIdsBufferSize) {
-				auto i = wereAcked.begin();
+			const auto removeCount = int(ackedCount - MTPIdsBufferSize);
+			clearedBecauseTooOld.reserve(removeCount);
+			const auto till = std::next(wereAcked.begin(), removeCount);
+			for (auto i = wereAcked.begin(); i != till; ++i) {
 				clearedBecauseTooOld.push_back(RPCCallbackClear(
-					i.key(),
+					i->first,
 					RPCError::TimeoutError));
-				wereAcked.erase(i);
 			}
+			wereAcked.erase(wereAcked.begin(), till);
 		}
 	}
 
@@ -2220,13 +2256,11 @@ void ConnectionPrivate::handleMsgsStates(const QVector<MTPlong> &ids, const QByt
 		{
 			QReadLocker locker(sessionData->haveSentMutex());
 			const mtpRequestMap &haveSent(sessionData->haveSentMap());
-			mtpRequestMap::const_iterator haveSentEnd = haveSent.cend();
-			if (haveSent.find(requestMsgId) == haveSentEnd) {
+			if (!haveSent.contains(requestMsgId)) {
 				DEBUG_LOG(("Message Info: state was received for msgId %1, but request is not found, looking in resent requests...").arg(requestMsgId));
 				QWriteLocker locker2(sessionData->toResendMutex());
 				mtpRequestIdsMap &toResend(sessionData->toResendMap());
-				mtpRequestIdsMap::iterator reqIt = toResend.find(requestMsgId);
-				if (reqIt != toResend.cend()) {
+				if (toResend.contains(requestMsgId)) {
 					if ((state & 0x07) != 0x04) { // was received
 						DEBUG_LOG(("Message Info: state was received for msgId %1, state %2, already resending in container").arg(requestMsgId).arg((int32)state));
 					} else {
@@ -2977,8 +3011,7 @@ bool ConnectionPrivate::sendRequest(mtpRequest &request, bool needAnyResponse, Q
 	memcpy(request->data() + 0, &salt, 2 * sizeof(mtpPrime));
 	memcpy(request->data() + 2, &session, 2 * sizeof(mtpPrime));
 
-	auto from = request->constData() + 4;
-	MTP_LOG(_shiftedDcId, ("Send: ") + mtpTextSerialize(from, from + messageSize));
+	MTP_LOG_DATA(_shiftedDcId, qsl("Send: "), *request, 4, messageSize);
 
 #ifdef TDESKTOP_MTPROTO_OLD
 	uint32 padding = fullSize - 4 - messageSize;
@@ -2987,7 +3020,7 @@ bool ConnectionPrivate::sendRequest(mtpRequest &request, bool needAnyResponse, Q
 	MTPint128 &msgKey(*(MTPint128*)(encryptedSHA + 4));
 	hashSha1(request->constData(), (fullSize - padding) * sizeof(mtpPrime), encryptedSHA);
 
-	mtpBuffer result;
+	auto &result = _sendBuffer;
 	result.resize(9 + fullSize);
 	*((uint64*)&result[2]) = keyId;
 	*((MTPint128*)&result[4]) = msgKey;
@@ -3003,7 +3036,7 @@ bool ConnectionPrivate::sendRequest(mtpRequest &request, bool needAnyResponse, Q
 	SHA256_Update(&msgKeyLargeContext, request->constData(), fullSize * sizeof(mtpPrime));
 	SHA256_Final(encryptedSHA256, &msgKeyLargeContext);
 
-	mtpBuffer result;
+	auto &result = _sendBuffer;
 	result.resize(9 + fullSize);
 	*((uint64*)&result[2]) = keyId;
 	*((MTPint128*)&result[4]) = msgKey;
@@ -3019,6 +3052,9 @@ bool ConnectionPrivate::sendRequest(mtpRequest &request, bool needAnyResponse, Q
 	if (needAnyResponse) {
 		onSentSome(result.size() * sizeof(mtpPrime));
 	}
+	if (result.capacity() * kIntSize > kKeepSendBufferSize) {
+		result = mtpBuffer();
+	}
 
 	return true;
 }
@@ -3028,20 +3064,20 @@ mtpRequestId ConnectionPrivate::wasSent(mtpMsgId msgId) const {
 	{
 		QReadLocker locker(sessionData->haveSentMutex());
 		const mtpRequestMap &haveSent(sessionData->haveSentMap());
-		mtpRequestMap::const_iterator i = haveSent.constFind(msgId);
-		if (i != haveSent.cend()) return i.value()->requestId ? i.value()->requestId : mtpRequestId(0xFFFFFFFF);
+		auto i = haveSent.find(msgId);
+		if (i != haveSent.cend()) return i->second->requestId ? i->second->requestId : mtpRequestId(0xFFFFFFFF);
 	}
 	{
 		QReadLocker locker(sessionData->toResendMutex());
 		const mtpRequestIdsMap &toResend(sessionData->toResendMap());
-		mtpRequestIdsMap::const_iterator i = toResend.constFind(msgId);
-		if (i != toResend.cend()) return i.value();
+		auto i = toResend.find(msgId);
+		if (i != toResend.cend()) return i->second;
 	}
 	{
 		QReadLocker locker(sessionData->wereAckedMutex());
 		const mtpRequestIdsMap &wereAcked(sessionData->wereAckedMap());
-		mtpRequestIdsMap::const_iterator i = wereAcked.constFind(msgId);
-		if (i != wereAcked.cend()) return i.value();
+		auto i = wereAcked.find(msgId);
+		if (i != wereAcked.cend()) return i->second;
 	}
 	return 0;
 }
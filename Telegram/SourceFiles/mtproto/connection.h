@@ -173,6 +173,9 @@ private:
 	};
 	HandleResult handleOneReceived(const mtpPrime *from, const mtpPrime *end, uint64 msgId, int32 serverTime, uint64 serverSalt, bool badTime);
 	mtpBuffer ungzip(const mtpPrime *from, const mtpPrime *end) const;
+
+	// Moves the decrypted buffer out if it is not shared, copies otherwise.
+	mtpBuffer takeReceivedSlice(const mtpPrime *from, const mtpPrime *end);
 	void handleMsgsStates(const QVector<MTPlong> &ids, const QByteArray &states, QVector<MTPlong> &acked);
 
 	void clearMessages();
@@ -209,6 +212,8 @@ private:
 	TimeMs firstSentAt = -1;
 
 	QVector<MTPlong> ackRequestData, resendRequestData;
+	mtpBuffer *_receivedBuffer = nullptr; // Decrypted message being handled.
+	mtpBuffer _sendBuffer; // Encrypted message being sent, reused.
 
 	// if badTime received - search for ids in sessionData->haveSent and sessionData->wereAcked and sync time/salt, return true if found
 	bool requestsFixTimeSalt(const QVector<MTPlong> &ids, int32 serverTime, uint64 serverSalt);
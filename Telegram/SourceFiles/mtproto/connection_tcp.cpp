@@ -14,6 +14,10 @@ namespace internal {
 
 namespace {
 
+constexpr auto kReadChunkMin = 64 * 1024;
+constexpr auto kReadChunkMax = 4 * 1024 * 1024;
+constexpr auto kReadBufferKeep = MTPShortBufferSize * int(sizeof(mtpPrime));
+
 uint32 tcpPacketSize(const char *packet) { // must have at least 4 bytes readable
 	uint32 result = (packet[0] > 0) ? packet[0] : 0;
 	if (result == 0x7f) {
@@ -27,11 +31,7 @@ uint32 tcpPacketSize(const char *packet) { // must have at least 4 bytes readabl
 } // namespace
 
 AbstractTCPConnection::AbstractTCPConnection(QThread *thread) : AbstractConnection(thread)
-, packetNum(0)
-, packetRead(0)
-, packetLeft(0)
-, readingToShort(true)
-, currentPos((char*)shortBuffer) {
+, packetNum(0) {
 }
 
 AbstractTCPConnection::~AbstractTCPConnection() {
@@ -45,71 +45,42 @@ void AbstractTCPConnection::socketRead() {
 	}
 
 	do {
-		uint32 toRead = packetLeft ? packetLeft : (readingToShort ? (MTPShortBufferSize * sizeof(mtpPrime) - packetRead) : 4);
-		if (readingToShort) {
-			if (currentPos + toRead > ((char*)shortBuffer) + MTPShortBufferSize * sizeof(mtpPrime)) {
-				longBuffer.resize(((packetRead + toRead) >> 2) + 1);
-				memcpy(&longBuffer[0], shortBuffer, packetRead);
-				currentPos = ((char*)&longBuffer[0]) + packetRead;
-				readingToShort = false;
-			}
-		} else {
-			if (longBuffer.size() * sizeof(mtpPrime) < packetRead + toRead) {
-				longBuffer.resize(((packetRead + toRead) >> 2) + 1);
-				currentPos = ((char*)&longBuffer[0]) + packetRead;
-			}
+		// Read everything that is available at once, decrypt it in one
+		// call and then handle all the complete packets in place.
+		const auto available = sock.bytesAvailable();
+		const auto toRead = snap(int(qMin(available, qint64(kReadChunkMax))), kReadChunkMin, kReadChunkMax);
+		if (_readBuffer.size() < size_t(_readBytes + toRead)) {
+			_readBuffer.resize(_readBytes + toRead);
 		}
-		int32 bytes = (int32)sock.read(currentPos, toRead);
+		const auto buffer = _readBuffer.data();
+		const auto bytes = int(sock.read(buffer + _readBytes, toRead));
 		if (bytes > 0) {
-			aesCtrEncrypt(currentPos, bytes, _receiveKey, &_receiveState);
+			aesCtrEncrypt(buffer + _readBytes, bytes, _receiveKey, &_receiveState);
 			TCP_LOG(("TCP Info: read %1 bytes").arg(bytes));
 
-			packetRead += bytes;
-			currentPos += bytes;
-			if (packetLeft) {
-				packetLeft -= bytes;
-				if (!packetLeft) {
-					socketPacket(currentPos - packetRead, packetRead);
-					currentPos = (char*)shortBuffer;
-					packetRead = packetLeft = 0;
-					readingToShort = true;
-					longBuffer.clear();
-				} else {
-					TCP_LOG(("TCP Info: not enough %1 for packet! read %2").arg(packetLeft).arg(packetRead));
+			_readBytes += bytes;
+			auto handled = 0;
+			while (_readBytes - handled >= 4) {
+				const auto packet = buffer + handled;
+				const auto packetSize = tcpPacketSize(packet);
+				if (packetSize < 5 || packetSize > MTPPacketSizeMax) {
+					LOG(("TCP Error: packet size = %1").arg(packetSize));
+					emit error(kErrorCodeOther);
+					return;
+				} else if (uint32(_readBytes - handled) < packetSize) {
+					TCP_LOG(("TCP Info: not enough %1 for packet! size %2 read %3").arg(packetSize - (_readBytes - handled)).arg(packetSize).arg(_readBytes - handled));
 					emit receivedSome();
+					break;
 				}
-			} else {
-				bool move = false;
-				while (packetRead >= 4) {
-					uint32 packetSize = tcpPacketSize(currentPos - packetRead);
-					if (packetSize < 5 || packetSize > MTPPacketSizeMax) {
-						LOG(("TCP Error: packet size = %1").arg(packetSize));
-						emit error(kErrorCodeOther);
-						return;
-					}
-					if (packetRead >= packetSize) {
-						socketPacket(currentPos - packetRead, packetSize);
-						packetRead -= packetSize;
-						packetLeft = 0;
-						move = true;
-					} else {
-						packetLeft = packetSize - packetRead;
-						TCP_LOG(("TCP Info: not enough %1 for packet! size %2 read %3").arg(packetLeft).arg(packetSize).arg(packetRead));
-						emit receivedSome();
-						break;
-					}
-				}
-				if (move) {
-					if (!packetRead) {
-						currentPos = (char*)shortBuffer;
-						readingToShort = true;
-						longBuffer.clear();
-					} else if (!readingToShort && packetRead < MTPShortBufferSize * sizeof(mtpPrime)) {
-						memcpy(shortBuffer, currentPos - packetRead, packetRead);
-						currentPos = (char*)shortBuffer + packetRead;
-						readingToShort = true;
-						longBuffer.clear();
-					}
+				socketPacket(packet, packetSize);
+				handled += packetSize;
+			}
+			if (handled > 0) {
+				_readBytes -= handled;
+				if (_readBytes > 0) {
+					memmove(buffer, buffer + handled, _readBytes);
+				} else if (_readBuffer.size() > size_t(kReadBufferKeep)) {
+					_readBuffer = std::vector<char>();
 				}
 			}
 		} else if (bytes < 0) {
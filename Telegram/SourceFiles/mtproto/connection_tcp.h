@@ -30,11 +30,10 @@ protected:
 	QTcpSocket sock;
 	uint32 packetNum; // sent packet number
 
-	uint32 packetRead, packetLeft; // reading from socket
-	bool readingToShort;
-	char *currentPos;
-	mtpBuffer longBuffer;
-	mtpPrime shortBuffer[MTPShortBufferSize];
+	// Decrypted received bytes, complete packets are handled in place,
+	// only the beginning of the last incomplete packet is kept.
+	std::vector<char> _readBuffer;
+	int _readBytes = 0;
 	virtual void socketPacket(const char *packet, uint32 length) = 0;
 
 	static mtpBuffer handleResponse(const char *packet, uint32 length);
@@ -9,6 +9,96 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 
 #include "zlib.h"
 
+namespace MTP {
+namespace internal {
+namespace {
+
+// Responses smaller than that are parsed with the usual allocations.
+constexpr auto kArenaMinResponseSize = std::size_t(16 * 1024);
+
+// A value that is kept after the response is handled holds its whole
+// block, so the blocks are small: it is still tens of allocations less.
+constexpr auto kArenaBlockSize = std::size_t(4 * 1024);
+
+// Each allocation remembers its block.
+struct alignas(std::max_align_t) AllocationHeader {
+	void *block = nullptr;
+};
+constexpr auto kHeaderSize = sizeof(AllocationHeader);
+
+thread_local TypeDataArena *CurrentArena = nullptr;
+
+} // namespace
+
+struct alignas(std::max_align_t) TypeDataArena::Block {
+	// Allocations alive plus one for the arena while it fills the block.
+	QAtomicInt counter = { 1 };
+	std::size_t offset = sizeof(Block);
+};
+
+TypeDataArena::~TypeDataArena() {
+	if (_block) {
+		ReleaseBlock(_block);
+	}
+}
+
+void *TypeDataArena::allocate(std::size_t size) {
+	constexpr auto kAlignment = alignof(std::max_align_t);
+	size = kHeaderSize + ((size + kAlignment - 1) / kAlignment) * kAlignment;
+	if (sizeof(Block) + size > kArenaBlockSize) {
+		return nullptr;
+	} else if (!_block || _block->offset + size > kArenaBlockSize) {
+		if (_block) {
+			ReleaseBlock(_block);
+		}
+		_block = new (::operator new(kArenaBlockSize)) Block();
+	}
+	const auto memory = reinterpret_cast<char*>(_block) + _block->offset;
+	_block->offset += size;
+	_block->counter.ref();
+
+	const auto header = new (memory) AllocationHeader();
+	header->block = _block;
+	return memory + kHeaderSize;
+}
+
+void TypeDataArena::Free(const void *memory) {
+	const auto header = reinterpret_cast<const AllocationHeader*>(
+		static_cast<const char*>(memory) - kHeaderSize);
+	ReleaseBlock(static_cast<Block*>(header->block));
+}
+
+void TypeDataArena::ReleaseBlock(Block *block) {
+	if (!block->counter.deref()) {
+		block->~Block();
+		::operator delete(block);
+	}
+}
+
+TypeDataArenaScope::TypeDataArenaScope(
+		const mtpPrime *from,
+		const mtpPrime *end)
+: _previous(CurrentArena) {
+	const auto size = std::size_t(end - from) * sizeof(mtpPrime);
+	if (size >= kArenaMinResponseSize) {
+		_arena = std::make_unique<TypeDataArena>();
+		CurrentArena = _arena.get();
+	}
+}
+
+TypeDataArenaScope::~TypeDataArenaScope() {
+	if (_arena) {
+		CurrentArena = _previous;
+	}
+}
+
+TypeDataArena *CurrentTypeDataArena() {
+	return CurrentArena;
+}
+
+} // namespace internal
+} // namespace MTP
+
 uint32 MTPstring::innerLength() const {
 	uint32 l = v.length();
 	if (l < 254) {
@@ -41,6 +131,21 @@ void MTPstring::read(const mtpPrime *&from, const mtpPrime *end, mtpTypeId cons)
 	v = QByteArray(reinterpret_cast<const char*>(buf), l);
 }
 
+void MTPstring::skip(const mtpPrime *&from, const mtpPrime *end, mtpTypeId cons) {
+	if (from + 1 > end) throw mtpErrorInsufficient();
+	if (cons != mtpc_string) throw mtpErrorUnexpected(cons, "MTPstring");
+
+	const uchar *buf = (const uchar*)from;
+	if (buf[0] == 254) {
+		const auto l = (uint32)buf[1] + ((uint32)buf[2] << 8) + ((uint32)buf[3] << 16);
+		from += ((l + 4) >> 2) + (((l + 4) & 0x03) ? 1 : 0);
+	} else {
+		const auto l = (uint32)buf[0];
+		from += ((l + 1) >> 2) + (((l + 1) & 0x03) ? 1 : 0);
+	}
+	if (from > end) throw mtpErrorInsufficient();
+}
+
 void MTPstring::write(mtpBuffer &to) const {
 	uint32 l = v.length(), s = l + ((l < 254) ? 1 : 4), was = to.size();
 	if (s & 0x03) {
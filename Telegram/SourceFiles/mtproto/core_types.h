@@ -9,6 +9,8 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 
 #include "core/basic_types.h"
 #include "base/flags.h"
+#include "base/flat_map.h"
+#include "base/flat_set.h"
 
 namespace MTP {
 
@@ -84,24 +86,41 @@ private:
 
 };
 
-using mtpPreRequestMap = QMap<mtpRequestId, mtpRequest>;
-using mtpRequestMap = QMap<mtpMsgId, mtpRequest>;
-using mtpMsgIdsSet = QMap<mtpMsgId, bool>;
-
-class mtpRequestIdsMap : public QMap<mtpMsgId, mtpRequestId> {
+// The requests to send and the state requests are few and are taken
+// all at once, so a flat map keeps them in one contiguous storage.
+using mtpPreRequestMap = base::flat_map<mtpRequestId, mtpRequest>;
+using mtpMsgIdsSet = base::flat_set<mtpMsgId>;
+
+// The sent, acked and resent requests are erased one by one by the ids
+// in acks, responses and resends, which can be anywhere in thousands of
+// requests in flight. A flat map moves a half of its entries on each of
+// those erases, so these maps stay node based.
+template <typename Value>
+class mtpMsgIdsMap : public std::map<mtpMsgId, Value> {
 public:
-	using ParentType = QMap<mtpMsgId, mtpRequestId>;
+	using ParentType = std::map<mtpMsgId, Value>;
+
+	bool contains(mtpMsgId msgId) const {
+		return (this->find(msgId) != this->end());
+	}
+
+	bool remove(mtpMsgId msgId) {
+		return (this->erase(msgId) != 0);
+	}
 
 	mtpMsgId min() const {
-		return size() ? cbegin().key() : 0;
+		return this->empty() ? 0 : this->begin()->first;
 	}
 
 	mtpMsgId max() const {
-		ParentType::const_iterator e(cend());
-		return size() ? (--e).key() : 0;
+		return this->empty() ? 0 : this->rbegin()->first;
 	}
+
 };
 
+using mtpRequestMap = mtpMsgIdsMap<mtpRequest>;
+using mtpRequestIdsMap = mtpMsgIdsMap<mtpRequestId>;
+
 class mtpErrorUnexpected : public Exception {
 public:
 	mtpErrorUnexpected(mtpTypeId typeId, const QString &type) : Exception(QString("MTP Unexpected type id #%1 read in %2").arg(uint32(typeId), 0, 16).arg(type), false) { // maybe api changed?..
@@ -126,6 +145,53 @@ public:
 namespace MTP {
 namespace internal {
 
+// Bump allocator for the data of the types read from a large response,
+// so that parsing doesn't do a heap allocation for each constructor.
+// Each block is returned only when all the data allocated in it is
+// destroyed, so any single value that is kept for long holds its whole
+// block. Blocks are kept small to limit the memory pinned that way.
+class TypeDataArena {
+public:
+	TypeDataArena() = default;
+	TypeDataArena(const TypeDataArena &other) = delete;
+	TypeDataArena &operator=(const TypeDataArena &other) = delete;
+	~TypeDataArena();
+
+	// Returns nullptr if the size doesn't fit in a block.
+	void *allocate(std::size_t size);
+	static void Free(const void *memory);
+
+private:
+	struct Block;
+	static void ReleaseBlock(Block *block);
+
+	Block *_block = nullptr;
+
+};
+
+// While alive the data of the types read in this thread is allocated
+// in an arena, if the response being read is large enough for that.
+class TypeDataArenaScope {
+public:
+	TypeDataArenaScope(const mtpPrime *from, const mtpPrime *end);
+	TypeDataArenaScope(const TypeDataArenaScope &other) = delete;
+	TypeDataArenaScope &operator=(const TypeDataArenaScope &other) = delete;
+	~TypeDataArenaScope();
+
+private:
+	std::unique_ptr<TypeDataArena> _arena;
+	TypeDataArena *_previous = nullptr;
+
+};
+
+TypeDataArena *CurrentTypeDataArena();
+
+template <typename Type>
+void ReadResponse(Type &response, const mtpPrime *from, const mtpPrime *end) {
+	TypeDataArenaScope arena(from, end);
+	response.read(from, end);
+}
+
 class TypeData {
 public:
 	TypeData() = default;
@@ -144,12 +210,37 @@ private:
 	bool decrementCounter() const {
 		return _counter.deref();
 	}
+	static void Destroy(const TypeData *data) {
+		if (data->_inArena) {
+			data->~TypeData();
+			TypeDataArena::Free(data);
+		} else {
+			delete data;
+		}
+	}
 	friend class TypeDataOwner;
 
+	template <typename DataType>
+	friend DataType *CreateTypeData();
+
 	mutable QAtomicInt _counter = { 1 };
+	bool _inArena = false;
 
 };
 
+// Creates the data of a type being read, in the current arena if any.
+template <typename DataType>
+DataType *CreateTypeData() {
+	if (const auto arena = CurrentTypeDataArena()) {
+		if (const auto memory = arena->allocate(sizeof(DataType))) {
+			const auto result = new (memory) DataType();
+			result->_inArena = true;
+			return result;
+		}
+	}
+	return new DataType();
+}
+
 class TypeDataOwner {
 public:
 	TypeDataOwner(TypeDataOwner &&other) : _data(base::take(other._data)) {
@@ -200,7 +291,7 @@ private:
 	}
 	void decrementCounter() {
 		if (_data && !_data->decrementCounter()) {
-			delete base::take(_data);
+			TypeData::Destroy(base::take(_data));
 		}
 	}
 
@@ -295,6 +386,11 @@ public:
 		cons = (mtpTypeId)*(from++);
 		bareT::read(from, end, cons);
 	}
+	static void skip(const mtpPrime *&from, const mtpPrime *end, mtpTypeId cons = 0) {
+		if (from + 1 > end) throw mtpErrorInsufficient();
+		cons = (mtpTypeId)*(from++);
+		bareT::skip(from, end, cons);
+	}
 	void write(mtpBuffer &to) const {
         to.push_back(bareT::type());
 		bareT::write(to);
@@ -325,6 +421,11 @@ public:
 		if (cons != mtpc_int) throw mtpErrorUnexpected(cons, "MTPint");
 		v = (int32)*(from++);
 	}
+	static void skip(const mtpPrime *&from, const mtpPrime *end, mtpTypeId cons = mtpc_int) {
+		if (from + 1 > end) throw mtpErrorInsufficient();
+		if (cons != mtpc_int) throw mtpErrorUnexpected(cons, "MTPint");
+		++from;
+	}
 	void write(mtpBuffer &to) const {
 		to.push_back((mtpPrime)v);
 	}
@@ -368,6 +469,11 @@ public:
 		if (cons != mtpc_flags) throw mtpErrorUnexpected(cons, "MTPflags");
 		v = Flags::from_raw(static_cast<typename Flags::Type>(*(from++)));
 	}
+	static void skip(const mtpPrime *&from, const mtpPrime *end, mtpTypeId cons = mtpc_flags) {
+		if (from + 1 > end) throw mtpErrorInsufficient();
+		if (cons != mtpc_flags) throw mtpErrorUnexpected(cons, "MTPflags");
+		++from;
+	}
 	void write(mtpBuffer &to) const {
 		to.push_back(static_cast<mtpPrime>(v.value()));
 	}
@@ -426,6 +532,11 @@ public:
 		v = (uint64)(((uint32*)from)[0]) | ((uint64)(((uint32*)from)[1]) << 32);
 		from += 2;
 	}
+	static void skip(const mtpPrime *&from, const mtpPrime *end, mtpTypeId cons = mtpc_long) {
+		if (from + 2 > end) throw mtpErrorInsufficient();
+		if (cons != mtpc_long) throw mtpErrorUnexpected(cons, "MTPlong");
+		from += 2;
+	}
 	void write(mtpBuffer &to) const {
 		to.push_back((mtpPrime)(v & 0xFFFFFFFFL));
 		to.push_back((mtpPrime)(v >> 32));
@@ -469,6 +580,11 @@ public:
 		h = (uint64)(((uint32*)from)[2]) | ((uint64)(((uint32*)from)[3]) << 32);
 		from += 4;
 	}
+	static void skip(const mtpPrime *&from, const mtpPrime *end, mtpTypeId cons = mtpc_int128) {
+		if (from + 4 > end) throw mtpErrorInsufficient();
+		if (cons != mtpc_int128) throw mtpErrorUnexpected(cons, "MTPint128");
+		from += 4;
+	}
 	void write(mtpBuffer &to) const {
 		to.push_back((mtpPrime)(l & 0xFFFFFFFFL));
 		to.push_back((mtpPrime)(l >> 32));
@@ -512,6 +628,11 @@ public:
 		l.read(from, end);
 		h.read(from, end);
 	}
+	static void skip(const mtpPrime *&from, const mtpPrime *end, mtpTypeId cons = mtpc_int256) {
+		if (cons != mtpc_int256) throw mtpErrorUnexpected(cons, "MTPint256");
+		MTPint128::skip(from, end);
+		MTPint128::skip(from, end);
+	}
 	void write(mtpBuffer &to) const {
 		l.write(to);
 		h.write(to);
@@ -553,6 +674,11 @@ public:
 		*(uint64*)(&v) = (uint64)(((uint32*)from)[0]) | ((uint64)(((uint32*)from)[1]) << 32);
 		from += 2;
 	}
+	static void skip(const mtpPrime *&from, const mtpPrime *end, mtpTypeId cons = mtpc_double) {
+		if (from + 2 > end) throw mtpErrorInsufficient();
+		if (cons != mtpc_double) throw mtpErrorUnexpected(cons, "MTPdouble");
+		from += 2;
+	}
 	void write(mtpBuffer &to) const {
 		uint64 iv = *(uint64*)(&v);
 		to.push_back((mtpPrime)(iv & 0xFFFFFFFFL));
@@ -589,6 +715,7 @@ public:
 		return mtpc_string;
 	}
 	void read(const mtpPrime *&from, const mtpPrime *end, mtpTypeId cons = mtpc_string);
+	static void skip(const mtpPrime *&from, const mtpPrime *end, mtpTypeId cons = mtpc_string);
 	void write(mtpBuffer &to) const;
 
 	QByteArray v;
@@ -686,6 +813,14 @@ public:
 		}
 		v = std::move(vector);
 	}
+	static void skip(const mtpPrime *&from, const mtpPrime *end, mtpTypeId cons = mtpc_vector) {
+		if (from + 1 > end) throw mtpErrorInsufficient();
+		if (cons != mtpc_vector) throw mtpErrorUnexpected(cons, "MTPvector");
+		auto count = static_cast<uint32>(*(from++));
+		for (auto i = uint32(0); i != count; ++i) {
+			T::skip(from, end);
+		}
+	}
 	void write(mtpBuffer &to) const {
 		to.push_back(v.size());
 		for_const (auto &item, v) {
@@ -15,20 +15,22 @@ namespace internal {
 namespace {
 
 int PauseLevel = 0;
+int MainSessionPauseLevel = 0;
 
 } // namespace
 
-bool paused() {
-	return PauseLevel > 0;
+bool paused(bool mainSession) {
+	return (PauseLevel > 0) || (mainSession && MainSessionPauseLevel > 0);
 }
 
-void pause() {
-	++PauseLevel;
+void pause(bool mainSessionOnly) {
+	++(mainSessionOnly ? MainSessionPauseLevel : PauseLevel);
 }
 
-void unpause() {
-	--PauseLevel;
-	if (!PauseLevel) {
+void unpause(bool mainSessionOnly) {
+	auto &level = mainSessionOnly ? MainSessionPauseLevel : PauseLevel;
+	--level;
+	if (!level) {
 		if (auto instance = MainInstance()) {
 			instance->unpaused();
 		}
@@ -14,9 +14,10 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 namespace MTP {
 namespace internal {
 
-bool paused();
-void pause();
-void unpause();
+// The main session is paused also when only it was asked to pause.
+bool paused(bool mainSession = false);
+void pause(bool mainSessionOnly = false);
+void unpause(bool mainSessionOnly = false);
 
 constexpr auto kDcShift = ShiftedDcId(10000);
 constexpr auto kConfigDcShift = 0x01;
@@ -30,17 +31,24 @@ constexpr auto kDestroyKeyStartDcShift = 0x100;
 
 class PauseHolder {
 public:
-	PauseHolder() {
+	// The main session pause holds only the results and updates
+	// received by the main session of the main dc.
+	enum class Scope {
+		All,
+		MainSession,
+	};
+
+	explicit PauseHolder(Scope scope = Scope::All) : _scope(scope) {
 		restart();
 	}
 	void restart() {
 		if (!std::exchange(_paused, true)) {
-			internal::pause();
+			internal::pause(_scope == Scope::MainSession);
 		}
 	}
 	void release() {
 		if (std::exchange(_paused, false)) {
-			internal::unpause();
+			internal::unpause(_scope == Scope::MainSession);
 		}
 	}
 	~PauseHolder() {
@@ -48,6 +56,7 @@ public:
 	}
 
 private:
+	Scope _scope = Scope::All;
 	bool _paused = false;
 
 };
@@ -137,7 +137,7 @@ public:
 	}
 	void operator()(mtpRequestId requestId, const mtpPrime *from, const mtpPrime *end) override {
 		auto response = TResponse();
-		response.read(from, end);
+		MTP::internal::ReadResponse(response, from, end);
 		(*_onDone)(std::move(response));
 	}
 
@@ -155,7 +155,7 @@ public:
 	}
 	void operator()(mtpRequestId requestId, const mtpPrime *from, const mtpPrime *end) override {
 		auto response = TResponse();
-		response.read(from, end);
+		MTP::internal::ReadResponse(response, from, end);
 		(*_onDone)(std::move(response), requestId);
 	}
 
@@ -383,7 +383,7 @@ public:
 	void operator()(mtpRequestId requestId, const mtpPrime *from, const mtpPrime *end) override {
 		if (_owner) {
 			auto response = TResponse();
-			response.read(from, end);
+			MTP::internal::ReadResponse(response, from, end);
 			(static_cast<TReceiver*>(_owner)->*_onDone)(std::move(response));
 		}
 	}
@@ -403,7 +403,7 @@ public:
 	void operator()(mtpRequestId requestId, const mtpPrime *from, const mtpPrime *end) override {
 		if (_owner) {
 			auto response = TResponse();
-			response.read(from, end);
+			MTP::internal::ReadResponse(response, from, end);
 			(static_cast<TReceiver*>(_owner)->*_onDone)(std::move(response), requestId);
 		}
 	}
@@ -489,7 +489,7 @@ public:
 	void operator()(mtpRequestId requestId, const mtpPrime *from, const mtpPrime *end) override {
 		if (_owner) {
 			auto response = TResponse();
-			response.read(from, end);
+			MTP::internal::ReadResponse(response, from, end);
 			(static_cast<TReceiver*>(_owner)->*_onDone)(_b, std::move(response));
 		}
 	}
@@ -510,7 +510,7 @@ public:
 	void operator()(mtpRequestId requestId, const mtpPrime *from, const mtpPrime *end) override {
 		if (_owner) {
 			auto response = TResponse();
-			response.read(from, end);
+			MTP::internal::ReadResponse(response, from, end);
 			(static_cast<TReceiver*>(_owner)->*_onDone)(_b, std::move(response), requestId);
 		}
 	}
@@ -881,7 +881,7 @@ public:
 	void operator()(mtpRequestId requestId, const mtpPrime *from, const mtpPrime *end) override {
 		if (this->_handler) {
 			auto response = TResponse();
-			response.read(from, end);
+			MTP::internal::ReadResponse(response, from, end);
 			this->_handler(std::move(response));
 		}
 	}
@@ -895,7 +895,7 @@ public:
 	void operator()(mtpRequestId requestId, const mtpPrime *from, const mtpPrime *end) override {
 		if (this->_handler) {
 			auto response = TResponse();
-			response.read(from, end);
+			MTP::internal::ReadResponse(response, from, end);
 			this->_handler(std::move(response), requestId);
 		}
 	}
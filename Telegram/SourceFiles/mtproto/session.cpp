@@ -27,6 +27,48 @@ QString LogIds(const QVector<uint64> &ids) {
 
 } // namespace
 
+void RequestsQueue::push(const mtpRequest &request) {
+	auto node = new Node{ request };
+	node->next = _head.load(std::memory_order_relaxed);
+	while (!_head.compare_exchange_weak(
+		node->next,
+		node,
+		std::memory_order_release,
+		std::memory_order_relaxed)) {
+	}
+}
+
+void RequestsQueue::takeAll(mtpPreRequestMap &to) {
+	auto node = _head.exchange(nullptr, std::memory_order_acquire);
+	while (node) {
+		const auto next = node->next;
+		const auto requestId = node->request->requestId;
+		to[requestId] = std::move(node->request);
+		delete node;
+		node = next;
+	}
+}
+
+bool RequestsQueue::contains(mtpRequestId requestId) const {
+	auto node = _head.load(std::memory_order_acquire);
+	while (node) {
+		if (node->request->requestId == requestId) {
+			return true;
+		}
+		node = node->next;
+	}
+	return false;
+}
+
+RequestsQueue::~RequestsQueue() {
+	auto node = _head.exchange(nullptr);
+	while (node) {
+		const auto next = node->next;
+		delete node;
+		node = next;
+	}
+}
+
 void SessionData::setKey(const AuthKeyPtr &key) {
 	if (_authKey != key) {
 		uint64 session = rand_value<uint64>();
@@ -42,6 +84,17 @@ void SessionData::setKey(const AuthKeyPtr &key) {
 	}
 }
 
+void SessionData::logContention() const {
+	const auto log = [](const char *name, const LockContention &counter) {
+		DEBUG_LOG(("MTP Info: %1 lock contended %2 of %3 times."
+			).arg(name
+			).arg(counter.contended.load()
+			).arg(counter.acquired.load()));
+	};
+	log("toSend", _toSendContention);
+	log("haveReceived", _haveReceivedContention);
+}
+
 void SessionData::clear(Instance *instance) {
 	auto clearCallbacks = std::vector<RPCCallbackClear>();
 	{
@@ -49,19 +102,19 @@ void SessionData::clear(Instance *instance) {
 		auto receivedResponsesEnd = _receivedResponses.cend();
 		clearCallbacks.reserve(_haveSent.size() + _wereAcked.size());
 		for (auto i = _haveSent.cbegin(), e = _haveSent.cend(); i != e; ++i) {
-			auto requestId = i.value()->requestId;
+			auto requestId = i->second->requestId;
 			if (!_receivedResponses.contains(requestId)) {
 				clearCallbacks.push_back(requestId);
 			}
 		}
 		for (auto i = _toResend.cbegin(), e = _toResend.cend(); i != e; ++i) {
-			auto requestId = i.value();
+			auto requestId = i->second;
 			if (!_receivedResponses.contains(requestId)) {
 				clearCallbacks.push_back(requestId);
 			}
 		}
 		for (auto i = _wereAcked.cbegin(), e = _wereAcked.cend(); i != e; ++i) {
-			auto requestId = i.value();
+			auto requestId = i->second;
 			if (!_receivedResponses.contains(requestId)) {
 				clearCallbacks.push_back(requestId);
 			}
@@ -158,6 +211,7 @@ void Session::stop() {
 		return;
 	}
 	DEBUG_LOG(("Session Info: stopping session dcWithShift %1").arg(dcWithShift));
+	data.logContention();
 	if (_connection) {
 		_connection->kill();
 		_instance->queueQuittingConnection(std::move(_connection));
@@ -255,22 +309,22 @@ void Session::checkRequestsByTimer() {
 		mtpRequestMap &haveSent(data.haveSentMap());
 		uint32 haveSentCount(haveSent.size());
 		auto ms = getms(true);
-		for (mtpRequestMap::iterator i = haveSent.begin(), e = haveSent.end(); i != e; ++i) {
-			mtpRequest &req(i.value());
+		for (auto i = haveSent.begin(), e = haveSent.end(); i != e; ++i) {
+			mtpRequest &req(i->second);
 			if (req->msDate > 0) {
 				if (req->msDate + MTPCheckResendTimeout < ms) { // need to resend or check state
 					if (mtpRequestData::messageSize(req) < MTPResendThreshold) { // resend
 						resendingIds.reserve(haveSentCount);
-						resendingIds.push_back(i.key());
+						resendingIds.push_back(i->first);
 					} else {
 						req->msDate = ms;
 						stateRequestIds.reserve(haveSentCount);
-						stateRequestIds.push_back(i.key());
+						stateRequestIds.push_back(i->first);
 					}
 				}
-			} else if (unixtime() > (int32)(i.key() >> 32) + MTPContainerLives) {
+			} else if (unixtime() > (int32)(i->first >> 32) + MTPContainerLives) {
 				removingIds.reserve(haveSentCount);
-				removingIds.push_back(i.key());
+				removingIds.push_back(i->first);
 			}
 		}
 	}
@@ -280,7 +334,7 @@ void Session::checkRequestsByTimer() {
 		{
 			QWriteLocker locker(data.stateRequestMutex());
 			for (uint32 i = 0, l = stateRequestIds.size(); i < l; ++i) {
-				data.stateRequestMap().insert(stateRequestIds[i], true);
+				data.stateRequestMap().insert(stateRequestIds[i]);
 			}
 		}
 		sendAnything(MTPCheckResendWaiting);
@@ -299,8 +353,8 @@ void Session::checkRequestsByTimer() {
 			for (uint32 i = 0, l = removingIds.size(); i < l; ++i) {
 				auto j = haveSent.find(removingIds[i]);
 				if (j != haveSent.cend()) {
-					if (j.value()->requestId) {
-						clearCallbacks.push_back(j.value()->requestId);
+					if (j->second->requestId) {
+						clearCallbacks.push_back(j->second->requestId);
 					}
 					haveSent.erase(j);
 				}
@@ -357,10 +411,8 @@ int32 Session::requestState(mtpRequestId requestId) const {
 	}
 	if (!requestId) return MTP::RequestSent;
 
-	QWriteLocker locker(data.toSendMutex());
-	const mtpPreRequestMap &toSend(data.toSendMap());
-	mtpPreRequestMap::const_iterator i = toSend.constFind(requestId);
-	if (i != toSend.cend()) {
+	QReadLocker locker(data.toSendMutex());
+	if (data.toSendContains(requestId)) {
 		return MTP::RequestSending;
 	} else {
 		return MTP::RequestSent;
@@ -415,7 +467,7 @@ mtpRequestId Session::resend(quint64 msgId, qint64 msCanWait, bool forceContaine
 			return 0;
 		}
 
-		request = i.value();
+		request = i->second;
 		haveSent.erase(i);
 	}
 	if (mtpRequestData::isSentContainer(request)) { // for container just resend all messages we can
@@ -430,7 +482,7 @@ mtpRequestId Session::resend(quint64 msgId, qint64 msCanWait, bool forceContaine
 		sendPrepared(request, msCanWait, false);
 		{
 			QWriteLocker locker(data.toResendMutex());
-			data.toResendMap().insert(msgId, request->requestId);
+			data.toResendMap()[msgId] = request->requestId;
 		}
 		return request->requestId;
 	} else {
@@ -450,8 +502,8 @@ void Session::resendAll() {
 		QReadLocker locker(data.haveSentMutex());
 		const mtpRequestMap &haveSent(data.haveSentMap());
 		toResend.reserve(haveSent.size());
-		for (mtpRequestMap::const_iterator i = haveSent.cbegin(), e = haveSent.cend(); i != e; ++i) {
-			if (i.value()->requestId) toResend.push_back(i.key());
+		for (auto i = haveSent.cbegin(), e = haveSent.cend(); i != e; ++i) {
+			if (i->second->requestId) toResend.push_back(i->first);
 		}
 	}
 	for (uint32 i = 0, l = toResend.size(); i < l; ++i) {
@@ -484,16 +536,14 @@ mtpRequestId Session::send(
 }
 
 void Session::sendPrepared(const mtpRequest &request, TimeMs msCanWait, bool newRequest) { // returns true, if emit of needToSend() is needed
-	{
-		QWriteLocker locker(data.toSendMutex());
-		data.toSendMap().insert(request->requestId, request);
-
-		if (newRequest) {
-			*(mtpMsgId*)(request->data() + 4) = 0;
-			*(request->data() + 6) = 0;
-		}
+	if (newRequest) {
+		*(mtpMsgId*)(request->data() + 4) = 0;
+		*(request->data() + 6) = 0;
 	}
 
+	// The connection thread moves it to toSendMap() when it needs it.
+	data.toSendQueue().push(request);
+
 	DEBUG_LOG(("MTP Info: added, requestId %1").arg(request->requestId));
 
 	sendAnything(msCanWait);
@@ -546,40 +596,49 @@ void Session::tryToReceive() {
 		DEBUG_LOG(("Session Error: can't receive in a killed session"));
 		return;
 	}
-	if (paused()) {
-		_needToReceive = true;
-		return;
-	}
+	const auto mainSession = (dcWithShift == _instance->mainDcId());
 	while (true) {
-		auto requestId = mtpRequestId(0);
-		auto isUpdate = false;
-		auto message = SerializedMessage();
+		if (paused(mainSession)) {
+			_needToReceive = true;
+			return;
+		}
+
+		// Take everything received so far with a single lock.
+		auto responses = QMap<mtpRequestId, SerializedMessage>();
+		auto updates = QList<SerializedMessage>();
 		{
-			QWriteLocker locker(data.haveReceivedMutex());
-			auto &responses = data.haveReceivedResponses();
-			auto response = responses.begin();
-			if (response == responses.cend()) {
-				auto &updates = data.haveReceivedUpdates();
-				auto update = updates.begin();
-				if (update == updates.cend()) {
-					return;
-				} else {
-					message = std::move(*update);
-					isUpdate = true;
-					updates.pop_front();
+			ContentionWriteLocker locker(
+				data.haveReceivedMutex(),
+				data.haveReceivedContention());
+			std::swap(responses, data.haveReceivedResponses());
+			std::swap(updates, data.haveReceivedUpdates());
+		}
+		if (responses.isEmpty() && updates.isEmpty()) {
+			return;
+		}
+		for (auto i = responses.cbegin(), e = responses.cend(); i != e; ++i) {
+			if (paused(mainSession)) {
+				// Some callback paused receiving, for example to parse
+				// its response in the background, keep the rest for later.
+				ContentionWriteLocker locker(
+					data.haveReceivedMutex(),
+					data.haveReceivedContention());
+				auto &haveResponses = data.haveReceivedResponses();
+				for (; i != e; ++i) {
+					haveResponses.insert(i.key(), i.value());
 				}
-			} else {
-				requestId = response.key();
-				message = std::move(response.value());
-				responses.erase(response);
+				auto &haveUpdates = data.haveReceivedUpdates();
+				haveUpdates = updates + haveUpdates;
+				_needToReceive = true;
+				return;
 			}
+			const auto &message = i.value();
+			_instance->execCallback(i.key(), message.constData(), message.constData() + message.size());
 		}
-		if (isUpdate) {
-			if (dcWithShift == bareDcId(dcWithShift)) { // call globalCallback only in main session
+		if (dcWithShift == bareDcId(dcWithShift)) { // call globalCallback only in main session
+			for (const auto &message : updates) {
 				_instance->globalCallback(message.constData(), message.constData() + message.size());
 			}
-		} else {
-			_instance->execCallback(requestId, message.constData(), message.constData() + message.size());
 		}
 	}
 }
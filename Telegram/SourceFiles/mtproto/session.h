@@ -10,6 +10,8 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "core/single_timer.h"
 #include "mtproto/rpc_sender.h"
 
+#include <atomic>
+
 namespace MTP {
 
 class Instance;
@@ -75,6 +77,71 @@ private:
 
 };
 
+// Lock-free handoff of new requests from Session to ConnectionPrivate.
+// Any thread may push, the pushed requests are taken all at once.
+class RequestsQueue {
+public:
+	RequestsQueue() = default;
+	RequestsQueue(const RequestsQueue &other) = delete;
+	RequestsQueue &operator=(const RequestsQueue &other) = delete;
+
+	void push(const mtpRequest &request);
+
+	// Moves all the pushed requests to the map, keyed by requestId.
+	void takeAll(mtpPreRequestMap &to);
+
+	// The nodes are deleted only by takeAll(), so this must be called
+	// with the lock that guards takeAll() calls.
+	bool contains(mtpRequestId requestId) const;
+
+	~RequestsQueue();
+
+private:
+	struct Node {
+		mtpRequest request;
+		Node *next = nullptr;
+	};
+	std::atomic<Node*> _head = { nullptr };
+
+};
+
+// Counts lock acquisitions that had to wait for another thread.
+struct LockContention {
+	std::atomic<int> acquired = { 0 };
+	std::atomic<int> contended = { 0 };
+};
+
+class ContentionWriteLocker {
+public:
+	ContentionWriteLocker(
+		not_null<QReadWriteLock*> lock,
+		LockContention &counter)
+	: _lock(lock) {
+		++counter.acquired;
+		if (!_lock->tryLockForWrite()) {
+			++counter.contended;
+			_lock->lockForWrite();
+		}
+	}
+	ContentionWriteLocker(const ContentionWriteLocker &other) = delete;
+	ContentionWriteLocker &operator=(const ContentionWriteLocker &other) = delete;
+
+	void unlock() {
+		if (_locked) {
+			_locked = false;
+			_lock->unlock();
+		}
+	}
+	~ContentionWriteLocker() {
+		unlock();
+	}
+
+private:
+	not_null<QReadWriteLock*> _lock;
+	bool _locked = true;
+
+};
+
 using SerializedMessage = mtpBuffer;
 
 inline bool ResponseNeedsAck(const SerializedMessage &response) {
@@ -177,11 +244,19 @@ public:
 		return &_stateRequestLock;
 	}
 
+	// Must be called with toSendMutex() locked for write.
 	mtpPreRequestMap &toSendMap() {
+		_toSendQueue.takeAll(_toSend);
 		return _toSend;
 	}
-	const mtpPreRequestMap &toSendMap() const {
-		return _toSend;
+	RequestsQueue &toSendQueue() {
+		return _toSendQueue;
+	}
+
+	// Must be called with toSendMutex() locked.
+	bool toSendContains(mtpRequestId requestId) const {
+		return _toSend.contains(requestId)
+			|| _toSendQueue.contains(requestId);
 	}
 	mtpRequestMap &haveSentMap() {
 		return _haveSent;
@@ -226,6 +301,14 @@ public:
 		return _stateRequest;
 	}
 
+	LockContention &toSendContention() {
+		return _toSendContention;
+	}
+	LockContention &haveReceivedContention() {
+		return _haveReceivedContention;
+	}
+	void logContention() const;
+
 	not_null<Session*> owner() {
 		return _owner;
 	}
@@ -256,6 +339,7 @@ private:
 	QString _systemLangCode;
 	QString _cloudLangCode;
 
+	RequestsQueue _toSendQueue; // requests that were sent by Session, but not yet moved to _toSend
 	mtpPreRequestMap _toSend; // map of request_id -> request, that is waiting to be sent
 	mtpRequestMap _haveSent; // map of msg_id -> request, that was sent, msDate = 0 for msgs_state_req (no resend / state req), msDate = 0, seqNo = 0 for containers
 	mtpRequestIdsMap _toResend; // map of msg_id -> request_id, that request_id -> request lies in toSend and is waiting to be resent
@@ -276,6 +360,9 @@ private:
 	mutable QReadWriteLock _haveReceivedLock;
 	mutable QReadWriteLock _stateRequestLock;
 
+	LockContention _toSendContention;
+	LockContention _haveReceivedContention;
+
 };
 
 class Session : public QObject {
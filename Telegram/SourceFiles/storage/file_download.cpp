@@ -12,11 +12,31 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "mainwindow.h"
 #include "messenger.h"
 #include "storage/localstorage.h"
+#include "storage/storage_download_target.h"
 #include "platform/platform_file_utilities.h"
 #include "auth_session.h"
 #include "core/crash_reports.h"
 
 namespace Storage {
+namespace {
+
+// Part sizes must divide 1 MB and the part offset must be divisible by
+// the part size, so we use only the powers of two in this range.
+constexpr auto kDownloadPartSizeMin = 128 * 1024;
+constexpr auto kDownloadPartSizeMax = 512 * 1024;
+
+constexpr auto kMaxFileQueriesMin = 16; // min 16 file parts downloaded at the same time
+constexpr auto kMaxFileQueriesMax = 32; // max 32 file parts downloaded at the same time
+constexpr auto kMaxFileQueriesStep = 4;
+
+// While a part arrives faster than kGrowPartDuration we grow the part
+// size and then the queries count, if it is slower than
+// kShrinkPartDuration we shrink them in the reverse order.
+constexpr auto kGrowPartDuration = TimeMs(500);
+constexpr auto kShrinkPartDuration = TimeMs(2500);
+constexpr auto kDurationSmoothing = 0.2;
+
+} // namespace
 
 Downloader::Downloader()
 : _delayedLoadersDestroyer([this] { _delayedDestroyedLoaders.clear(); }) {
@@ -58,6 +78,65 @@ int Downloader::chooseDcIndexForRequest(MTP::DcId dcId) const {
 	return result;
 }
 
+void Downloader::requestSucceeded(MTP::DcId dcId, int bytes, TimeMs duration) {
+	auto &stats = _loadStats[dcId];
+	if (!stats.partSize) {
+		stats.partSize = kDownloadPartSizeMin;
+		stats.queriesLimit = kMaxFileQueriesMin;
+	}
+	if (bytes < stats.partSize) {
+		// Small or last parts say nothing about the link.
+		return;
+	}
+	stats.averageDuration = stats.samples
+		? (stats.averageDuration * (1. - kDurationSmoothing)
+			+ duration * kDurationSmoothing)
+		: float64(duration);
+
+	// Wait for the whole window of parts with the current settings.
+	if (++stats.samples < stats.queriesLimit) {
+		return;
+	}
+	const auto wasPartSize = stats.partSize;
+	const auto wasQueriesLimit = stats.queriesLimit;
+	if (stats.averageDuration < kGrowPartDuration) {
+		if (stats.partSize < kDownloadPartSizeMax) {
+			stats.partSize *= 2;
+		} else if (stats.queriesLimit < kMaxFileQueriesMax) {
+			stats.queriesLimit += kMaxFileQueriesStep;
+		}
+	} else if (stats.averageDuration > kShrinkPartDuration) {
+		if (stats.queriesLimit > kMaxFileQueriesMin) {
+			stats.queriesLimit -= kMaxFileQueriesStep;
+		} else if (stats.partSize > kDownloadPartSizeMin) {
+			stats.partSize /= 2;
+		}
+	}
+	if (stats.partSize != wasPartSize
+		|| stats.queriesLimit != wasQueriesLimit) {
+		DEBUG_LOG(("Download Info: dc %1 part size %2, queries %3, average part duration %4 ms."
+			).arg(dcId
+			).arg(stats.partSize
+			).arg(stats.queriesLimit
+			).arg(stats.averageDuration));
+		stats.samples = 0;
+	}
+}
+
+int Downloader::partSize(MTP::DcId dcId) const {
+	const auto i = _loadStats.find(dcId);
+	return (i != _loadStats.cend() && i->second.partSize)
+		? i->second.partSize
+		: kDownloadPartSizeMin;
+}
+
+int Downloader::queriesLimit(MTP::DcId dcId) const {
+	const auto i = _loadStats.find(dcId);
+	return (i != _loadStats.cend() && i->second.queriesLimit)
+		? i->second.queriesLimit
+		: kMaxFileQueriesMin;
+}
+
 Downloader::~Downloader() {
 	// The file loaders have pointer to downloader and they cancel
 	// requests in destructor where they use that pointer, so all
@@ -69,9 +148,6 @@ Downloader::~Downloader() {
 
 namespace {
 
-constexpr auto kDownloadPhotoPartSize = 64 * 1024; // 64kb for photo
-constexpr auto kDownloadDocumentPartSize = 128 * 1024; // 128kb for document
-constexpr auto kMaxFileQueries = 16; // max 16 file parts downloaded at the same time
 constexpr auto kMaxWebFileQueries = 8; // max 8 http[s] files downloaded at the same time
 constexpr auto kDownloadCdnPartSize = 128 * 1024; // 128kb for cdn requests
 
@@ -258,11 +334,8 @@ void FileLoader::start(bool loadFirst, bool prior) {
 		return;
 	}
 
-	if (!_filename.isEmpty() && _toCache == LoadToFileOnly && !_fileIsOpen) {
-		_fileIsOpen = _file.open(QIODevice::WriteOnly);
-		if (!_fileIsOpen) {
-			return cancel(true);
-		}
+	if (!openFile()) {
+		return cancel(true);
 	}
 
 	auto currentPriority = _downloader->currentPriority();
@@ -354,6 +427,14 @@ void FileLoader::start(bool loadFirst, bool prior) {
 	return startLoading(loadFirst, prior);
 }
 
+bool FileLoader::openFile() {
+	if (!_filename.isEmpty() && _toCache == LoadToFileOnly && !_fileIsOpen) {
+		_fileIsOpen = _file.open(QIODevice::WriteOnly);
+		return _fileIsOpen;
+	}
+	return true;
+}
+
 void FileLoader::cancel() {
 	cancel(false);
 }
@@ -397,7 +478,7 @@ mtpFileLoader::mtpFileLoader(const StorageImageLocation *location, int32 size, L
 	auto shiftedDcId = MTP::downloadDcId(_dcId, 0);
 	auto i = queues.find(shiftedDcId);
 	if (i == queues.cend()) {
-		i = queues.insert(shiftedDcId, FileLoaderQueue(kMaxFileQueries));
+		i = queues.insert(shiftedDcId, FileLoaderQueue(_downloader->queriesLimit(_dcId)));
 	}
 	_queue = &i.value();
 }
@@ -411,7 +492,7 @@ mtpFileLoader::mtpFileLoader(int32 dc, uint64 id, uint64 accessHash, int32 versi
 	auto shiftedDcId = MTP::downloadDcId(_dcId, 0);
 	auto i = queues.find(shiftedDcId);
 	if (i == queues.cend()) {
-		i = queues.insert(shiftedDcId, FileLoaderQueue(kMaxFileQueries));
+		i = queues.insert(shiftedDcId, FileLoaderQueue(_downloader->queriesLimit(_dcId)));
 	}
 	_queue = &i.value();
 }
@@ -423,58 +504,117 @@ mtpFileLoader::mtpFileLoader(const WebFileImageLocation *location, int32 size, L
 	auto shiftedDcId = MTP::downloadDcId(_dcId, 0);
 	auto i = queues.find(shiftedDcId);
 	if (i == queues.cend()) {
-		i = queues.insert(shiftedDcId, FileLoaderQueue(kMaxFileQueries));
+		i = queues.insert(shiftedDcId, FileLoaderQueue(_downloader->queriesLimit(_dcId)));
 	}
 	_queue = &i.value();
 }
 
 int32 mtpFileLoader::currentOffset(bool includeSkipped) const {
+	if (_target) {
+		return _target->receivedBytes();
+	}
 	return (_fileIsOpen ? _file.size() : _data.size()) - (includeSkipped ? 0 : _skippedBytes);
 }
 
+bool mtpFileLoader::openFile() {
+	if (_target || _fileIsOpen) {
+		return true;
+	} else if (!_filename.isEmpty()
+		&& _toCache == LoadToFileOnly
+		&& _locationType != UnknownFileLocation
+		&& _size > Storage::kMaxFileInMemory) {
+		auto target = std::make_unique<Storage::DownloadTarget>(
+			resumablePath());
+		if (target->open(_size)) {
+			_target = std::move(target);
+			if (_target->receivedAll()) {
+				// Nothing is requested, finish after the loader starts.
+				crl::on_main(this, [=] { finishReceived(); });
+			}
+			return true;
+		}
+	}
+	return FileLoader::openFile();
+}
+
+void mtpFileLoader::finishReceived() {
+	if (_target && !_finished && _sentRequests.empty()) {
+		partLoaded(_size, base::const_byte_span());
+	}
+}
+
+QString mtpFileLoader::resumablePath() const {
+	return Storage::DownloadTargetsPath()
+		+ qsl("%1_%2_%3"
+		).arg(_dcId
+		).arg(_id, 16, 16, QChar('0')
+		).arg(_version);
+}
+
 bool mtpFileLoader::loadPart() {
+	if (_target && !_finished) {
+		_nextRequestOffset = _target->nextMissing(_nextRequestOffset);
+	}
 	if (_finished || _lastComplete || (!_sentRequests.empty() && !_size)) {
 		return false;
 	} else if (_size && _nextRequestOffset >= _size) {
 		return false;
 	}
 
-	makeRequest(_nextRequestOffset);
-	_nextRequestOffset += partSize();
+	auto limit = partSize(_nextRequestOffset);
+	while (_target
+		&& limit > partSize()
+		&& _target->receivedAny(_nextRequestOffset, limit)) {
+		limit /= 2;
+	}
+	makeRequest(_nextRequestOffset, limit);
+	_nextRequestOffset += limit;
 	return true;
 }
 
 int mtpFileLoader::partSize() const {
+	// CDN file hashes are provided for kDownloadCdnPartSize parts,
+	// so the CDN parts (and all the parts before the redirect is
+	// received, when we don't know yet) have this minimal size.
 	return kDownloadCdnPartSize;
+}
 
-	// Different part sizes are not supported for now :(
-	// Because we start downloading with some part size
-	// and then we get a cdn-redirect where we support only
-	// fixed part size download for hash checking.
-	//
-	//if (_cdnDcId) {
-	//	return kDownloadCdnPartSize;
-	//} else if (_locationType == UnknownFileLocation) {
-	//	return kDownloadPhotoPartSize;
-	//}
-	//return kDownloadDocumentPartSize;
+int mtpFileLoader::partSize(int offset) const {
+	if (_cdnDcId || _urlLocation || _size <= Storage::kMaxFileInMemory) {
+		return partSize();
+	}
+	auto result = _downloader->partSize(_dcId);
+	while (result > partSize() && (offset % result) != 0) {
+		result /= 2;
+	}
+	return result;
 }
 
-mtpFileLoader::RequestData mtpFileLoader::prepareRequest(int offset) const {
+mtpFileLoader::RequestData mtpFileLoader::prepareRequest(int offset, int limit) const {
 	auto result = RequestData();
 	result.dcId = _cdnDcId ? _cdnDcId : _dcId;
 	result.dcIndex = _size ? _downloader->chooseDcIndexForRequest(result.dcId) : 0;
 	result.offset = offset;
+	result.limit = limit;
+	result.sent = getms();
 	return result;
 }
 
-void mtpFileLoader::makeRequest(int offset) {
+void mtpFileLoader::makeRequests(int offset, int limit) {
+	// After a redirect to CDN the large parts are requested by pieces.
+	const auto size = partSize();
+	for (auto till = offset + limit; offset < till; offset += size) {
+		makeRequest(offset, size);
+	}
+}
+
+void mtpFileLoader::makeRequest(int offset, int limit) {
 	Expects(!_finished);
 
-	auto requestData = prepareRequest(offset);
+	auto requestData = prepareRequest(offset, limit);
 	auto send = [this, &requestData] {
 		auto offset = requestData.offset;
-		auto limit = partSize();
+		auto limit = requestData.limit;
 		auto shiftedDcId = MTP::downloadDcId(requestData.dcId, requestData.dcIndex);
 		if (_cdnDcId) {
 			Assert(requestData.dcId == _cdnDcId);
@@ -508,6 +648,8 @@ void mtpFileLoader::requestMoreCdnFileHashes() {
 	requestData.dcId = _dcId;
 	requestData.dcIndex = 0;
 	requestData.offset = offset;
+	requestData.limit = partSize();
+	requestData.sent = getms();
 	auto shiftedDcId = MTP::downloadDcId(requestData.dcId, requestData.dcIndex);
 	auto requestId = _cdnHashesRequestId = MTP::send(
 		MTPupload_GetCdnFileHashes(
@@ -523,12 +665,13 @@ void mtpFileLoader::normalPartLoaded(const MTPupload_File &result, mtpRequestId
 	Expects(!_finished);
 	Expects(result.type() == mtpc_upload_fileCdnRedirect || result.type() == mtpc_upload_file);
 
-	auto offset = finishSentRequestGetOffset(requestId);
+	const auto requestData = finishSentRequest(requestId);
 	if (result.type() == mtpc_upload_fileCdnRedirect) {
-		return switchToCDN(offset, result.c_upload_fileCdnRedirect());
+		return switchToCDN(requestData, result.c_upload_fileCdnRedirect());
 	}
+	requestSucceeded(requestData);
 	auto bytes = gsl::as_bytes(gsl::make_span(result.c_upload_file().vbytes.v));
-	return partLoaded(offset, bytes);
+	return partLoaded(requestData.offset, bytes);
 }
 
 void mtpFileLoader::webPartLoaded(const MTPupload_WebFile &result, mtpRequestId requestId) {
@@ -549,12 +692,15 @@ void mtpFileLoader::webPartLoaded(const MTPupload_WebFile &result, mtpRequestId
 void mtpFileLoader::cdnPartLoaded(const MTPupload_CdnFile &result, mtpRequestId requestId) {
 	Expects(!_finished);
 
-	auto offset = finishSentRequestGetOffset(requestId);
+	const auto loadedData = finishSentRequest(requestId);
+	const auto offset = loadedData.offset;
 	if (result.type() == mtpc_upload_cdnFileReuploadNeeded) {
 		auto requestData = RequestData();
 		requestData.dcId = _dcId;
 		requestData.dcIndex = 0;
 		requestData.offset = offset;
+		requestData.limit = partSize();
+		requestData.sent = getms();
 		auto shiftedDcId = MTP::downloadDcId(requestData.dcId, requestData.dcIndex);
 		auto requestId = MTP::send(MTPupload_ReuploadCdnFile(MTP_bytes(_cdnToken), result.c_upload_cdnFileReuploadNeeded().vrequest_token), rpcDone(&mtpFileLoader::reuploadDone), rpcFail(&mtpFileLoader::cdnPartFailed), shiftedDcId);
 		placeSentRequest(requestId, requestData);
@@ -562,6 +708,7 @@ void mtpFileLoader::cdnPartLoaded(const MTPupload_CdnFile &result, mtpRequestId
 	}
 	Expects(result.type() == mtpc_upload_cdnFile);
 
+	requestSucceeded(loadedData);
 	auto key = gsl::as_bytes(gsl::make_span(_cdnEncryptionKey));
 	auto iv = gsl::as_bytes(gsl::make_span(_cdnEncryptionIV));
 	Expects(key.size() == MTP::CTRState::KeySize);
@@ -612,7 +759,7 @@ mtpFileLoader::CheckCdnHashResult mtpFileLoader::checkCdnFileHash(int offset, ba
 void mtpFileLoader::reuploadDone(const MTPVector<MTPCdnFileHash> &result, mtpRequestId requestId) {
 	auto offset = finishSentRequestGetOffset(requestId);
 	addCdnHashes(result.v);
-	makeRequest(offset);
+	makeRequest(offset, partSize());
 }
 
 void mtpFileLoader::getCdnFileHashesDone(const MTPVector<MTPCdnFileHash> &result, mtpRequestId requestId) {
@@ -671,29 +818,46 @@ void mtpFileLoader::getCdnFileHashesDone(const MTPVector<MTPCdnFileHash> &result
 void mtpFileLoader::placeSentRequest(mtpRequestId requestId, const RequestData &requestData) {
 	Expects(!_finished);
 
-	_downloader->requestedAmountIncrement(requestData.dcId, requestData.dcIndex, partSize());
+	_downloader->requestedAmountIncrement(requestData.dcId, requestData.dcIndex, requestData.limit);
 	++_queue->queriesCount;
 	_sentRequests.emplace(requestId, requestData);
 }
 
-int mtpFileLoader::finishSentRequestGetOffset(mtpRequestId requestId) {
+mtpFileLoader::RequestData mtpFileLoader::finishSentRequest(mtpRequestId requestId) {
 	auto it = _sentRequests.find(requestId);
 	Expects(it != _sentRequests.cend());
 
 	auto requestData = it->second;
-	_downloader->requestedAmountIncrement(requestData.dcId, requestData.dcIndex, -partSize());
+	_downloader->requestedAmountIncrement(requestData.dcId, requestData.dcIndex, -requestData.limit);
 
 	--_queue->queriesCount;
 	_sentRequests.erase(it);
 
-	return requestData.offset;
+	return requestData;
+}
+
+int mtpFileLoader::finishSentRequestGetOffset(mtpRequestId requestId) {
+	return finishSentRequest(requestId).offset;
+}
+
+void mtpFileLoader::requestSucceeded(const RequestData &requestData) {
+	_downloader->requestSucceeded(
+		requestData.dcId,
+		requestData.limit,
+		getms() - requestData.sent);
+	_queue->queriesLimit = _downloader->queriesLimit(_dcId);
 }
 
 bool mtpFileLoader::feedPart(int offset, base::const_byte_span bytes) {
 	Expects(!_finished);
 
 	if (bytes.size()) {
-		if (_fileIsOpen) {
+		if (_target) {
+			if (!_target->write(offset, bytes)) {
+				cancel(true);
+				return false;
+			}
+		} else if (_fileIsOpen) {
 			auto fsize = _file.size();
 			if (offset < fsize) {
 				_skippedBytes -= bytes.size();
@@ -749,6 +913,13 @@ bool mtpFileLoader::feedPart(int offset, base::const_byte_span bytes) {
 				return false;
 			}
 		}
+		if (_target) {
+			if (!base::take(_target)->finish(_filename)) {
+				cancel(true);
+				return false;
+			}
+			Platform::File::PostprocessDownloaded(QFileInfo(_file).absoluteFilePath());
+		}
 		_finished = true;
 		if (_fileIsOpen) {
 			_file.close();
@@ -804,8 +975,8 @@ bool mtpFileLoader::cdnPartFailed(const RPCError &error, mtpRequestId requestId)
 		_cdnHashesRequestId = 0;
 	}
 	if (error.type() == qstr("FILE_TOKEN_INVALID") || error.type() == qstr("REQUEST_TOKEN_INVALID")) {
-		auto offset = finishSentRequestGetOffset(requestId);
-		changeCDNParams(offset, 0, QByteArray(), QByteArray(), QByteArray(), QVector<MTPCdnFileHash>());
+		const auto requestData = finishSentRequest(requestId);
+		changeCDNParams(requestData, 0, QByteArray(), QByteArray(), QByteArray(), QVector<MTPCdnFileHash>());
 		return true;
 	}
 	return partFailed(error);
@@ -817,10 +988,13 @@ void mtpFileLoader::cancelRequests() {
 		MTP::cancel(requestId);
 		finishSentRequestGetOffset(requestId);
 	}
+
+	// Keep the received parts to resume the download next time.
+	_target = nullptr;
 }
 
-void mtpFileLoader::switchToCDN(int offset, const MTPDupload_fileCdnRedirect &redirect) {
-	changeCDNParams(offset, redirect.vdc_id.v, redirect.vfile_token.v, redirect.vencryption_key.v, redirect.vencryption_iv.v, redirect.vcdn_file_hashes.v);
+void mtpFileLoader::switchToCDN(const RequestData &requestData, const MTPDupload_fileCdnRedirect &redirect) {
+	changeCDNParams(requestData, redirect.vdc_id.v, redirect.vfile_token.v, redirect.vencryption_key.v, redirect.vencryption_iv.v, redirect.vcdn_file_hashes.v);
 }
 
 void mtpFileLoader::addCdnHashes(const QVector<MTPCdnFileHash> &hashes) {
@@ -831,7 +1005,7 @@ void mtpFileLoader::addCdnHashes(const QVector<MTPCdnFileHash> &hashes) {
 	}
 }
 
-void mtpFileLoader::changeCDNParams(int offset, MTP::DcId dcId, const QByteArray &token, const QByteArray &encryptionKey, const QByteArray &encryptionIV, const QVector<MTPCdnFileHash> &hashes) {
+void mtpFileLoader::changeCDNParams(const RequestData &requestData, MTP::DcId dcId, const QByteArray &token, const QByteArray &encryptionKey, const QByteArray &encryptionIV, const QVector<MTPCdnFileHash> &hashes) {
 	if (dcId != 0 && (encryptionKey.size() != MTP::CTRState::KeySize || encryptionIV.size() != MTP::CTRState::IvecSize)) {
 		LOG(("Message Error: Wrong key (%1) / iv (%2) size in CDN params").arg(encryptionKey.size()).arg(encryptionIV.size()));
 		cancel(true);
@@ -849,19 +1023,18 @@ void mtpFileLoader::changeCDNParams(int offset, MTP::DcId dcId, const QByteArray
 	addCdnHashes(hashes);
 
 	if (resendAllRequests && !_sentRequests.empty()) {
-		auto resendOffsets = std::vector<int>();
-		resendOffsets.reserve(_sentRequests.size());
+		auto resendRequests = std::vector<RequestData>();
+		resendRequests.reserve(_sentRequests.size());
 		while (!_sentRequests.empty()) {
 			auto requestId = _sentRequests.begin()->first;
 			MTP::cancel(requestId);
-			auto resendOffset = finishSentRequestGetOffset(requestId);
-			resendOffsets.push_back(resendOffset);
+			resendRequests.push_back(finishSentRequest(requestId));
 		}
-		for (auto resendOffset : resendOffsets) {
-			makeRequest(resendOffset);
+		for (const auto &resendRequest : resendRequests) {
+			makeRequests(resendRequest.offset, resendRequest.limit);
 		}
 	}
-	makeRequest(offset);
+	makeRequests(requestData.offset, requestData.limit);
 }
 
 bool mtpFileLoader::tryLoadLocal() {
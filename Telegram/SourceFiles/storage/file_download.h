@@ -17,6 +17,8 @@ constexpr auto kMaxVoiceInMemory = 2 * 1024 * 1024; // 2 MB audio is hold in mem
 constexpr auto kMaxStickerInMemory = 2 * 1024 * 1024; // 2 MB stickers hold in memory, auto loaded and displayed inline
 constexpr auto kMaxAnimationInMemory = kMaxFileInMemory; // 10 MB gif and mp4 animations held in memory while playing
 
+class DownloadTarget;
+
 class Downloader final {
 public:
 	Downloader();
@@ -35,6 +37,12 @@ public:
 	void requestedAmountIncrement(MTP::DcId dcId, int index, int amount);
 	int chooseDcIndexForRequest(MTP::DcId dcId) const;
 
+	// Part size and parallel queries count adapt to the measured
+	// time it takes to receive a part from the given dc.
+	void requestSucceeded(MTP::DcId dcId, int bytes, TimeMs duration);
+	int partSize(MTP::DcId dcId) const;
+	int queriesLimit(MTP::DcId dcId) const;
+
 	~Downloader();
 
 private:
@@ -47,6 +55,14 @@ private:
 	using RequestedInDc = std::array<int64, MTP::kDownloadSessionsCount>;
 	std::map<MTP::DcId, RequestedInDc> _requestedBytesAmount;
 
+	struct LoadStats {
+		int partSize = 0;
+		int queriesLimit = 0;
+		int samples = 0;
+		float64 averageDuration = 0.;
+	};
+	std::map<MTP::DcId, LoadStats> _loadStats;
+
 };
 
 } // namespace Storage
@@ -149,6 +165,7 @@ protected:
 
 	virtual bool tryLoadLocal() = 0;
 	virtual void cancelRequests() = 0;
+	virtual bool openFile();
 
 	void startLoading(bool loadFirst, bool prior);
 	void removeFromQueue();
@@ -202,6 +219,8 @@ private:
 		MTP::DcId dcId = 0;
 		int dcIndex = 0;
 		int offset = 0;
+		int limit = 0;
+		TimeMs sent = 0;
 	};
 	struct CdnFileHash {
 		CdnFileHash(int limit, QByteArray hash) : limit(limit), hash(hash) {
@@ -212,10 +231,15 @@ private:
 
 	bool tryLoadLocal() override;
 	void cancelRequests() override;
+	bool openFile() override;
+	QString resumablePath() const;
+	void finishReceived();
 
 	int partSize() const;
-	RequestData prepareRequest(int offset) const;
-	void makeRequest(int offset);
+	int partSize(int offset) const;
+	RequestData prepareRequest(int offset, int limit) const;
+	void makeRequest(int offset, int limit);
+	void makeRequests(int offset, int limit);
 
 	bool loadPart() override;
 	void normalPartLoaded(const MTPupload_File &result, mtpRequestId requestId);
@@ -232,10 +256,12 @@ private:
 	bool cdnPartFailed(const RPCError &error, mtpRequestId requestId);
 
 	void placeSentRequest(mtpRequestId requestId, const RequestData &requestData);
+	RequestData finishSentRequest(mtpRequestId requestId);
 	int finishSentRequestGetOffset(mtpRequestId requestId);
-	void switchToCDN(int offset, const MTPDupload_fileCdnRedirect &redirect);
+	void requestSucceeded(const RequestData &requestData);
+	void switchToCDN(const RequestData &requestData, const MTPDupload_fileCdnRedirect &redirect);
 	void addCdnHashes(const QVector<MTPCdnFileHash> &hashes);
-	void changeCDNParams(int offset, MTP::DcId dcId, const QByteArray &token, const QByteArray &encryptionKey, const QByteArray &encryptionIV, const QVector<MTPCdnFileHash> &hashes);
+	void changeCDNParams(const RequestData &requestData, MTP::DcId dcId, const QByteArray &token, const QByteArray &encryptionKey, const QByteArray &encryptionIV, const QVector<MTPCdnFileHash> &hashes);
 
 	enum class CheckCdnHashResult {
 		NoHash,
@@ -249,6 +275,7 @@ private:
 	bool _lastComplete = false;
 	int32 _skippedBytes = 0;
 	int32 _nextRequestOffset = 0;
+	std::unique_ptr<Storage::DownloadTarget> _target;
 
 	MTP::DcId _dcId = 0; // for photo locations
 	const StorageImageLocation *_location = nullptr;
@@ -14,7 +14,187 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 namespace Storage {
 namespace {
 
-constexpr auto kMaxUploadFileParallelSize = MTP::kUploadSessionsCount * 512 * 1024; // max 512kb uploaded at the same time in each session
+// Each upload session has its own window of bytes in flight, it grows
+// while the parts are acknowledged fast and shrinks on a slow link.
+constexpr auto kUploadWindowMin = 256 * 1024;
+constexpr auto kUploadWindowStart = 512 * 1024;
+constexpr auto kUploadWindowMax = 4 * 1024 * 1024;
+constexpr auto kUploadWindowStep = 128 * 1024;
+constexpr auto kFastPartDuration = TimeMs(1000);
+constexpr auto kSlowPartDuration = TimeMs(4000);
+
+// Document parts are read and hashed this much ahead of the requests.
+constexpr auto kReadAheadSize = 4 * 1024 * 1024;
+
+// Reads the document parts and feeds the MD5 hash on a worker thread,
+// so that the disk reads overlap with the parts sent over the network.
+class PartsReader : public std::enable_shared_from_this<PartsReader> {
+public:
+	PartsReader(
+		const QString &path,
+		const QByteArray &content,
+		int partSize,
+		int partsCount,
+		bool hashMd5,
+		base::lambda<void()> ready);
+
+	void readAhead();
+	bool partReady() const;
+	bool failed() const;
+	QByteArray takePart();
+
+	// Valid after all the parts were taken.
+	QByteArray md5();
+
+private:
+	static void Read(const std::weak_ptr<PartsReader> &weak);
+	bool readPart();
+
+	const QString _path;
+	const QByteArray _content;
+	const int _partSize = 0;
+	const int _partsCount = 0;
+	const int _readAheadParts = 0;
+	const bool _hashMd5 = false;
+	const base::lambda<void()> _ready;
+
+	// Used only by the worker that reads the parts.
+	std::unique_ptr<QFile> _file;
+	HashMd5 _md5Hash;
+
+	mutable QMutex _mutex;
+	std::deque<QByteArray> _parts;
+	int _partsRead = 0;
+	bool _reading = false;
+	bool _failed = false;
+
+};
+
+PartsReader::PartsReader(
+	const QString &path,
+	const QByteArray &content,
+	int partSize,
+	int partsCount,
+	bool hashMd5,
+	base::lambda<void()> ready)
+: _path(path)
+, _content(content)
+, _partSize(partSize)
+, _partsCount(partsCount)
+, _readAheadParts(std::max(kReadAheadSize / partSize, 1))
+, _hashMd5(hashMd5)
+, _ready(std::move(ready)) {
+}
+
+void PartsReader::readAhead() {
+	QMutexLocker lock(&_mutex);
+	if (_reading
+		|| _failed
+		|| _partsRead == _partsCount
+		|| int(_parts.size()) >= _readAheadParts) {
+		return;
+	}
+	_reading = true;
+	lock.unlock();
+
+	crl::async([weak = std::weak_ptr<PartsReader>(shared_from_this())] {
+		Read(weak);
+	});
+}
+
+void PartsReader::Read(const std::weak_ptr<PartsReader> &weak) {
+	// Stops after the current part if the upload was cancelled.
+	while (const auto strong = weak.lock()) {
+		if (!strong->readPart()) {
+			return;
+		}
+	}
+}
+
+bool PartsReader::readPart() {
+	QMutexLocker lock(&_mutex);
+	if (_partsRead == _partsCount
+		|| int(_parts.size()) >= _readAheadParts) {
+		_reading = false;
+		return false;
+	}
+	const auto index = _partsRead;
+	lock.unlock();
+
+	auto part = QByteArray();
+	auto failed = false;
+	if (!_content.isEmpty()) {
+		part = _content.mid(index * _partSize, _partSize);
+	} else {
+		if (!_file) {
+			_file = std::make_unique<QFile>(_path);
+			failed = !_file->open(QIODevice::ReadOnly);
+		}
+		if (!failed) {
+			// The file is not mapped: if it is truncated while uploading
+			// reading it gives a short part instead of a SIGBUS.
+			part.resize(_partSize);
+			const auto read = _file->read(part.data(), _partSize);
+			part.resize(std::max(read, qint64(0)));
+		}
+	}
+	if ((part.size() > _partSize)
+		|| (part.size() < _partSize && index + 1 != _partsCount)) {
+		failed = true;
+	}
+	if (!failed && _hashMd5) {
+		_md5Hash.feed(part.constData(), part.size());
+	}
+
+	lock.relock();
+	const auto notify = failed || _parts.empty();
+	if (failed) {
+		_failed = true;
+		_reading = false;
+	} else {
+		_parts.push_back(std::move(part));
+		++_partsRead;
+	}
+	lock.unlock();
+
+	// The uploader waits for a part only when there are none ready.
+	if (notify) {
+		_ready();
+	}
+	return !failed;
+}
+
+bool PartsReader::partReady() const {
+	QMutexLocker lock(&_mutex);
+	return _failed || !_parts.empty();
+}
+
+bool PartsReader::failed() const {
+	QMutexLocker lock(&_mutex);
+	return _failed;
+}
+
+QByteArray PartsReader::takePart() {
+	QMutexLocker lock(&_mutex);
+	if (_failed || _parts.empty()) {
+		return QByteArray();
+	}
+	auto result = std::move(_parts.front());
+	_parts.pop_front();
+	lock.unlock();
+
+	readAhead();
+	return result;
+}
+
+QByteArray PartsReader::md5() {
+	QMutexLocker lock(&_mutex);
+	Assert(_partsRead == _partsCount);
+
+	auto result = QByteArray(32, Qt::Uninitialized);
+	hashMd5Hex(_md5Hash.result(), result.data());
+	return result;
+}
 
 } // namespace
 
@@ -25,20 +205,27 @@ struct Uploader::File {
 	void setDocSize(int32 size);
 	bool setPartSize(uint32 partSize);
 
+	QMap<int, QByteArray> &parts();
+	const QByteArray &docContent() const;
+	const QString &docPath() const;
+	QByteArray docMd5();
+	bool sendingDone();
+
 	std::shared_ptr<FileLoadResult> file;
 	SendMediaReady media;
 	int32 partsCount;
-	mutable int32 fileSentSize;
+	mutable int32 fileSentSize = 0;
+	bool started = false;
+	int requestsInFlight = 0;
 
 	uint64 id() const;
 	SendMediaType type() const;
 	uint64 thumbId() const;
 	const QString &filename() const;
 
-	HashMd5 md5Hash;
-
-	std::unique_ptr<QFile> docFile;
+	std::shared_ptr<PartsReader> docReader;
 	int32 docSentParts = 0;
+	int docRequestsInFlight = 0;
 	int32 docSize = 0;
 	int32 docPartSize = 0;
 	int32 docPartsCount = 0;
@@ -91,6 +278,35 @@ bool Uploader::File::setPartSize(uint32 partSize) {
 	return (docPartsCount <= DocumentMaxPartsCount);
 }
 
+QMap<int, QByteArray> &Uploader::File::parts() {
+	return file
+		? (type() == SendMediaType::Photo
+			? file->fileparts
+			: file->thumbparts)
+		: media.parts;
+}
+
+const QByteArray &Uploader::File::docContent() const {
+	return file ? file->content : media.data;
+}
+
+const QString &Uploader::File::docPath() const {
+	return file ? file->filepath : media.file;
+}
+
+QByteArray Uploader::File::docMd5() {
+	if (docReader) {
+		return docReader->md5();
+	}
+	auto result = QByteArray(32, Qt::Uninitialized);
+	hashMd5Hex(HashMd5().result(), result.data());
+	return result;
+}
+
+bool Uploader::File::sendingDone() {
+	return parts().isEmpty() && (docSentParts >= docPartsCount);
+}
+
 uint64 Uploader::File::id() const {
 	return file ? file->id : media.id;
 }
@@ -108,6 +324,9 @@ const QString &Uploader::File::filename() const {
 }
 
 Uploader::Uploader() {
+	for (auto &window : sessionWindows) {
+		window = kUploadWindowStart;
+	}
 	nextTimer.setSingleShot(true);
 	connect(&nextTimer, SIGNAL(timeout()), this, SLOT(sendNext()));
 	killSessionsTimer.setSingleShot(true);
@@ -155,8 +374,8 @@ void Uploader::upload(
 	sendNext();
 }
 
-void Uploader::currentFailed() {
-	auto j = queue.find(uploadingId);
+void Uploader::failed(const FullMsgId &msgId) {
+	auto j = queue.find(msgId);
 	if (j != queue.end()) {
 		if (j->second.type() == SendMediaType::Photo) {
 			emit photoFailed(j->first);
@@ -167,29 +386,57 @@ void Uploader::currentFailed() {
 			}
 			emit documentFailed(j->first);
 		}
-		queue.erase(j);
-	}
-
-	requestsSent.clear();
-	docRequestsSent.clear();
-	dcMap.clear();
-	uploadingId = FullMsgId();
-	sentSize = 0;
-	for (int i = 0; i < MTP::kUploadSessionsCount; ++i) {
-		sentSizes[i] = 0;
+		queue.erase(msgId);
 	}
+	cancelRequests(msgId);
 
 	sendNext();
 }
 
+void Uploader::cancelRequests(const FullMsgId &msgId) {
+	for (auto i = requestsSent.begin(); i != requestsSent.end();) {
+		if (i->second.msgId == msgId) {
+			MTP::cancel(i->first);
+			sentSizes[i->second.dc] -= i->second.size;
+			i = requestsSent.erase(i);
+		} else {
+			++i;
+		}
+	}
+}
+
 void Uploader::killSessions() {
 	for (int i = 0; i < MTP::kUploadSessionsCount; ++i) {
 		MTP::stopSession(MTP::uploadDcId(i));
 	}
 }
 
+int Uploader::chooseSession() const {
+	auto result = -1;
+	auto available = 0;
+	for (auto dc = 0; dc != MTP::kUploadSessionsCount; ++dc) {
+		const auto free = sessionWindows[dc] - sentSizes[dc];
+		if (free > available) {
+			available = free;
+			result = dc;
+		}
+	}
+	return result;
+}
+
+void Uploader::adjustWindow(int dc, TimeMs duration) {
+	auto &window = sessionWindows[dc];
+	if (duration < kFastPartDuration) {
+		window = std::min(window + kUploadWindowStep, kUploadWindowMax);
+	} else if (duration > kSlowPartDuration) {
+		window = std::max(window / 2, kUploadWindowMin);
+	}
+}
+
 void Uploader::sendNext() {
-	if (sentSize >= kMaxUploadFileParallelSize || _pausedId.msg) return;
+	if (_pausedId.msg) return;
+
+	sendReady();
 
 	bool killing = killSessionsTimer.isActive();
 	if (queue.empty()) {
@@ -202,132 +449,130 @@ void Uploader::sendNext() {
 	if (killing) {
 		killSessionsTimer.stop();
 	}
-	auto i = uploadingId.msg ? queue.find(uploadingId) : queue.begin();
-	if (!uploadingId.msg) {
-		uploadingId = i->first;
-	} else if (i == queue.end()) {
-		i = queue.begin();
-		uploadingId = i->first;
+
+	// Fill the windows of all sessions, starting the next files
+	// while the last parts of the previous ones are still in flight.
+	auto i = queue.begin();
+	while (i != queue.end()) {
+		const auto todc = chooseSession();
+		if (todc < 0) {
+			break;
+		} else if (i->second.sendingDone() || !partReady(i->second)) {
+			// While a document part is being read, send the other files.
+			++i;
+		} else if (!sendPart(i->first, i->second, todc)) {
+			return;
+		}
 	}
-	auto &uploadingData = i->second;
+	nextTimer.start(UploadRequestInterval);
+}
 
-	auto todc = 0;
-	for (auto dc = 1; dc != MTP::kUploadSessionsCount; ++dc) {
-		if (sentSizes[dc] < sentSizes[todc]) {
-			todc = dc;
+void Uploader::sendReady() {
+	while (!queue.empty()) {
+		const auto fullId = queue.begin()->first;
+		auto &uploadingData = queue.begin()->second;
+		if (!uploadingData.sendingDone() || uploadingData.requestsInFlight) {
+			// Files are ready in the order they were queued.
+			return;
+		}
+		const auto silent = uploadingData.file
+			&& uploadingData.file->to.silent;
+		if (uploadingData.type() == SendMediaType::Photo) {
+			auto photoFilename = uploadingData.filename();
+			if (!photoFilename.endsWith(qstr(".jpg"), Qt::CaseInsensitive)) {
+				// Server has some extensions checking for inputMediaUploadedPhoto,
+				// so force the extension to be .jpg anyway. It doesn't matter,
+				// because the filename from inputFile is not used anywhere.
+				photoFilename += qstr(".jpg");
+			}
+			const auto md5 = uploadingData.file
+				? uploadingData.file->filemd5
+				: uploadingData.media.jpeg_md5;
+			const auto file = MTP_inputFile(
+				MTP_long(uploadingData.id()),
+				MTP_int(uploadingData.partsCount),
+				MTP_string(photoFilename),
+				MTP_bytes(md5));
+			queue.erase(fullId);
+			emit photoReady(fullId, silent, file);
+		} else if (uploadingData.type() == SendMediaType::File
+			|| uploadingData.type() == SendMediaType::Audio) {
+			const auto docMd5 = uploadingData.docMd5();
+
+			const auto file = (uploadingData.docSize > UseBigFilesFrom)
+				? MTP_inputFileBig(
+					MTP_long(uploadingData.id()),
+					MTP_int(uploadingData.docPartsCount),
+					MTP_string(uploadingData.filename()))
+				: MTP_inputFile(
+					MTP_long(uploadingData.id()),
+					MTP_int(uploadingData.docPartsCount),
+					MTP_string(uploadingData.filename()),
+					MTP_bytes(docMd5));
+			if (uploadingData.partsCount) {
+				const auto thumbFilename = uploadingData.file
+					? uploadingData.file->thumbname
+					: (qsl("thumb.") + uploadingData.media.thumbExt);
+				const auto thumbMd5 = uploadingData.file
+					? uploadingData.file->thumbmd5
+					: uploadingData.media.jpeg_md5;
+				const auto thumb = MTP_inputFile(
+					MTP_long(uploadingData.thumbId()),
+					MTP_int(uploadingData.partsCount),
+					MTP_string(thumbFilename),
+					MTP_bytes(thumbMd5));
+				queue.erase(fullId);
+				emit thumbDocumentReady(
+					fullId,
+					silent,
+					file,
+					thumb);
+			} else {
+				queue.erase(fullId);
+				emit documentReady(fullId, silent, file);
+			}
+		} else {
+			queue.erase(fullId);
 		}
 	}
+}
+
+bool Uploader::partReady(File &uploadingData) {
+	if (!uploadingData.parts().isEmpty()) {
+		return true;
+	} else if (!uploadingData.docReader) {
+		const auto weak = base::make_weak(this);
+		uploadingData.docReader = std::make_shared<PartsReader>(
+			uploadingData.docPath(),
+			uploadingData.docContent(),
+			uploadingData.docPartSize,
+			uploadingData.docPartsCount,
+			(uploadingData.docSize <= UseBigFilesFrom),
+			[=] { crl::on_main(weak, [=] { sendNext(); }); });
+		uploadingData.docReader->readAhead();
+	}
+	return uploadingData.docReader->partReady();
+}
 
-	auto &parts = uploadingData.file
-		? (uploadingData.type() == SendMediaType::Photo
-			? uploadingData.file->fileparts
-			: uploadingData.file->thumbparts)
-		: uploadingData.media.parts;
+bool Uploader::sendPart(
+		const FullMsgId &fullId,
+		File &uploadingData,
+		int todc) {
+	auto &parts = uploadingData.parts();
 	const auto partsOfId = uploadingData.file
 		? (uploadingData.type() == SendMediaType::Photo
 			? uploadingData.file->id
 			: uploadingData.file->thumbId)
 		: uploadingData.media.thumbId;
+	uploadingData.started = true;
 	if (parts.isEmpty()) {
-		if (uploadingData.docSentParts >= uploadingData.docPartsCount) {
-			if (requestsSent.empty() && docRequestsSent.empty()) {
-				const auto silent = uploadingData.file
-					&& uploadingData.file->to.silent;
-				if (uploadingData.type() == SendMediaType::Photo) {
-					auto photoFilename = uploadingData.filename();
-					if (!photoFilename.endsWith(qstr(".jpg"), Qt::CaseInsensitive)) {
-						// Server has some extensions checking for inputMediaUploadedPhoto,
-						// so force the extension to be .jpg anyway. It doesn't matter,
-						// because the filename from inputFile is not used anywhere.
-						photoFilename += qstr(".jpg");
-					}
-					const auto md5 = uploadingData.file
-						? uploadingData.file->filemd5
-						: uploadingData.media.jpeg_md5;
-					const auto file = MTP_inputFile(
-						MTP_long(uploadingData.id()),
-						MTP_int(uploadingData.partsCount),
-						MTP_string(photoFilename),
-						MTP_bytes(md5));
-					emit photoReady(uploadingId, silent, file);
-				} else if (uploadingData.type() == SendMediaType::File
-					|| uploadingData.type() == SendMediaType::Audio) {
-					QByteArray docMd5(32, Qt::Uninitialized);
-					hashMd5Hex(uploadingData.md5Hash.result(), docMd5.data());
-
-					const auto file = (uploadingData.docSize > UseBigFilesFrom)
-						? MTP_inputFileBig(
-							MTP_long(uploadingData.id()),
-							MTP_int(uploadingData.docPartsCount),
-							MTP_string(uploadingData.filename()))
-						: MTP_inputFile(
-							MTP_long(uploadingData.id()),
-							MTP_int(uploadingData.docPartsCount),
-							MTP_string(uploadingData.filename()),
-							MTP_bytes(docMd5));
-					if (uploadingData.partsCount) {
-						const auto thumbFilename = uploadingData.file
-							? uploadingData.file->thumbname
-							: (qsl("thumb.") + uploadingData.media.thumbExt);
-						const auto thumbMd5 = uploadingData.file
-							? uploadingData.file->thumbmd5
-							: uploadingData.media.jpeg_md5;
-						const auto thumb = MTP_inputFile(
-							MTP_long(uploadingData.thumbId()),
-							MTP_int(uploadingData.partsCount),
-							MTP_string(thumbFilename),
-							MTP_bytes(thumbMd5));
-						emit thumbDocumentReady(
-							uploadingId,
-							silent,
-							file,
-							thumb);
-					} else {
-						emit documentReady(uploadingId, silent, file);
-					}
-				}
-				queue.erase(uploadingId);
-				uploadingId = FullMsgId();
-				sendNext();
-			}
-			return;
-		}
-
-		auto &content = uploadingData.file
-			? uploadingData.file->content
-			: uploadingData.media.data;
-		QByteArray toSend;
-		if (content.isEmpty()) {
-			if (!uploadingData.docFile) {
-				const auto filepath = uploadingData.file
-					? uploadingData.file->filepath
-					: uploadingData.media.file;
-				uploadingData.docFile = std::make_unique<QFile>(filepath);
-				if (!uploadingData.docFile->open(QIODevice::ReadOnly)) {
-					currentFailed();
-					return;
-				}
-			}
-			toSend = uploadingData.docFile->read(uploadingData.docPartSize);
-			if (uploadingData.docSize <= UseBigFilesFrom) {
-				uploadingData.md5Hash.feed(toSend.constData(), toSend.size());
-			}
-		} else {
-			const auto offset = uploadingData.docSentParts
-				* uploadingData.docPartSize;
-			toSend = content.mid(offset, uploadingData.docPartSize);
-			if ((uploadingData.type() == SendMediaType::File
-				|| uploadingData.type() == SendMediaType::Audio)
-				&& uploadingData.docSentParts <= UseBigFilesFrom) {
-				uploadingData.md5Hash.feed(toSend.constData(), toSend.size());
-			}
-		}
-		if ((toSend.size() > uploadingData.docPartSize)
-			|| ((toSend.size() < uploadingData.docPartSize
-				&& uploadingData.docSentParts + 1 != uploadingData.docPartsCount))) {
-			currentFailed();
-			return;
+		const auto &reader = uploadingData.docReader;
+		Assert(reader != nullptr);
+		if (reader->failed()) {
+			failed(fullId);
+			return false;
 		}
+		const auto toSend = reader->takePart();
 		mtpRequestId requestId;
 		if (uploadingData.docSize > UseBigFilesFrom) {
 			requestId = MTP::send(
@@ -349,11 +594,8 @@ void Uploader::sendNext() {
 				rpcFail(&Uploader::partFailed),
 				MTP::uploadDcId(todc));
 		}
-		docRequestsSent.emplace(requestId, uploadingData.docSentParts);
-		dcMap.emplace(requestId, todc);
-		sentSize += uploadingData.docPartSize;
-		sentSizes[todc] += uploadingData.docPartSize;
-
+		placeSentRequest(requestId, fullId, todc, toSend.size(), true);
+		++uploadingData.docRequestsInFlight;
 		uploadingData.docSentParts++;
 	} else {
 		auto part = parts.begin();
@@ -366,20 +608,34 @@ void Uploader::sendNext() {
 			rpcDone(&Uploader::partLoaded),
 			rpcFail(&Uploader::partFailed),
 			MTP::uploadDcId(todc));
-		requestsSent.emplace(requestId, part.value());
-		dcMap.emplace(requestId, todc);
-		sentSize += part.value().size();
-		sentSizes[todc] += part.value().size();
+		placeSentRequest(requestId, fullId, todc, part.value().size(), false);
 
 		parts.erase(part);
 	}
-	nextTimer.start(UploadRequestInterval);
+	++uploadingData.requestsInFlight;
+	return true;
+}
+
+void Uploader::placeSentRequest(
+		mtpRequestId requestId,
+		const FullMsgId &fullId,
+		int dc,
+		int size,
+		bool docPart) {
+	auto &request = requestsSent[requestId];
+	request.msgId = fullId;
+	request.dc = dc;
+	request.size = size;
+	request.docPart = docPart;
+	request.sent = getms();
+	sentSizes[dc] += size;
 }
 
 void Uploader::cancel(const FullMsgId &msgId) {
 	uploaded.erase(msgId);
-	if (uploadingId == msgId) {
-		currentFailed();
+	const auto i = queue.find(msgId);
+	if (i != queue.end() && i->second.started) {
+		failed(msgId);
 	} else {
 		queue.erase(msgId);
 	}
@@ -404,12 +660,6 @@ void Uploader::clear() {
 		MTP::cancel(requestData.first);
 	}
 	requestsSent.clear();
-	for (const auto &requestData : docRequestsSent) {
-		MTP::cancel(requestData.first);
-	}
-	docRequestsSent.clear();
-	dcMap.clear();
-	sentSize = 0;
 	for (int i = 0; i < MTP::kUploadSessionsCount; ++i) {
 		MTP::stopSession(MTP::uploadDcId(i));
 		sentSizes[i] = 0;
@@ -418,58 +668,46 @@ void Uploader::clear() {
 }
 
 void Uploader::partLoaded(const MTPBool &result, mtpRequestId requestId) {
-	auto j = docRequestsSent.end();
-	auto i = requestsSent.find(requestId);
+	const auto i = requestsSent.find(requestId);
 	if (i == requestsSent.cend()) {
-		j = docRequestsSent.find(requestId);
+		sendNext();
+		return;
 	}
-	if (i != requestsSent.cend() || j != docRequestsSent.cend()) {
-		if (mtpIsFalse(result)) { // failed to upload current file
-			currentFailed();
-			return;
-		} else {
-			auto dcIt = dcMap.find(requestId);
-			if (dcIt == dcMap.cend()) { // must not happen
-				currentFailed();
-				return;
-			}
-			auto dc = dcIt->second;
-			dcMap.erase(dcIt);
-
-			int32 sentPartSize = 0;
-			auto k = queue.find(uploadingId);
-			Assert(k != queue.cend());
-			auto &[fullId, file] = *k;
-			if (i != requestsSent.cend()) {
-				sentPartSize = i->second.size();
-				requestsSent.erase(i);
-			} else {
-				sentPartSize = file.docPartSize;
-				docRequestsSent.erase(j);
-			}
-			sentSize -= sentPartSize;
-			sentSizes[dc] -= sentPartSize;
-			if (file.type() == SendMediaType::Photo) {
-				file.fileSentSize += sentPartSize;
-				const auto photo = App::photo(file.id());
-				if (photo->uploading() && file.file) {
-					photo->uploadingData->size = file.file->partssize;
-					photo->uploadingData->offset = file.fileSentSize;
-				}
-				emit photoProgress(fullId);
-			} else if (file.type() == SendMediaType::File
-				|| file.type() == SendMediaType::Audio) {
-				const auto document = App::document(file.id());
-				if (document->uploading()) {
-					const auto doneParts = file.docSentParts
-						- int(docRequestsSent.size());
-					document->uploadingData->offset = std::min(
-						document->uploadingData->size,
-						doneParts * file.docPartSize);
-				}
-				emit documentProgress(fullId);
-			}
+	const auto request = i->second;
+	requestsSent.erase(i);
+	sentSizes[request.dc] -= request.size;
+
+	const auto k = queue.find(request.msgId);
+	Assert(k != queue.cend());
+	auto &[fullId, file] = *k;
+	--file.requestsInFlight;
+	if (request.docPart) {
+		--file.docRequestsInFlight;
+	}
+	if (mtpIsFalse(result)) { // failed to upload current file
+		failed(fullId);
+		return;
+	}
+	adjustWindow(request.dc, getms() - request.sent);
+	if (file.type() == SendMediaType::Photo) {
+		file.fileSentSize += request.size;
+		const auto photo = App::photo(file.id());
+		if (photo->uploading() && file.file) {
+			photo->uploadingData->size = file.file->partssize;
+			photo->uploadingData->offset = file.fileSentSize;
+		}
+		emit photoProgress(fullId);
+	} else if (file.type() == SendMediaType::File
+		|| file.type() == SendMediaType::Audio) {
+		const auto document = App::document(file.id());
+		if (document->uploading()) {
+			const auto doneParts = file.docSentParts
+				- file.docRequestsInFlight;
+			document->uploadingData->offset = std::min(
+				document->uploadingData->size,
+				doneParts * file.docPartSize);
 		}
+		emit documentProgress(fullId);
 	}
 
 	sendNext();
@@ -479,11 +717,15 @@ bool Uploader::partFailed(const RPCError &error, mtpRequestId requestId) {
 	if (MTP::isDefaultHandledError(error)) return false;
 
 	// failed to upload current file
-	if ((requestsSent.find(requestId) != requestsSent.cend())
-		|| (docRequestsSent.find(requestId) != docRequestsSent.cend())) {
-		currentFailed();
+	const auto i = requestsSent.find(requestId);
+	if (i != requestsSent.cend()) {
+		const auto fullId = i->second.msgId;
+		sentSizes[i->second.dc] -= i->second.size;
+		requestsSent.erase(i);
+		failed(fullId);
+	} else {
+		sendNext();
 	}
-	sendNext();
 	return true;
 }
 
@@ -7,12 +7,17 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 */
 #pragma once
 
+#include "base/weak_ptr.h"
+
 struct FileLoadResult;
 struct SendMediaReady;
 
 namespace Storage {
 
-class Uploader : public QObject, public RPCSender {
+class Uploader
+	: public QObject
+	, public RPCSender
+	, public base::has_weak_ptr {
 	Q_OBJECT
 
 public:
@@ -51,19 +56,35 @@ signals:
 
 private:
 	struct File;
+	struct SentRequest {
+		FullMsgId msgId;
+		int dc = 0;
+		int size = 0;
+		bool docPart = false;
+		TimeMs sent = 0;
+	};
 
 	void partLoaded(const MTPBool &result, mtpRequestId requestId);
 	bool partFailed(const RPCError &err, mtpRequestId requestId);
 
-	void currentFailed();
-
-	base::flat_map<mtpRequestId, QByteArray> requestsSent;
-	base::flat_map<mtpRequestId, int32> docRequestsSent;
-	base::flat_map<mtpRequestId, int32> dcMap;
-	uint32 sentSize = 0;
-	uint32 sentSizes[MTP::kUploadSessionsCount] = { 0 };
+	int chooseSession() const;
+	void adjustWindow(int dc, TimeMs duration);
+	void sendReady();
+	bool partReady(File &uploadingData);
+	bool sendPart(const FullMsgId &fullId, File &uploadingData, int todc);
+	void placeSentRequest(
+		mtpRequestId requestId,
+		const FullMsgId &fullId,
+		int dc,
+		int size,
+		bool docPart);
+	void failed(const FullMsgId &msgId);
+	void cancelRequests(const FullMsgId &msgId);
+
+	base::flat_map<mtpRequestId, SentRequest> requestsSent;
+	int sentSizes[MTP::kUploadSessionsCount] = { 0 };
+	int sessionWindows[MTP::kUploadSessionsCount] = { 0 };
 
-	FullMsgId uploadingId;
 	FullMsgId _pausedId;
 	std::map<FullMsgId, File> queue;
 	std::map<FullMsgId, File> uploaded;
@@ -21,7 +21,22 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 
 using Storage::ValidateThumbDimensions;
 
-TaskQueue::TaskQueue(TimeMs stopTimeoutMs) {
+namespace {
+
+QImage ScaledToBox(const QImage &image, int box) {
+	return (image.width() > box || image.height() > box)
+		? image.scaled(box, box, Qt::KeepAspectRatio, Qt::SmoothTransformation)
+		: image;
+}
+
+} // namespace
+
+TaskQueue::TaskQueue(
+	TimeMs stopTimeoutMs,
+	int threadsCount,
+	FinishOrder finishOrder)
+: _threadsCount(std::max(threadsCount, 1))
+, _finishOrder(finishOrder) {
 	if (stopTimeoutMs > 0) {
 		_stopTimer = new QTimer(this);
 		connect(_stopTimer, SIGNAL(timeout()), this, SLOT(stop()));
@@ -30,50 +45,86 @@ TaskQueue::TaskQueue(TimeMs stopTimeoutMs) {
 	}
 }
 
-TaskId TaskQueue::addTask(std::unique_ptr<Task> &&task) {
+TaskId TaskQueue::addTask(
+		std::unique_ptr<Task> &&task,
+		TaskPriority priority) {
 	const auto result = task->id();
+	if (_finishOrder == FinishOrder::AsAdded) {
+		_addedOrder.push_back(result);
+	}
 	{
 		QMutexLocker lock(&_tasksToProcessMutex);
-		_tasksToProcess.push_back(std::move(task));
+		_tasksToProcess[static_cast<int>(priority)].push_back(
+			std::move(task));
 	}
 
-	wakeThread();
+	wakeThreads();
 
 	return result;
 }
 
-void TaskQueue::addTasks(std::vector<std::unique_ptr<Task>> &&tasks) {
+void TaskQueue::addTasks(
+		std::vector<std::unique_ptr<Task>> &&tasks,
+		TaskPriority priority) {
+	if (_finishOrder == FinishOrder::AsAdded) {
+		for (const auto &task : tasks) {
+			_addedOrder.push_back(task->id());
+		}
+	}
 	{
 		QMutexLocker lock(&_tasksToProcessMutex);
+		auto &queue = _tasksToProcess[static_cast<int>(priority)];
 		for (auto &task : tasks) {
-			_tasksToProcess.push_back(std::move(task));
+			queue.push_back(std::move(task));
 		}
 	}
 
-	wakeThread();
+	wakeThreads();
 }
 
-void TaskQueue::wakeThread() {
-	if (!_thread) {
-		_thread = new QThread();
-
-		_worker = new TaskQueueWorker(this);
-		_worker->moveToThread(_thread);
+void TaskQueue::wakeThreads() {
+	if (_threads.empty()) {
+		for (auto i = 0; i != _threadsCount; ++i) {
+			const auto thread = new QThread();
+			const auto worker = new TaskQueueWorker(this);
+			worker->moveToThread(thread);
 
-		connect(this, SIGNAL(taskAdded()), _worker, SLOT(onTaskAdded()));
-		connect(_worker, SIGNAL(taskProcessed()), this, SLOT(onTaskProcessed()));
+			connect(this, SIGNAL(taskAdded()), worker, SLOT(onTaskAdded()));
+			connect(worker, SIGNAL(taskProcessed()), this, SLOT(onTaskProcessed()));
 
-		_thread->start();
+			thread->start();
+			_threads.push_back(thread);
+			_workers.push_back(worker);
+		}
 	}
 	if (_stopTimer) _stopTimer->stop();
 	emit taskAdded();
 }
 
+std::unique_ptr<Task> TaskQueue::takeTaskToProcess() {
+	for (auto i = kPrioritiesCount; i != 0;) {
+		auto &queue = _tasksToProcess[--i];
+		if (!queue.empty()) {
+			auto result = std::move(queue.front());
+			queue.pop_front();
+			_tasksInProcess.push_back(result->id());
+			return result;
+		}
+	}
+	return nullptr;
+}
+
+bool TaskQueue::hasTasksToProcess() const {
+	return ranges::find_if(_tasksToProcess, [](const auto &queue) {
+		return !queue.empty();
+	}) != _tasksToProcess.end();
+}
+
 void TaskQueue::cancelTask(TaskId id) {
-	const auto removeFrom = [&](std::deque<std::unique_ptr<Task>> &queue) {
-		const auto proj = [](const std::unique_ptr<Task> &task) {
-			return task->id();
-		};
+	const auto proj = [](const std::unique_ptr<Task> &task) {
+		return task->id();
+	};
+	const auto removeFrom = [&](auto &queue) {
 		auto i = ranges::find(queue, id, proj);
 		if (i != queue.end()) {
 			queue.erase(i);
@@ -81,16 +132,30 @@ void TaskQueue::cancelTask(TaskId id) {
 	};
 	{
 		QMutexLocker lock(&_tasksToProcessMutex);
-		removeFrom(_tasksToProcess);
-		if (_taskInProcessId == id) {
-			_taskInProcessId = TaskId();
+		for (auto &queue : _tasksToProcess) {
+			removeFrom(queue);
+		}
+		auto i = ranges::find(_tasksInProcess, id);
+		if (i != _tasksInProcess.end()) {
+			_tasksInProcess.erase(i);
 		}
 	}
-	QMutexLocker lock(&_tasksToFinishMutex);
-	removeFrom(_tasksToFinish);
+	{
+		QMutexLocker lock(&_tasksToFinishMutex);
+		removeFrom(_tasksToFinish);
+	}
+	removeFrom(_finishedOutOfOrder);
+	auto i = ranges::find(_addedOrder, id);
+	if (i != _addedOrder.end()) {
+		_addedOrder.erase(i);
+
+		// The cancelled task could hold the finished ones after it.
+		finishInOrder(nullptr);
+	}
 }
 
 void TaskQueue::onTaskProcessed() {
+	// All the tasks processed till now are finished in one event.
 	do {
 		auto task = std::unique_ptr<Task>();
 		{
@@ -99,31 +164,67 @@ void TaskQueue::onTaskProcessed() {
 			task = std::move(_tasksToFinish.front());
 			_tasksToFinish.pop_front();
 		}
-		task->finish();
+		if (_finishOrder == FinishOrder::AsAdded) {
+			finishInOrder(std::move(task));
+		} else {
+			task->finish();
+		}
 	} while (true);
 
 	if (_stopTimer) {
 		QMutexLocker lock(&_tasksToProcessMutex);
-		if (_tasksToProcess.empty() && !_taskInProcessId) {
+		if (!hasTasksToProcess() && _tasksInProcess.empty()) {
 			_stopTimer->start();
 		}
 	}
 }
 
+void TaskQueue::finishInOrder(std::unique_ptr<Task> &&task) {
+	if (task) {
+		_finishedOutOfOrder.push_back(std::move(task));
+	}
+	while (!_addedOrder.empty()) {
+		const auto proj = [](const std::unique_ptr<Task> &task) {
+			return task->id();
+		};
+		const auto i = ranges::find(
+			_finishedOutOfOrder,
+			_addedOrder.front(),
+			proj);
+		if (i == _finishedOutOfOrder.end()) {
+			break;
+		}
+		auto next = std::move(*i);
+		_finishedOutOfOrder.erase(i);
+		_addedOrder.pop_front();
+		next->finish();
+	}
+}
+
 void TaskQueue::stop() {
-	if (_thread) {
-		_thread->requestInterruption();
-		_thread->quit();
+	for (const auto thread : _threads) {
+		thread->requestInterruption();
+		thread->quit();
+	}
+	if (!_threads.empty()) {
 		DEBUG_LOG(("Waiting for taskThread to finish"));
-		_thread->wait();
-		delete _worker;
-		delete _thread;
-		_worker = 0;
-		_thread = 0;
 	}
-	_tasksToProcess.clear();
+	for (const auto thread : _threads) {
+		thread->wait();
+	}
+	for (const auto worker : base::take(_workers)) {
+		delete worker;
+	}
+	for (const auto thread : base::take(_threads)) {
+		delete thread;
+	}
+	for (auto &queue : _tasksToProcess) {
+		queue.clear();
+	}
 	_tasksToFinish.clear();
-	_taskInProcessId = TaskId();
+	_tasksInProcess.clear();
+	_finishedOutOfOrder.clear();
+	_addedOrder.clear();
 }
 
 TaskQueue::~TaskQueue() {
@@ -140,26 +241,25 @@ void TaskQueueWorker::onTaskAdded() {
 		auto task = std::unique_ptr<Task>();
 		{
 			QMutexLocker lock(&_queue->_tasksToProcessMutex);
-			if (!_queue->_tasksToProcess.empty()) {
-				task = std::move(_queue->_tasksToProcess.front());
-				_queue->_tasksToProcess.pop_front();
-				_queue->_taskInProcessId = task->id();
-			}
+			task = _queue->takeTaskToProcess();
 		}
 
+		someTasksLeft = false;
 		if (task) {
 			task->process();
 			bool emitTaskProcessed = false;
 			{
 				QMutexLocker lockToProcess(&_queue->_tasksToProcessMutex);
-				if (_queue->_taskInProcessId == task->id()) {
-					_queue->_taskInProcessId = TaskId();
-					someTasksLeft = !_queue->_tasksToProcess.empty();
+				auto &inProcess = _queue->_tasksInProcess;
+				const auto i = ranges::find(inProcess, task->id());
+				if (i != inProcess.end()) {
+					inProcess.erase(i);
 
 					QMutexLocker lockToFinish(&_queue->_tasksToFinishMutex);
 					emitTaskProcessed = _queue->_tasksToFinish.empty();
 					_queue->_tasksToFinish.push_back(std::move(task));
 				}
+				someTasksLeft = _queue->hasTasksToProcess();
 			}
 			if (emitTaskProcessed) {
 				emit taskProcessed();
@@ -470,7 +570,7 @@ void FileLoadTask::process() {
 
 	PreparedPhotoThumbs photoThumbs;
 	QVector<MTPPhotoSize> photoSizes;
-	QPixmap thumb;
+	QImage thumb;
 
 	QVector<MTPDocumentAttribute> attributes(1, MTP_documentAttributeFilename(MTP_string(filename)));
 
@@ -489,9 +589,7 @@ void FileLoadTask::process() {
 			auto flags = MTPDdocumentAttributeAudio::Flag::f_title | MTPDdocumentAttributeAudio::Flag::f_performer;
 			attributes.push_back(MTP_documentAttributeAudio(MTP_flags(flags), MTP_int(song->duration), MTP_string(song->title), MTP_string(song->performer), MTPstring()));
 			if (!song->cover.isNull()) { // cover to thumb
-				auto coverWidth = song->cover.width();
-				auto coverHeight = song->cover.height();
-				auto full = (coverWidth > 90 || coverHeight > 90) ? App::pixmapFromImageInPlace(song->cover.scaled(90, 90, Qt::KeepAspectRatio, Qt::SmoothTransformation)) : App::pixmapFromImageInPlace(std::move(song->cover));
+				auto full = ScaledToBox(song->cover, 90);
 				{
 					auto thumbFormat = QByteArray("JPG");
 					auto thumbQuality = 87;
@@ -527,7 +625,7 @@ void FileLoadTask::process() {
 				cover.save(&buffer, thumbFormat, thumbQuality);
 			}
 
-			thumb = App::pixmapFromImageInPlace(std::move(cover));
+			thumb = std::move(cover);
 			thumbSize = MTP_photoSize(MTP_string(""), MTP_fileLocationUnavailable(MTP_long(0), MTP_int(0), MTP_long(0)), MTP_int(thumb.width()), MTP_int(thumb.height()), MTP_int(0));
 
 			thumbId = rand_value<uint64>();
@@ -539,25 +637,33 @@ void FileLoadTask::process() {
 		attributes.push_back(MTP_documentAttributeImageSize(MTP_int(w), MTP_int(h)));
 
 		if (ValidateThumbDimensions(w, h)) {
+			auto thumbSource = fullimage;
 			if (isAnimation) {
 				attributes.push_back(MTP_documentAttributeAnimated());
 			} else if (_type != SendMediaType::File) {
-				auto thumb = (w > 100 || h > 100) ? App::pixmapFromImageInPlace(fullimage.scaled(100, 100, Qt::KeepAspectRatio, Qt::SmoothTransformation)) : QPixmap::fromImage(fullimage);
-				photoThumbs.insert('s', thumb);
-				photoSizes.push_back(MTP_photoSize(MTP_string("s"), MTP_fileLocationUnavailable(MTP_long(0), MTP_int(0), MTP_long(0)), MTP_int(thumb.width()), MTP_int(thumb.height()), MTP_int(0)));
+				// Each size is scaled from the previous larger one, while
+				// the largest one is being encoded in the background.
+				auto full = ScaledToBox(fullimage, 1280);
+				QSemaphore encoded;
+				crl::async([&] {
+					const auto guard = gsl::finally([&] { encoded.release(); });
+					QBuffer buffer(&filedata);
+					full.save(&buffer, "JPG", 87);
+				});
+				auto medium = ScaledToBox(full, 320);
+				auto small = ScaledToBox(medium, 100);
+
+				photoThumbs.insert('s', small);
+				photoSizes.push_back(MTP_photoSize(MTP_string("s"), MTP_fileLocationUnavailable(MTP_long(0), MTP_int(0), MTP_long(0)), MTP_int(small.width()), MTP_int(small.height()), MTP_int(0)));
 
-				auto medium = (w > 320 || h > 320) ? App::pixmapFromImageInPlace(fullimage.scaled(320, 320, Qt::KeepAspectRatio, Qt::SmoothTransformation)) : QPixmap::fromImage(fullimage);
 				photoThumbs.insert('m', medium);
 				photoSizes.push_back(MTP_photoSize(MTP_string("m"), MTP_fileLocationUnavailable(MTP_long(0), MTP_int(0), MTP_long(0)), MTP_int(medium.width()), MTP_int(medium.height()), MTP_int(0)));
 
-				auto full = (w > 1280 || h > 1280) ? App::pixmapFromImageInPlace(fullimage.scaled(1280, 1280, Qt::KeepAspectRatio, Qt::SmoothTransformation)) : QPixmap::fromImage(fullimage);
 				photoThumbs.insert('y', full);
 				photoSizes.push_back(MTP_photoSize(MTP_string("y"), MTP_fileLocationUnavailable(MTP_long(0), MTP_int(0), MTP_long(0)), MTP_int(full.width()), MTP_int(full.height()), MTP_int(0)));
 
-				{
-					QBuffer buffer(&filedata);
-					full.save(&buffer, "JPG", 87);
-				}
+				thumbSource = std::move(medium);
+				encoded.acquire();
 
 				photo = MTP_photo(MTP_flags(0), MTP_long(_id), MTP_long(0), MTP_int(unixtime()), MTP_vector<MTPPhotoSize>(photoSizes));
 
@@ -580,7 +686,7 @@ void FileLoadTask::process() {
 				thumbname = qsl("thumb.webp");
 			}
 
-			QPixmap full = (w > 90 || h > 90) ? App::pixmapFromImageInPlace(fullimage.scaled(90, 90, Qt::KeepAspectRatio, Qt::SmoothTransformation)) : QPixmap::fromImage(fullimage, Qt::ColorOnly);
+			auto full = ScaledToBox(thumbSource, 90);
 
 			{
 				QBuffer buffer(&thumbdata);
@@ -102,15 +102,36 @@ public:
 
 };
 
+enum class TaskPriority {
+	Low,
+	Normal,
+	High,
+};
+
 class TaskQueueWorker;
 class TaskQueue : public QObject {
 	Q_OBJECT
 
 public:
-	explicit TaskQueue(TimeMs stopTimeoutMs = 0); // <= 0 - never stop worker
+	// Tasks are processed by several threads, the ones with a higher
+	// priority first. finish() is called in the order the tasks were
+	// added only with FinishOrder::AsAdded.
+	enum class FinishOrder {
+		Any,
+		AsAdded,
+	};
 
-	TaskId addTask(std::unique_ptr<Task> &&task);
-	void addTasks(std::vector<std::unique_ptr<Task>> &&tasks);
+	explicit TaskQueue(
+		TimeMs stopTimeoutMs = 0, // <= 0 - never stop workers
+		int threadsCount = 1,
+		FinishOrder finishOrder = FinishOrder::Any);
+
+	TaskId addTask(
+		std::unique_ptr<Task> &&task,
+		TaskPriority priority = TaskPriority::Normal);
+	void addTasks(
+		std::vector<std::unique_ptr<Task>> &&tasks,
+		TaskPriority priority = TaskPriority::Normal);
 	void cancelTask(TaskId id); // this task finish() won't be called
 
 	~TaskQueue();
@@ -125,14 +146,30 @@ public slots:
 private:
 	friend class TaskQueueWorker;
 
-	void wakeThread();
+	static constexpr auto kPrioritiesCount = 3;
+
+	void wakeThreads();
+	void finishInOrder(std::unique_ptr<Task> &&task);
 
-	std::deque<std::unique_ptr<Task>> _tasksToProcess;
+	// Called with _tasksToProcessMutex locked.
+	std::unique_ptr<Task> takeTaskToProcess();
+	bool hasTasksToProcess() const;
+
+	std::array<
+		std::deque<std::unique_ptr<Task>>,
+		kPrioritiesCount> _tasksToProcess;
 	std::deque<std::unique_ptr<Task>> _tasksToFinish;
-	TaskId _taskInProcessId = TaskId();
+	std::vector<TaskId> _tasksInProcess;
 	QMutex _tasksToProcessMutex, _tasksToFinishMutex;
-	QThread *_thread = nullptr;
-	TaskQueueWorker *_worker = nullptr;
+
+	// Used only in the queue thread for FinishOrder::AsAdded.
+	std::deque<TaskId> _addedOrder;
+	std::vector<std::unique_ptr<Task>> _finishedOutOfOrder;
+
+	int _threadsCount = 1;
+	FinishOrder _finishOrder = FinishOrder::Any;
+	std::vector<QThread*> _threads;
+	std::vector<TaskQueueWorker*> _workers;
 	QTimer *_stopTimer = nullptr;
 
 };
@@ -211,7 +248,7 @@ struct FileLoadResult {
 	QString thumbname;
 	UploadFileParts thumbparts;
 	QByteArray thumbmd5;
-	QPixmap thumb;
+	QImage thumb;
 
 	MTPPhoto photo;
 	MTPDocument document;
@@ -9,6 +9,8 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 
 #include "storage/serialize_document.h"
 #include "storage/serialize_common.h"
+#include "storage/storage_cache_pack.h"
+#include "storage/storage_download_target.h"
 #include "chat_helpers/stickers.h"
 #include "data/data_drafts.h"
 #include "boxes/send_files_box.h"
@@ -34,6 +36,7 @@ namespace {
 
 constexpr auto kThemeFileSizeLimit = 5 * 1024 * 1024;
 constexpr auto kFileLoaderQueueStopTimeout = TimeMs(5000);
+constexpr auto kFileLoaderThreadsCount = 3;
 
 using FileKey = quint64;
 
@@ -72,7 +75,70 @@ enum class FileOption {
 using FileOptions = base::flags<FileOption>;
 inline constexpr auto is_flag_type(FileOption) { return true; };
 
+// Writes the local files in a background thread. A write to a file that
+// was not started yet is replaced by a newer write to the same file and
+// is moved to the end of the queue, so the jobs are done in push order.
+class FileWriter : public QThread {
+public:
+	struct Chunk {
+		QByteArray data;
+		MTP::AuthKeyPtr key; // If not null the data is encrypted with it.
+	};
+	struct Job {
+		QString base; // Full path without the '0' or '1' suffix.
+		FileOptions options;
+		std::vector<Chunk> chunks;
+		bool remove = false;
+		base::lambda_once<void()> custom; // Replaces the file writing.
+
+		// Called after the job is done. A replaced job passes them to
+		// the newer one, so they are called after the newer write.
+		std::vector<base::lambda_once<void()>> done;
+	};
+
+	void push(Job &&job);
+	bool pending(const QString &base);
+
+	// Wait until all the jobs pushed before are written.
+	void flush();
+	void flush(const QString &base);
+
+	// Write everything pushed and stop the thread.
+	void stop();
+
+	static void Write(Job &job, std::map<QString, QChar> *written = nullptr);
+
+protected:
+	void run() override;
+
+private:
+	static void WriteFile(Job &job, std::map<QString, QChar> *written);
+
+	QMutex _mutex;
+	QWaitCondition _pushed;
+	QWaitCondition _written;
+	std::deque<QString> _order;
+	std::map<QString, Job> _jobs;
+	QString _writing;
+	bool _stopping = false;
+
+	// Last written suffix for each path, so that we don't need to
+	// compare the modification time of two files on each write.
+	std::map<QString, QChar> _suffixes;
+
+};
+
+FileWriter *_writer = nullptr;
+
+// Cached images, stickers, audios and web files are kept in the pack.
+std::unique_ptr<Storage::CachePack> _cachePack;
+
+QString cacheJobName(FileKey key) {
+	return _userBasePath + qsl("cache/") + toFilePart(key);
+}
+
 bool keyAlreadyUsed(QString &name, FileOptions options = FileOption::User | FileOption::Safe) {
+	if (_writer && _writer->pending(name)) return true;
 	name += '0';
 	if (QFileInfo(name).exists()) return true;
 	if (options & (FileOption::Safe)) {
@@ -109,9 +175,36 @@ void clearKey(const FileKey &key, FileOptions options = FileOption::User | FileO
 		if (!_working()) return;
 	}
 
+	if (options == FileOption::User && _cachePack) {
+		const auto name = cacheJobName(key);
+		if (_cachePack->contains(key) || (_writer && _writer->pending(name))) {
+			auto job = FileWriter::Job();
+			job.base = name;
+			job.custom = [key] {
+				_cachePack->remove(key);
+			};
+			if (_writer) {
+				_writer->push(std::move(job));
+			} else {
+				job.custom();
+			}
+			return;
+		}
+	}
+
 	QString base = (options & FileOption::User) ? _userBasePath : _basePath, name;
 	name.reserve(base.size() + 0x11);
-	name.append(base).append(toFilePart(key)).append('0');
+	name.append(base).append(toFilePart(key));
+	if (_writer) {
+		// Removal should be ordered with the pending writes.
+		auto job = FileWriter::Job();
+		job.base = name;
+		job.options = options;
+		job.remove = true;
+		_writer->push(std::move(job));
+		return;
+	}
+	name.append('0');
 	QFile::remove(name);
 	if (options & FileOption::Safe) {
 		name[name.size() - 1] = '1';
@@ -195,6 +288,23 @@ struct EncryptedDescriptor {
 	}
 };
 
+QByteArray encryptLocalData(QByteArray &&toEncrypt, const MTP::AuthKeyPtr &key) {
+	// prepare for encryption
+	uint32 size = toEncrypt.size(), fullSize = size;
+	if (fullSize & 0x0F) {
+		fullSize += 0x10 - (fullSize & 0x0F);
+		toEncrypt.resize(fullSize);
+		memset_rand(toEncrypt.data() + size, fullSize - size);
+	}
+	*(uint32*)toEncrypt.data() = size;
+	QByteArray encrypted(0x10 + fullSize, Qt::Uninitialized); // 128bit of sha1 - key128, sizeof(data), data
+	hashSha1(toEncrypt.constData(), toEncrypt.size(), encrypted.data());
+	MTP::aesEncryptLocal(toEncrypt.constData(), encrypted.data() + 0x10, fullSize, key, encrypted.constData());
+
+	return encrypted;
+}
+
+// Collects the data and passes it to the FileWriter on finish.
 struct FileWriteDescriptor {
 	FileWriteDescriptor(const FileKey &key, FileOptions options = FileOption::User | FileOption::Safe) {
 		init(toFilePart(key), options);
@@ -208,12 +318,153 @@ struct FileWriteDescriptor {
 		} else {
 			if (!_working()) return;
 		}
+		job.base = ((options & FileOption::User) ? _userBasePath : _basePath) + name;
+		job.options = options;
+	}
+	bool writeData(const QByteArray &data) {
+		if (job.base.isEmpty()) return false;
 
-		// detect order of read attempts and file version
-		QString toTry[2];
-		toTry[0] = ((options & FileOption::User) ? _userBasePath : _basePath) + name + '0';
-		if (options & FileOption::Safe) {
-			toTry[1] = ((options & FileOption::User) ? _userBasePath : _basePath) + name + '1';
+		job.chunks.push_back({ data, nullptr });
+		return true;
+	}
+	static QByteArray prepareEncrypted(EncryptedDescriptor &data, const MTP::AuthKeyPtr &key = LocalKey) {
+		data.finish();
+		return encryptLocalData(std::move(data.data), key);
+	}
+	bool writeEncrypted(EncryptedDescriptor &data, const MTP::AuthKeyPtr &key = LocalKey) {
+		if (job.base.isEmpty()) return false;
+
+		// Encryption is done by the FileWriter as well.
+		data.finish();
+		job.chunks.push_back({ std::move(data.data), key });
+		return true;
+	}
+	void finish() {
+		if (job.base.isEmpty()) return;
+
+		if (_writer) {
+			_writer->push(base::take(job));
+		} else {
+			FileWriter::Write(job);
+			job = FileWriter::Job();
+		}
+	}
+	FileWriter::Job job;
+
+	~FileWriteDescriptor() {
+		finish();
+	}
+};
+
+void FileWriter::push(Job &&job) {
+	QMutexLocker lock(&_mutex);
+	auto i = _jobs.find(job.base);
+	if (i != _jobs.end()) {
+		_order.erase(ranges::find(_order, job.base));
+		_order.push_back(job.base);
+		auto done = base::take(i->second.done);
+		for (auto &callback : job.done) {
+			done.push_back(std::move(callback));
+		}
+		i->second = std::move(job);
+		i->second.done = std::move(done);
+	} else {
+		_order.push_back(job.base);
+		_jobs.emplace(job.base, std::move(job));
+	}
+	_pushed.wakeOne();
+}
+
+bool FileWriter::pending(const QString &base) {
+	QMutexLocker lock(&_mutex);
+	return (_jobs.find(base) != _jobs.end()) || (_writing == base);
+}
+
+void FileWriter::flush() {
+	QMutexLocker lock(&_mutex);
+	while (!_order.empty() || !_writing.isEmpty()) {
+		_written.wait(&_mutex);
+	}
+}
+
+void FileWriter::flush(const QString &base) {
+	QMutexLocker lock(&_mutex);
+	while (_jobs.find(base) != _jobs.end() || _writing == base) {
+		_written.wait(&_mutex);
+	}
+}
+
+void FileWriter::stop() {
+	{
+		QMutexLocker lock(&_mutex);
+		_stopping = true;
+		_pushed.wakeOne();
+	}
+	wait();
+}
+
+void FileWriter::run() {
+	QMutexLocker lock(&_mutex);
+	while (true) {
+		if (_order.empty()) {
+			if (_stopping) {
+				break;
+			}
+			_pushed.wait(&_mutex);
+			continue;
+		}
+		_writing = _order.front();
+		_order.pop_front();
+		auto i = _jobs.find(_writing);
+		auto job = std::move(i->second);
+		_jobs.erase(i);
+
+		lock.unlock();
+		Write(job, &_suffixes);
+		lock.relock();
+
+		_writing = QString();
+		_written.wakeAll();
+	}
+}
+
+void FileWriter::Write(Job &job, std::map<QString, QChar> *written) {
+	WriteFile(job, written);
+	for (auto &callback : base::take(job.done)) {
+		callback();
+	}
+}
+
+void FileWriter::WriteFile(Job &job, std::map<QString, QChar> *written) {
+	if (job.custom) {
+		job.custom();
+		return;
+	} else if (job.remove) {
+		QFile::remove(job.base + '0');
+		if (job.options & FileOption::Safe) {
+			QFile::remove(job.base + '1');
+		}
+		if (written) {
+			written->erase(job.base);
+		}
+		return;
+	}
+
+	// detect order of read attempts and file version
+	QString toTry[2];
+	toTry[0] = job.base + '0';
+	QString toDelete;
+	if (job.options & FileOption::Safe) {
+		toTry[1] = job.base + '1';
+		const auto known = written
+			&& (written->find(job.base) != written->end());
+		if (known) {
+			// The file written last time is the only one left.
+			if ((*written)[job.base] == '0') {
+				qSwap(toTry[0], toTry[1]);
+			}
+			toDelete = toTry[1];
+		} else {
 			QFileInfo toTry0(toTry[0]);
 			QFileInfo toTry1(toTry[1]);
 			if (toTry0.exists()) {
@@ -230,20 +481,26 @@ struct FileWriteDescriptor {
 				toDelete = toTry[1];
 			}
 		}
+	}
 
-		file.setFileName(toTry[0]);
-		if (file.open(QIODevice::WriteOnly)) {
-			file.write(tdfMagic, tdfMagicLen);
-			qint32 version = AppVersion;
-			file.write((const char*)&version, sizeof(version));
-
-			stream.setDevice(&file);
-			stream.setVersion(QDataStream::Qt_5_1);
-		}
+	QFile file(toTry[0]);
+	if (!file.open(QIODevice::WriteOnly)) {
+		LOG(("App Error: could not open '%1' for writing.").arg(toTry[0]));
+		return;
 	}
-	bool writeData(const QByteArray &data) {
-		if (!file.isOpen()) return false;
+	file.write(tdfMagic, tdfMagicLen);
+	qint32 version = AppVersion;
+	file.write((const char*)&version, sizeof(version));
+
+	QDataStream stream(&file);
+	stream.setVersion(QDataStream::Qt_5_1);
 
+	HashMd5 md5;
+	int32 dataSize = 0;
+	for (auto &chunk : job.chunks) {
+		const auto data = chunk.key
+			? encryptLocalData(std::move(chunk.data), chunk.key)
+			: chunk.data;
 		stream << data;
 		quint32 len = data.isNull() ? 0xffffffff : data.size();
 		if (QSysInfo::ByteOrder != QSysInfo::BigEndian) {
@@ -252,58 +509,22 @@ struct FileWriteDescriptor {
 		md5.feed(&len, sizeof(len));
 		md5.feed(data.constData(), data.size());
 		dataSize += sizeof(len) + data.size();
-
-		return true;
 	}
-	static QByteArray prepareEncrypted(EncryptedDescriptor &data, const MTP::AuthKeyPtr &key = LocalKey) {
-		data.finish();
-		QByteArray &toEncrypt(data.data);
+	stream.setDevice(0);
 
-		// prepare for encryption
-		uint32 size = toEncrypt.size(), fullSize = size;
-		if (fullSize & 0x0F) {
-			fullSize += 0x10 - (fullSize & 0x0F);
-			toEncrypt.resize(fullSize);
-			memset_rand(toEncrypt.data() + size, fullSize - size);
-		}
-		*(uint32*)toEncrypt.data() = size;
-		QByteArray encrypted(0x10 + fullSize, Qt::Uninitialized); // 128bit of sha1 - key128, sizeof(data), data
-		hashSha1(toEncrypt.constData(), toEncrypt.size(), encrypted.data());
-		MTP::aesEncryptLocal(toEncrypt.constData(), encrypted.data() + 0x10, fullSize, key, encrypted.constData());
+	md5.feed(&dataSize, sizeof(dataSize));
+	md5.feed(&version, sizeof(version));
+	md5.feed(tdfMagic, tdfMagicLen);
+	file.write((const char*)md5.result(), 0x10);
+	file.close();
 
-		return encrypted;
+	if (!toDelete.isEmpty()) {
+		QFile::remove(toDelete);
 	}
-	bool writeEncrypted(EncryptedDescriptor &data, const MTP::AuthKeyPtr &key = LocalKey) {
-		return writeData(prepareEncrypted(data, key));
+	if (written && (job.options & FileOption::Safe)) {
+		(*written)[job.base] = toTry[0][toTry[0].size() - 1];
 	}
-	void finish() {
-		if (!file.isOpen()) return;
-
-		stream.setDevice(0);
-
-		md5.feed(&dataSize, sizeof(dataSize));
-		qint32 version = AppVersion;
-		md5.feed(&version, sizeof(version));
-		md5.feed(tdfMagic, tdfMagicLen);
-		file.write((const char*)md5.result(), 0x10);
-		file.close();
-
-		if (!toDelete.isEmpty()) {
-			QFile::remove(toDelete);
-		}
-	}
-	QFile file;
-	QDataStream stream;
-
-	QString toDelete;
-
-	HashMd5 md5;
-	int32 dataSize = 0;
-
-	~FileWriteDescriptor() {
-		finish();
-	}
-};
+}
 
 bool readFile(FileReadDescriptor &result, const QString &name, FileOptions options = FileOption::User | FileOption::Safe) {
 	if (options & FileOption::User) {
@@ -312,6 +533,10 @@ bool readFile(FileReadDescriptor &result, const QString &name, FileOptions optio
 		if (!_working()) return false;
 	}
 
+	if (_writer) {
+		_writer->flush(((options & FileOption::User) ? _userBasePath : _basePath) + name);
+	}
+
 	// detect order of read attempts
 	QString toTry[2];
 	toTry[0] = ((options & FileOption::User) ? _userBasePath : _basePath) + name + '0';
@@ -472,6 +697,66 @@ bool readEncryptedFile(FileReadDescriptor &result, const FileKey &fkey, FileOpti
 	return readEncryptedFile(result, toFilePart(fkey), options, key);
 }
 
+FileKey genCacheKey() {
+	if (!_cachePack) {
+		return genKey(FileOption::User);
+	}
+	auto result = FileKey();
+	do {
+		result = rand_value<FileKey>();
+	} while (!result
+		|| _cachePack->contains(result)
+		|| (_writer && _writer->pending(cacheJobName(result))));
+	return result;
+}
+
+void writeCache(const FileKey &key, EncryptedDescriptor &data) {
+	if (!_cachePack) {
+		FileWriteDescriptor file(key, FileOption::User);
+		file.writeEncrypted(data);
+		return;
+	}
+	data.finish();
+
+	auto job = FileWriter::Job();
+	job.base = cacheJobName(key);
+	job.custom = [key, plain = std::move(data.data), localKey = LocalKey]() mutable {
+		_cachePack->put(key, encryptLocalData(std::move(plain), localKey));
+	};
+	if (_writer) {
+		_writer->push(std::move(job));
+	} else {
+		job.custom();
+	}
+}
+
+bool readEncryptedCache(FileReadDescriptor &result, const FileKey &key) {
+	if (!_cachePack) {
+		return readEncryptedFile(result, key, FileOption::User);
+	}
+	if (_writer) {
+		_writer->flush(cacheJobName(key));
+	}
+	const auto encrypted = _cachePack->get(key);
+	if (encrypted.isEmpty()) {
+		// Cached before the pack was used.
+		return readEncryptedFile(result, key, FileOption::User);
+	}
+
+	EncryptedDescriptor data;
+	if (!decryptLocal(data, encrypted)) {
+		return false;
+	}
+	result.version = AppVersion;
+	result.data = data.data;
+	result.buffer.setBuffer(&result.data);
+	result.buffer.open(QIODevice::ReadOnly);
+	result.buffer.seek(data.buffer.pos());
+	result.stream.setDevice(&result.buffer);
+	result.stream.setVersion(QDataStream::Qt_5_1);
+	return true;
+}
+
 FileKey _dataNameKey = 0;
 
 enum { // Local Storage Keys
@@ -494,6 +779,7 @@ enum { // Local Storage Keys
 	lskStickersKeys = 0x10, // no data
 	lskTrustedBots = 0x11, // no data
 	lskFavedStickers = 0x12, // no data
+	lskMapJournal = 0x13, // no data
 };
 
 enum {
@@ -644,6 +930,118 @@ AuthSessionData &GetStoredAuthSessionCache() {
 
 void _writeMap(WriteMapWhen when = WriteMapWhen::Soon);
 
+// Changes of the cached files maps are appended to the map journal
+// instead of writing the whole map each time. The map is a checkpoint
+// that refers to the journal with the changes done after it.
+constexpr auto kMapJournalRecordsLimit = 1024;
+
+struct MapJournal {
+	FileKey key = 0;
+	int records = 0;
+
+	QMutex mutex;
+	std::vector<QByteArray> pending; // Encrypted records not written yet.
+};
+std::shared_ptr<MapJournal> _mapJournal;
+
+QString _mapJournalPath(FileKey key) {
+	return _userBasePath + toFilePart(key) + '0';
+}
+
+void _writeMapJournal(
+		const std::shared_ptr<MapJournal> &journal,
+		const QString &path) {
+	auto records = std::vector<QByteArray>();
+	{
+		QMutexLocker lock(&journal->mutex);
+		records = base::take(journal->pending);
+	}
+	if (records.empty()) {
+		return;
+	}
+	QFile file(path);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+		LOG(("App Error: could not open '%1' for writing."
+			).arg(file.fileName()));
+		return;
+	}
+	QDataStream stream(&file);
+	stream.setVersion(QDataStream::Qt_5_1);
+	for (const auto &record : records) {
+		stream << record;
+	}
+}
+
+// A removed entry is passed with a zero key.
+void _writeStorageChange(
+		quint32 type,
+		const StorageKey &location,
+		const FileDesc &desc) {
+	if (!_mapJournal) {
+		// The current map doesn't refer to any journal yet.
+		_mapChanged = true;
+		_writeMap();
+		return;
+	}
+	EncryptedDescriptor data(sizeof(quint32) + sizeof(quint64) * 3 + sizeof(qint32));
+	data.stream << quint32(type) << quint64(location.first) << quint64(location.second) << quint64(desc.first) << qint32(desc.second);
+	{
+		QMutexLocker lock(&_mapJournal->mutex);
+		_mapJournal->pending.push_back(
+			FileWriteDescriptor::prepareEncrypted(data));
+	}
+	auto job = FileWriter::Job();
+	job.base = _userBasePath + toFilePart(_mapJournal->key);
+	job.custom = [journal = _mapJournal, path = job.base + '0'] {
+		_writeMapJournal(journal, path);
+	};
+	if (_writer) {
+		_writer->push(std::move(job));
+	} else {
+		job.custom();
+	}
+	if (++_mapJournal->records >= kMapJournalRecordsLimit) {
+		_mapChanged = true;
+		_writeMap();
+	}
+}
+
+// Returns the count of the replayed records.
+int _readMapJournal(
+		FileKey key,
+		base::lambda<void(quint32, const StorageKey&, const FileDesc&)> apply) {
+	QFile file(_mapJournalPath(key));
+	if (!file.open(QIODevice::ReadOnly)) {
+		return 0;
+	}
+	QDataStream stream(&file);
+	stream.setVersion(QDataStream::Qt_5_1);
+
+	auto result = 0;
+	while (!stream.atEnd()) {
+		QByteArray encrypted;
+		stream >> encrypted;
+		EncryptedDescriptor data;
+		if (stream.status() != QDataStream::Ok
+			|| !decryptLocal(data, encrypted)) {
+			// The last record was not written completely.
+			LOG(("App Info: map journal is broken after %1 records."
+				).arg(result));
+			break;
+		}
+		quint32 type = 0;
+		quint64 first = 0, second = 0, fileKey = 0;
+		qint32 size = 0;
+		data.stream >> type >> first >> second >> fileKey >> size;
+		if (!_checkStreamStatus(data.stream)) {
+			break;
+		}
+		apply(type, StorageKey(first, second), FileDesc(fileKey, size));
+		++result;
+	}
+	return result;
+}
+
 void _writeLocations(WriteMapWhen when = WriteMapWhen::Soon) {
 	if (when != WriteMapWhen::Now) {
 		_manager->writeLocations(when == WriteMapWhen::Fast);
@@ -1912,6 +2310,12 @@ ReadMapState _readMap(const QByteArray &pass) {
 	hashMd5(dataNameUtf8.constData(), dataNameUtf8.size(), dataNameHash);
 	_dataNameKey = dataNameHash[0];
 	_userBasePath = _basePath + toFilePart(_dataNameKey) + QChar('/');
+	if (!_cachePack) {
+		_cachePack = std::make_unique<Storage::CachePack>(_userBasePath + qsl("cache/"));
+		if (!_cachePack->open()) {
+			_cachePack = nullptr;
+		}
+	}
 
 	FileReadDescriptor mapData;
 	if (!readFile(mapData, qsl("map"))) {
@@ -1961,6 +2365,7 @@ ReadMapState _readMap(const QByteArray &pass) {
 	quint64 installedStickersKey = 0, featuredStickersKey = 0, recentStickersKey = 0, favedStickersKey = 0, archivedStickersKey = 0;
 	quint64 savedGifsKey = 0;
 	quint64 backgroundKey = 0, userSettingsKey = 0, recentHashtagsAndBotsKey = 0, savedPeersKey = 0;
+	quint64 mapJournalKey = 0;
 	while (!map.stream.atEnd()) {
 		quint32 keyType;
 		map.stream >> keyType;
@@ -2062,6 +2467,9 @@ ReadMapState _readMap(const QByteArray &pass) {
 		case lskSavedPeers: {
 			map.stream >> savedPeersKey;
 		} break;
+		case lskMapJournal: {
+			map.stream >> mapJournalKey;
+		} break;
 		default:
 		LOG(("App Error: unknown key type in encrypted map: %1").arg(keyType));
 		return ReadMapFailed;
@@ -2071,6 +2479,40 @@ ReadMapState _readMap(const QByteArray &pass) {
 		}
 	}
 
+	auto mapJournalRecords = 0;
+	if (mapJournalKey) {
+		const auto apply = [&](
+				quint32 type,
+				const StorageKey &location,
+				const FileDesc &desc) {
+			const auto [storage, storageSize] = [&] {
+				switch (type) {
+				case lskImages:
+					return std::make_pair(&imagesMap, &storageImagesSize);
+				case lskStickerImages:
+					return std::make_pair(&stickerImagesMap, &storageStickersSize);
+				case lskAudios:
+					return std::make_pair(&audiosMap, &storageAudiosSize);
+				}
+				return std::make_pair((StorageMap*)nullptr, (qint64*)nullptr);
+			}();
+			if (!storage) {
+				LOG(("App Error: unknown type in map journal: %1").arg(type));
+				return;
+			}
+			const auto i = storage->find(location);
+			if (i != storage->end()) {
+				*storageSize -= i.value().second;
+				storage->erase(i);
+			}
+			if (desc.first) {
+				storage->insert(location, desc);
+				*storageSize += desc.second;
+			}
+		};
+		mapJournalRecords = _readMapJournal(mapJournalKey, apply);
+	}
+
 	_draftsMap = draftsMap;
 	_draftCursorsMap = draftCursorsMap;
 	_draftsNotReadMap = draftsNotReadMap;
@@ -2096,8 +2538,14 @@ ReadMapState _readMap(const QByteArray &pass) {
 	_backgroundKey = backgroundKey;
 	_userSettingsKey = userSettingsKey;
 	_recentHashtagsAndBotsKey = recentHashtagsAndBotsKey;
+	if (mapJournalKey) {
+		_mapJournal = std::make_shared<MapJournal>();
+		_mapJournal->key = mapJournalKey;
+		_mapJournal->records = mapJournalRecords;
+	}
 	_oldMapVersion = mapData.version;
-	if (_oldMapVersion < AppVersion) {
+	if (_oldMapVersion < AppVersion
+		|| mapJournalRecords >= kMapJournalRecordsLimit) {
 		_mapChanged = true;
 		_writeMap();
 	} else {
@@ -2155,6 +2603,13 @@ void _writeMap(WriteMapWhen when) {
 	map.writeData(_passKeySalt);
 	map.writeData(_passKeyEncrypted);
 
+	// The changes after this checkpoint go to a new journal.
+	const auto previousJournal = base::take(_mapJournal);
+	if (const auto key = genKey(FileOption::User)) {
+		_mapJournal = std::make_shared<MapJournal>();
+		_mapJournal->key = key;
+	}
+
 	uint32 mapSize = 0;
 	if (!_draftsMap.isEmpty()) mapSize += sizeof(quint32) * 2 + _draftsMap.size() * sizeof(quint64) * 2;
 	if (!_draftCursorsMap.isEmpty()) mapSize += sizeof(quint32) * 2 + _draftCursorsMap.size() * sizeof(quint64) * 2;
@@ -2174,6 +2629,7 @@ void _writeMap(WriteMapWhen when) {
 	if (_backgroundKey) mapSize += sizeof(quint32) + sizeof(quint64);
 	if (_userSettingsKey) mapSize += sizeof(quint32) + sizeof(quint64);
 	if (_recentHashtagsAndBotsKey) mapSize += sizeof(quint32) + sizeof(quint64);
+	if (_mapJournal) mapSize += sizeof(quint32) + sizeof(quint64);
 	EncryptedDescriptor mapData(mapSize);
 	if (!_draftsMap.isEmpty()) {
 		mapData.stream << quint32(lskDraft) << quint32(_draftsMap.size());
@@ -2239,8 +2695,26 @@ void _writeMap(WriteMapWhen when) {
 	if (_recentHashtagsAndBotsKey) {
 		mapData.stream << quint32(lskRecentHashtagsAndBots) << quint64(_recentHashtagsAndBotsKey);
 	}
+	if (_mapJournal) {
+		mapData.stream << quint32(lskMapJournal) << quint64(_mapJournal->key);
+	}
 	map.writeEncrypted(mapData);
 
+	if (previousJournal) {
+		// Not written records are in the checkpoint already and the
+		// previous journal is removed only after the map is written,
+		// even if this map write is replaced by a later one.
+		{
+			QMutexLocker lock(&previousJournal->mutex);
+			previousJournal->pending.clear();
+		}
+		map.job.done.push_back([
+				path = _mapJournalPath(previousJournal->key)] {
+			QFile::remove(path);
+		});
+	}
+	map.finish();
+
 	_mapChanged = false;
 }
 
@@ -2253,6 +2727,12 @@ void finish() {
 		_manager->deleteLater();
 		_manager = 0;
 		delete base::take(_localLoader);
+
+		// All the pending writes reach the disk before we quit.
+		_writer->stop();
+		delete base::take(_writer);
+		_cachePack = nullptr;
+		_mapJournal = nullptr;
 	}
 }
 
@@ -2263,7 +2743,11 @@ void start() {
 	Expects(!_manager);
 
 	_manager = new internal::Manager();
-	_localLoader = new TaskQueue(kFileLoaderQueueStopTimeout);
+	_localLoader = new TaskQueue(
+		kFileLoaderQueueStopTimeout,
+		kFileLoaderThreadsCount);
+	_writer = new FileWriter();
+	_writer->start();
 
 	_basePath = cWorkingDir() + qsl("tdata/");
 	if (!QDir().exists(_basePath)) QDir().mkpath(_basePath);
@@ -2426,6 +2910,8 @@ void reset() {
 	_writeMap(WriteMapWhen::Now);
 
 	_writeMtpData();
+
+	Storage::ClearDownloadTargets();
 }
 
 bool checkPasscode(const QByteArray &passcode) {
@@ -2734,10 +3220,9 @@ void writeImage(const StorageKey &location, const StorageImageSaved &image, bool
 	qint32 size = _storageImageSize(image.data.size());
 	StorageMap::const_iterator i = _imagesMap.constFind(location);
 	if (i == _imagesMap.cend()) {
-		i = _imagesMap.insert(location, FileDesc(genKey(FileOption::User), size));
+		i = _imagesMap.insert(location, FileDesc(genCacheKey(), size));
 		_storageImagesSize += size;
-		_mapChanged = true;
-		_writeMap();
+		_writeStorageChange(lskImages, location, i.value());
 	} else if (!overwrite) {
 		return;
 	}
@@ -2747,15 +3232,24 @@ void writeImage(const StorageKey &location, const StorageImageSaved &image, bool
 	EncryptedDescriptor data(sizeof(quint64) * 2 + sizeof(quint32) + sizeof(quint32) + image.data.size());
 	data.stream << quint64(location.first) << quint64(location.second) << quint32(legacyTypeField) << image.data;
 
-	FileWriteDescriptor file(i.value().first, FileOption::User);
-	file.writeEncrypted(data);
+	writeCache(i.value().first, data);
 	if (i.value().second != size) {
 		_storageImagesSize += size;
 		_storageImagesSize -= i.value().second;
 		_imagesMap[location].second = size;
+		_writeStorageChange(lskImages, location, _imagesMap[location]);
 	}
 }
 
+namespace {
+
+// Files requested to be shown are read before the automatically loaded.
+TaskPriority LoadTaskPriority(not_null<FileLoader*> loader) {
+	return loader->autoLoading() ? TaskPriority::Normal : TaskPriority::High;
+}
+
+} // namespace
+
 class AbstractCachedLoadTask : public Task {
 public:
 
@@ -2764,7 +3258,7 @@ public:
 	}
 	void process() {
 		FileReadDescriptor image;
-		if (!readEncryptedFile(image, _key, FileOption::User)) {
+		if (!readEncryptedCache(image, _key)) {
 			return;
 		}
 
@@ -2833,6 +3327,7 @@ public:
 			clearKey(_key, FileOption::User);
 			_storageImagesSize -= j->second;
 			_imagesMap.erase(j);
+			_writeStorageChange(lskImages, _location, FileDesc(0, 0));
 		}
 	}
 };
@@ -2843,7 +3338,8 @@ TaskId startImageLoad(const StorageKey &location, mtpFileLoader *loader) {
 		return 0;
 	}
 	return _localLoader->addTask(
-		std::make_unique<ImageLoadTask>(j->first, location, loader));
+		std::make_unique<ImageLoadTask>(j->first, location, loader),
+		LoadTaskPriority(loader));
 }
 
 int32 hasImages() {
@@ -2860,21 +3356,20 @@ void writeStickerImage(const StorageKey &location, const QByteArray &sticker, bo
 	qint32 size = _storageStickerSize(sticker.size());
 	StorageMap::const_iterator i = _stickerImagesMap.constFind(location);
 	if (i == _stickerImagesMap.cend()) {
-		i = _stickerImagesMap.insert(location, FileDesc(genKey(FileOption::User), size));
+		i = _stickerImagesMap.insert(location, FileDesc(genCacheKey(), size));
 		_storageStickersSize += size;
-		_mapChanged = true;
-		_writeMap();
+		_writeStorageChange(lskStickerImages, location, i.value());
 	} else if (!overwrite) {
 		return;
 	}
 	EncryptedDescriptor data(sizeof(quint64) * 2 + sizeof(quint32) + sizeof(quint32) + sticker.size());
 	data.stream << quint64(location.first) << quint64(location.second) << sticker;
-	FileWriteDescriptor file(i.value().first, FileOption::User);
-	file.writeEncrypted(data);
+	writeCache(i.value().first, data);
 	if (i.value().second != size) {
 		_storageStickersSize += size;
 		_storageStickersSize -= i.value().second;
 		_stickerImagesMap[location].second = size;
+		_writeStorageChange(lskStickerImages, location, _stickerImagesMap[location]);
 	}
 }
 
@@ -2892,6 +3387,7 @@ public:
 			clearKey(j.value().first, FileOption::User);
 			_storageStickersSize -= j.value().second;
 			_stickerImagesMap.erase(j);
+			_writeStorageChange(lskStickerImages, _location, FileDesc(0, 0));
 		}
 	}
 };
@@ -2902,7 +3398,8 @@ TaskId startStickerImageLoad(const StorageKey &location, mtpFileLoader *loader)
 		return 0;
 	}
 	return _localLoader->addTask(
-		std::make_unique<StickerImageLoadTask>(j->first, location, loader));
+		std::make_unique<StickerImageLoadTask>(j->first, location, loader),
+		LoadTaskPriority(loader));
 }
 
 bool willStickerImageLoad(const StorageKey &location) {
@@ -2914,9 +3411,9 @@ bool copyStickerImage(const StorageKey &oldLocation, const StorageKey &newLocati
 	if (i == _stickerImagesMap.cend()) {
 		return false;
 	}
-	_stickerImagesMap.insert(newLocation, i.value());
-	_mapChanged = true;
-	_writeMap();
+	const auto desc = i.value();
+	_stickerImagesMap.insert(newLocation, desc);
+	_writeStorageChange(lskStickerImages, newLocation, desc);
 	return true;
 }
 
@@ -2934,21 +3431,20 @@ void writeAudio(const StorageKey &location, const QByteArray &audio, bool overwr
 	qint32 size = _storageAudioSize(audio.size());
 	StorageMap::const_iterator i = _audiosMap.constFind(location);
 	if (i == _audiosMap.cend()) {
-		i = _audiosMap.insert(location, FileDesc(genKey(FileOption::User), size));
+		i = _audiosMap.insert(location, FileDesc(genCacheKey(), size));
 		_storageAudiosSize += size;
-		_mapChanged = true;
-		_writeMap();
+		_writeStorageChange(lskAudios, location, i.value());
 	} else if (!overwrite) {
 		return;
 	}
 	EncryptedDescriptor data(sizeof(quint64) * 2 + sizeof(quint32) + sizeof(quint32) + audio.size());
 	data.stream << quint64(location.first) << quint64(location.second) << audio;
-	FileWriteDescriptor file(i.value().first, FileOption::User);
-	file.writeEncrypted(data);
+	writeCache(i.value().first, data);
 	if (i.value().second != size) {
 		_storageAudiosSize += size;
 		_storageAudiosSize -= i.value().second;
 		_audiosMap[location].second = size;
+		_writeStorageChange(lskAudios, location, _audiosMap[location]);
 	}
 }
 
@@ -2966,6 +3462,7 @@ public:
 			clearKey(j.value().first, FileOption::User);
 			_storageAudiosSize -= j.value().second;
 			_audiosMap.erase(j);
+			_writeStorageChange(lskAudios, _location, FileDesc(0, 0));
 		}
 	}
 };
@@ -2976,7 +3473,8 @@ TaskId startAudioLoad(const StorageKey &location, mtpFileLoader *loader) {
 		return 0;
 	}
 	return _localLoader->addTask(
-		std::make_unique<AudioLoadTask>(j->first, location, loader));
+		std::make_unique<AudioLoadTask>(j->first, location, loader),
+		LoadTaskPriority(loader));
 }
 
 bool copyAudio(const StorageKey &oldLocation, const StorageKey &newLocation) {
@@ -2984,9 +3482,9 @@ bool copyAudio(const StorageKey &oldLocation, const StorageKey &newLocation) {
 	if (i == _audiosMap.cend()) {
 		return false;
 	}
-	_audiosMap.insert(newLocation, i.value());
-	_mapChanged = true;
-	_writeMap();
+	const auto desc = i.value();
+	_audiosMap.insert(newLocation, desc);
+	_writeStorageChange(lskAudios, newLocation, desc);
 	return true;
 }
 
@@ -3012,7 +3510,7 @@ void writeWebFile(const QString &url, const QByteArray &content, bool overwrite)
 	qint32 size = _storageWebFileSize(url, content.size());
 	WebFilesMap::const_iterator i = _webFilesMap.constFind(url);
 	if (i == _webFilesMap.cend()) {
-		i = _webFilesMap.insert(url, FileDesc(genKey(FileOption::User), size));
+		i = _webFilesMap.insert(url, FileDesc(genCacheKey(), size));
 		_storageWebFilesSize += size;
 		_writeLocations();
 	} else if (!overwrite) {
@@ -3020,8 +3518,7 @@ void writeWebFile(const QString &url, const QByteArray &content, bool overwrite)
 	}
 	EncryptedDescriptor data(Serialize::stringSize(url) + sizeof(quint32) + sizeof(quint32) + content.size());
 	data.stream << url << content;
-	FileWriteDescriptor file(i.value().first, FileOption::User);
-	file.writeEncrypted(data);
+	writeCache(i.value().first, data);
 	if (i.value().second != size) {
 		_storageWebFilesSize += size;
 		_storageWebFilesSize -= i.value().second;
@@ -3039,7 +3536,7 @@ public:
 	}
 	void process() {
 		FileReadDescriptor image;
-		if (!readEncryptedFile(image, _key, FileOption::User)) {
+		if (!readEncryptedCache(image, _key)) {
 			return;
 		}
 
@@ -3093,7 +3590,8 @@ TaskId startWebFileLoad(const QString &url, webFileLoader *loader) {
 		return 0;
 	}
 	return _localLoader->addTask(
-		std::make_unique<WebFileLoadTask>(j->first, url, loader));
+		std::make_unique<WebFileLoadTask>(j->first, url, loader),
+		LoadTaskPriority(loader));
 }
 
 int32 hasWebFiles() {
@@ -3170,7 +3668,8 @@ void countVoiceWaveform(DocumentData *document) {
 			voice->waveform.resize(1 + sizeof(TaskId));
 			voice->waveform[0] = -1; // counting
 			TaskId taskId = _localLoader->addTask(
-				std::make_unique<CountWaveformTask>(document));
+				std::make_unique<CountWaveformTask>(document),
+				TaskPriority::Low);
 			memcpy(voice->waveform.data() + 1, &taskId, sizeof(taskId));
 		}
 	}
@@ -4621,7 +5120,14 @@ void ClearManager::onStart() {
 		}
 		switch (task) {
 		case ClearManagerAll: {
+			if (_writer) {
+				_writer->flush();
+			}
+			if (_cachePack) {
+				_cachePack->clear();
+			}
 			result = QDir(cTempDir()).removeRecursively();
+			Storage::ClearDownloadTargets();
 			QDirIterator di(_userBasePath, QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot);
 			while (di.hasNext()) {
 				di.next();
@@ -4638,8 +5144,15 @@ void ClearManager::onStart() {
 		} break;
 		case ClearManagerDownloads:
 			result = QDir(cTempDir()).removeRecursively();
+			Storage::ClearDownloadTargets();
 		break;
 		case ClearManagerStorage:
+			if (_writer) {
+				_writer->flush();
+			}
+			if (_cachePack) {
+				_cachePack->clear();
+			}
 			for (StorageMap::const_iterator i = images.cbegin(), e = images.cend(); i != e; ++i) {
 				clearKey(i.value().first, FileOption::User);
 			}
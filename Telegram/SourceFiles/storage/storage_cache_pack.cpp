@@ -0,0 +1,492 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "storage/storage_cache_pack.h"
+
+namespace Storage {
+namespace {
+
+constexpr auto kSegmentSizeMax = qint64(32 * 1024 * 1024);
+constexpr auto kRecordHeaderSize = qint64(sizeof(quint64) + sizeof(qint32));
+constexpr auto kIndexMagic = quint32(0x49434454); // 'TDCI'
+constexpr auto kIndexVersion = qint32(1);
+
+} // namespace
+
+CachePack::CachePack(const QString &path) : _path(path) {
+}
+
+QString CachePack::segmentPath(int index) const {
+	return _path + qsl("segment%1").arg(index);
+}
+
+QString CachePack::indexPath() const {
+	return _path + qsl("index");
+}
+
+CachePack::Segment *CachePack::openSegment(int index) {
+	auto i = _segments.find(index);
+	if (i != _segments.end()) {
+		return &i->second;
+	}
+	QDir().mkpath(_path);
+	auto file = std::make_unique<QFile>(segmentPath(index));
+	if (!file->open(QIODevice::ReadWrite)) {
+		LOG(("Cache Error: could not open segment '%1'."
+			).arg(file->fileName()));
+		return nullptr;
+	}
+	auto &segment = _segments[index];
+	segment.size = file->size();
+	segment.file = std::move(file);
+	return &segment;
+}
+
+bool CachePack::open() {
+	QMutexLocker lock(&_mutex);
+
+	const auto prefix = qsl("segment");
+	const auto names = QDir(_path).entryList(
+		QStringList(prefix + '*'),
+		QDir::Files);
+	for (const auto &name : names) {
+		auto ok = false;
+		const auto index = name.mid(prefix.size()).toInt(&ok);
+		if (ok && index >= 0) {
+			openSegment(index);
+		}
+	}
+
+	auto snapshots = std::map<int, Snapshot>();
+	if (readIndex(snapshots)) {
+		for (const auto &[index, snapshot] : snapshots) {
+			const auto i = _segments.find(index);
+			if (i == _segments.end() || i->second.size < snapshot.scanned) {
+				LOG(("Cache Info: index is outdated, scanning segments."));
+				snapshots.clear();
+				_entries.clear();
+				break;
+			}
+			i->second.dead = snapshot.dead;
+		}
+	}
+	if (snapshots.empty()) {
+		for (auto &[index, segment] : _segments) {
+			segment.dead = 0;
+		}
+	}
+	for (const auto &[index, segment] : _segments) {
+		const auto i = snapshots.find(index);
+		scanSegment(index, (i != snapshots.end()) ? i->second.scanned : 0);
+	}
+
+	_current = _segments.empty() ? 0 : _segments.rbegin()->first;
+	return (openSegment(_current) != nullptr);
+}
+
+bool CachePack::readIndex(std::map<int, Snapshot> &snapshots) {
+	QFile file(indexPath());
+	if (!file.open(QIODevice::ReadOnly)) {
+		return false;
+	}
+	const auto bytes = file.readAll();
+	QDataStream stream(bytes);
+	stream.setVersion(QDataStream::Qt_5_1);
+
+	quint32 magic = 0, segmentsCount = 0, entriesCount = 0;
+	qint32 version = 0;
+	stream >> magic >> version >> segmentsCount;
+	if (magic != kIndexMagic || version != kIndexVersion) {
+		return false;
+	}
+	for (auto i = quint32(0); i != segmentsCount; ++i) {
+		qint32 index = 0;
+		auto snapshot = Snapshot();
+		stream >> index >> snapshot.scanned >> snapshot.dead;
+		snapshots.emplace(index, snapshot);
+	}
+	stream >> entriesCount;
+	for (auto i = quint32(0); i != entriesCount; ++i) {
+		quint64 key = 0;
+		auto entry = Entry();
+		stream >> key >> entry.segment >> entry.offset >> entry.size;
+		const auto j = snapshots.find(entry.segment);
+		if (j == snapshots.end()
+			|| entry.size < 0
+			|| entry.offset + entry.size > j->second.scanned) {
+			stream.setStatus(QDataStream::ReadCorruptData);
+			break;
+		}
+		_entries.emplace(key, entry);
+	}
+	if (stream.status() != QDataStream::Ok) {
+		LOG(("Cache Error: bad index data stream status: %1"
+			).arg(stream.status()));
+		snapshots.clear();
+		_entries.clear();
+		return false;
+	}
+	return true;
+}
+
+void CachePack::writeIndex() {
+	QSaveFile file(indexPath());
+	if (!file.open(QIODevice::WriteOnly)) {
+		return;
+	}
+	QDataStream stream(&file);
+	stream.setVersion(QDataStream::Qt_5_1);
+	stream << kIndexMagic << kIndexVersion << quint32(_segments.size());
+	for (const auto &[index, segment] : _segments) {
+		stream << qint32(index) << segment.size << segment.dead;
+	}
+	stream << quint32(_entries.size());
+	for (const auto &[key, entry] : _entries) {
+		stream << quint64(key) << qint32(entry.segment) << entry.offset << entry.size;
+	}
+	file.commit();
+}
+
+bool CachePack::scanSegment(int index, qint64 from) {
+	auto &segment = _segments[index];
+	auto &file = *segment.file;
+	auto offset = from;
+	char header[kRecordHeaderSize];
+	while (offset + kRecordHeaderSize <= segment.size) {
+		if (!file.seek(offset)
+			|| file.read(header, kRecordHeaderSize) != kRecordHeaderSize) {
+			break;
+		}
+		auto key = Key();
+		auto size = qint32();
+		memcpy(&key, header, sizeof(key));
+		memcpy(&size, header + sizeof(key), sizeof(size));
+		const auto dataSize = std::max(size, 0);
+		if (offset + kRecordHeaderSize + dataSize > segment.size) {
+			break;
+		}
+		auto entry = Entry();
+		entry.segment = index;
+		entry.offset = offset + kRecordHeaderSize;
+		entry.size = size;
+		apply(key, entry);
+		offset += kRecordHeaderSize + dataSize;
+	}
+	if (offset < segment.size) {
+		// The last record was not written completely.
+		LOG(("Cache Info: truncating segment %1 from %2 to %3."
+			).arg(index
+			).arg(segment.size
+			).arg(offset));
+		file.resize(offset);
+		segment.size = offset;
+		return false;
+	}
+	return true;
+}
+
+void CachePack::markDead(const Entry &entry) {
+	const auto i = _segments.find(entry.segment);
+	if (i != _segments.end()) {
+		i->second.dead += kRecordHeaderSize + std::max(entry.size, 0);
+	}
+}
+
+void CachePack::apply(Key key, const Entry &entry) {
+	const auto i = _entries.find(key);
+	if (i != _entries.end()) {
+		markDead(i->second);
+	}
+	if (entry.size < 0) {
+		markDead(entry);
+		if (i != _entries.end()) {
+			_entries.erase(i);
+		}
+	} else if (i != _entries.end()) {
+		i->second = entry;
+	} else {
+		_entries.emplace(key, entry);
+	}
+}
+
+bool CachePack::append(Key key, qint32 size, const char *bytes) {
+	auto segment = openSegment(_current);
+	if (segment && segment->size >= kSegmentSizeMax) {
+		segment = openSegment(++_current);
+	}
+	if (!segment) {
+		return false;
+	}
+	auto &file = *segment->file;
+	const auto dataSize = std::max(size, 0);
+	char header[kRecordHeaderSize];
+	memcpy(header, &key, sizeof(key));
+	memcpy(header + sizeof(key), &size, sizeof(size));
+	if (!file.seek(segment->size)
+		|| file.write(header, kRecordHeaderSize) != kRecordHeaderSize
+		|| (dataSize > 0 && file.write(bytes, dataSize) != dataSize)
+		|| !file.flush()) {
+		LOG(("Cache Error: could not write to segment %1.").arg(_current));
+		file.resize(segment->size);
+		return false;
+	}
+	auto entry = Entry();
+	entry.segment = _current;
+	entry.offset = segment->size + kRecordHeaderSize;
+	entry.size = size;
+	segment->size += kRecordHeaderSize + dataSize;
+	apply(key, entry);
+	return true;
+}
+
+bool CachePack::contains(Key key) const {
+	QMutexLocker lock(&_mutex);
+	return (_entries.find(key) != _entries.end());
+}
+
+QByteArray CachePack::get(Key key) const {
+	// The records are never changed once written, so the data is read
+	// through a separate handle without holding the mutex. If meanwhile
+	// the record was moved by a compaction or the pack was cleared, the
+	// data could be from a removed file and it is read once again.
+	for (auto attempt = 0; attempt != 2; ++attempt) {
+		QMutexLocker lock(&_mutex);
+		const auto i = _entries.find(key);
+		if (i == _entries.end()) {
+			return QByteArray();
+		}
+		const auto entry = i->second;
+		const auto cleared = _cleared;
+		lock.unlock();
+
+		QFile file(segmentPath(entry.segment));
+		if (!file.open(QIODevice::ReadOnly) || !file.seek(entry.offset)) {
+			continue;
+		}
+		auto result = file.read(entry.size);
+		file.close();
+
+		lock.relock();
+		const auto j = _entries.find(key);
+		if (_cleared == cleared
+			&& j != _entries.end()
+			&& j->second.segment == entry.segment
+			&& j->second.offset == entry.offset) {
+			return (result.size() == entry.size) ? result : QByteArray();
+		}
+	}
+	return QByteArray();
+}
+
+void CachePack::put(Key key, const QByteArray &data) {
+	QMutexLocker lock(&_mutex);
+	if (append(key, data.size(), data.constData())) {
+		compactIfNeeded();
+	}
+}
+
+void CachePack::remove(Key key) {
+	QMutexLocker lock(&_mutex);
+	if (_entries.find(key) == _entries.end()) {
+		return;
+	}
+	if (append(key, -1, nullptr)) {
+		compactIfNeeded();
+	}
+}
+
+void CachePack::compactIfNeeded() {
+	if (_compacting || _compactionStopped) {
+		return;
+	}
+	for (const auto &[index, segment] : _segments) {
+		if (index != _current && segment.dead * 2 > segment.size) {
+			// The task doesn't touch the pack after the semaphore release,
+			// so the pack can be destroyed right after it was acquired.
+			// A compaction started from the end of the previous one waits
+			// for it to leave compact(), so waiting for the last is enough.
+			const auto previous = base::take(_compactionDone);
+			const auto done = std::make_shared<QSemaphore>();
+			_compacting = true;
+			_compactionDone = done;
+			crl::async([=, compacting = index] {
+				if (previous) {
+					previous->acquire();
+				}
+				compact(compacting);
+				done->release();
+			});
+			return;
+		}
+	}
+}
+
+void CachePack::compact(int index) {
+	// The segment is not written any more, so it is read through its own
+	// handle and the mutex is held only to move each record.
+	auto live = std::vector<std::pair<Key, Entry>>();
+	auto older = std::vector<int>();
+	{
+		QMutexLocker lock(&_mutex);
+		for (const auto &[key, entry] : _entries) {
+			if (entry.segment == index) {
+				live.emplace_back(key, entry);
+			}
+		}
+		for (const auto &[other, segment] : _segments) {
+			if (other < index) {
+				older.push_back(other);
+			}
+		}
+	}
+	QFile file(segmentPath(index));
+	auto ok = file.open(QIODevice::ReadOnly);
+	for (const auto &[key, entry] : live) {
+		if (!ok || !file.seek(entry.offset)) {
+			ok = false;
+			break;
+		}
+		const auto bytes = file.read(entry.size);
+		if (bytes.size() != entry.size) {
+			ok = false;
+			break;
+		}
+
+		QMutexLocker lock(&_mutex);
+		const auto i = _entries.find(key);
+		if (_compactionStopped) {
+			ok = false;
+			break;
+		} else if (i == _entries.end()
+			|| i->second.segment != entry.segment
+			|| i->second.offset != entry.offset) {
+			continue;
+		} else if (!append(key, bytes.size(), bytes.constData())) {
+			ok = false;
+			break;
+		}
+	}
+
+	// If an older segment still has a value for a removed key, the
+	// tombstone is carried forward, otherwise a scan would restore it.
+	const auto tombstones = ok
+		? collectTombstones(file, older)
+		: std::vector<Key>();
+	file.close();
+
+	QMutexLocker lock(&_mutex);
+	if (ok && !_compactionStopped) {
+		for (const auto key : tombstones) {
+			if (_entries.find(key) == _entries.end()
+				&& !append(key, -1, nullptr)) {
+				ok = false;
+				break;
+			}
+		}
+		const auto i = _segments.find(index);
+		if (ok && i != _segments.end()) {
+			i->second.file->close();
+			i->second.file->remove();
+			_segments.erase(i);
+			writeIndex();
+		}
+	}
+	_compacting = false;
+	if (ok) {
+		compactIfNeeded();
+	}
+}
+
+std::vector<CachePack::Key> CachePack::collectTombstones(
+		QFile &file,
+		const std::vector<int> &older) const {
+	const auto forEachRecord = [](QFile &file, auto callback) {
+		const auto size = file.size();
+		auto offset = qint64(0);
+		char header[kRecordHeaderSize];
+		while (offset + kRecordHeaderSize <= size) {
+			if (!file.seek(offset)
+				|| file.read(header, kRecordHeaderSize) != kRecordHeaderSize) {
+				break;
+			}
+			auto key = Key();
+			auto recordSize = qint32();
+			memcpy(&key, header, sizeof(key));
+			memcpy(&recordSize, header + sizeof(key), sizeof(recordSize));
+			callback(key, recordSize);
+			offset += kRecordHeaderSize + std::max(recordSize, 0);
+		}
+	};
+
+	auto removed = std::set<Key>();
+	forEachRecord(file, [&](Key key, qint32 size) {
+		if (size < 0) {
+			removed.emplace(key);
+		}
+	});
+	auto result = std::vector<Key>();
+	for (const auto index : older) {
+		if (removed.empty()) {
+			break;
+		}
+		QFile other(segmentPath(index));
+		if (!other.open(QIODevice::ReadOnly)) {
+			// Keep all the tombstones if we can't check.
+			result.insert(result.end(), removed.begin(), removed.end());
+			return result;
+		}
+		forEachRecord(other, [&](Key key, qint32 size) {
+			if (size >= 0 && removed.erase(key)) {
+				result.push_back(key);
+			}
+		});
+	}
+	return result;
+}
+
+void CachePack::stopCompaction(QMutexLocker &lock) {
+	// No new compaction is started after that, so only the one that was
+	// started last could be running.
+	_compactionStopped = true;
+	if (const auto done = base::take(_compactionDone)) {
+		lock.unlock();
+		done->acquire();
+		lock.relock();
+	}
+	Assert(!_compacting);
+}
+
+void CachePack::clear() {
+	QMutexLocker lock(&_mutex);
+	stopCompaction(lock);
+	_compactionStopped = false;
+	for (auto &[index, segment] : _segments) {
+		segment.file->close();
+		segment.file->remove();
+	}
+	_segments.clear();
+	_entries.clear();
+	_current = 0;
+	++_cleared;
+	QFile::remove(indexPath());
+}
+
+void CachePack::close() {
+	writeIndex();
+	for (auto &[index, segment] : _segments) {
+		segment.file->close();
+	}
+	_segments.clear();
+}
+
+CachePack::~CachePack() {
+	QMutexLocker lock(&_mutex);
+	stopCompaction(lock);
+	close();
+}
+
+} // namespace Storage
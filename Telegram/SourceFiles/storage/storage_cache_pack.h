@@ -0,0 +1,84 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+namespace Storage {
+
+// Append-only store of cached blobs in a few large segment files.
+//
+// Each record in a segment is the key, the size and the data, a removed
+// key is marked by a record with a negative size. The index of the live
+// records is saved to a separate file on close and after a compaction,
+// the records appended after it are found by scanning the segment tails.
+// Segments with mostly dead records are compacted in the background.
+class CachePack {
+public:
+	using Key = quint64;
+
+	explicit CachePack(const QString &path);
+	CachePack(const CachePack &other) = delete;
+	CachePack &operator=(const CachePack &other) = delete;
+
+	bool open();
+
+	bool contains(Key key) const;
+	QByteArray get(Key key) const;
+	void put(Key key, const QByteArray &data);
+	void remove(Key key);
+	void clear();
+
+	~CachePack();
+
+private:
+	struct Entry {
+		int segment = 0;
+		qint64 offset = 0;
+		qint32 size = 0;
+	};
+	struct Segment {
+		std::unique_ptr<QFile> file;
+		qint64 size = 0;
+		qint64 dead = 0;
+	};
+	struct Snapshot {
+		qint64 scanned = 0;
+		qint64 dead = 0;
+	};
+
+	QString segmentPath(int index) const;
+	QString indexPath() const;
+	Segment *openSegment(int index);
+	bool readIndex(std::map<int, Snapshot> &snapshots);
+	void writeIndex();
+	bool scanSegment(int index, qint64 from);
+	void apply(Key key, const Entry &entry);
+	bool append(Key key, qint32 size, const char *bytes);
+	void markDead(const Entry &entry);
+	void compactIfNeeded();
+	void compact(int index);
+	std::vector<Key> collectTombstones(
+		QFile &file,
+		const std::vector<int> &older) const;
+	void stopCompaction(QMutexLocker &lock);
+	void close();
+
+	QString _path;
+	mutable QMutex _mutex;
+	std::map<int, Segment> _segments;
+	std::map<Key, Entry> _entries;
+	int _current = 0;
+
+	int _cleared = 0;
+
+	bool _compacting = false;
+	bool _compactionStopped = false;
+	std::shared_ptr<QSemaphore> _compactionDone;
+
+};
+
+} // namespace Storage
@@ -0,0 +1,382 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "storage/storage_download_target.h"
+
+#include <QtCore/QStorageInfo>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <io.h>
+#else // Q_OS_WIN
+#include <sys/mman.h>
+#endif // Q_OS_WIN
+
+namespace Storage {
+namespace {
+
+constexpr auto kPartSize = kDownloadTargetPartSize;
+constexpr auto kTrailerMagic = quint32(0x504C4454); // 'TDLP'
+constexpr auto kSyncEachBytes = 4 * 1024 * 1024;
+constexpr auto kTargetsSizeMax = qint64(2) * 1024 * 1024 * 1024;
+constexpr auto kTargetsAgeMax = 7 * 24 * 60 * 60; // seconds
+
+struct Trailer {
+	quint32 magic = 0;
+	qint32 size = 0;
+	qint32 partSize = 0;
+};
+constexpr auto kTrailerSize = qint64(sizeof(Trailer));
+
+QMutex OpenedTargetsMutex;
+std::set<QString> OpenedTargets;
+
+bool RegisterOpenedTarget(const QString &path) {
+	QMutexLocker lock(&OpenedTargetsMutex);
+	return OpenedTargets.emplace(path).second;
+}
+
+void UnregisterOpenedTarget(const QString &path) {
+	QMutexLocker lock(&OpenedTargetsMutex);
+	OpenedTargets.erase(path);
+}
+
+bool SyncMapped(QFile &file, uchar *data, qint64 size) {
+#ifdef Q_OS_WIN
+	const auto handle = HANDLE(_get_osfhandle(file.handle()));
+	return FlushViewOfFile(data, size_t(size))
+		&& (handle != INVALID_HANDLE_VALUE)
+		&& FlushFileBuffers(handle);
+#else // Q_OS_WIN
+	return (msync(data, size_t(size), MS_SYNC) == 0);
+#endif // Q_OS_WIN
+}
+
+// Removes the old partial files and then the least recently modified
+// ones while all of them together take more than the limit.
+void TrimDownloadTargets() {
+	auto entries = QDir(DownloadTargetsPath()).entryInfoList(
+		QDir::Files | QDir::NoDotAndDotDot,
+		QDir::Time | QDir::Reversed);
+	auto total = qint64(0);
+	for (const auto &entry : entries) {
+		total += entry.size();
+	}
+	const auto now = QDateTime::currentDateTime();
+	QMutexLocker lock(&OpenedTargetsMutex);
+	for (const auto &entry : entries) {
+		const auto path = entry.absoluteFilePath();
+		if (OpenedTargets.find(path) != OpenedTargets.end()) {
+			continue;
+		} else if (total > kTargetsSizeMax
+			|| entry.lastModified().secsTo(now) > kTargetsAgeMax) {
+			if (QFile::remove(path)) {
+				total -= entry.size();
+			}
+		}
+	}
+}
+
+} // namespace
+
+QString DownloadTargetsPath() {
+	return cWorkingDir() + qsl("tdata/downloads/");
+}
+
+void ClearDownloadTargets() {
+	const auto entries = QDir(DownloadTargetsPath()).entryInfoList(
+		QDir::Files | QDir::NoDotAndDotDot);
+	QMutexLocker lock(&OpenedTargetsMutex);
+	for (const auto &entry : entries) {
+		const auto path = entry.absoluteFilePath();
+		if (OpenedTargets.find(path) == OpenedTargets.end()) {
+			QFile::remove(path);
+		}
+	}
+}
+
+// The mapping with the file, used by the background syncs.
+// Syncs, finish and close are serialized by the mutex.
+struct DownloadTarget::Mapped {
+	explicit Mapped(const QString &path);
+
+	// The parts are synced and only then marked in the stored bitmap.
+	void sync(int from, int till, const std::vector<uchar> &received);
+	void close();
+
+	QMutex mutex;
+	QFile file;
+	QString path;
+	bool registered = false;
+	uchar *data = nullptr;
+	uchar *storedReceived = nullptr;
+	bool syncFailed = false;
+	std::atomic<bool> syncing = { false };
+
+};
+
+DownloadTarget::Mapped::Mapped(const QString &path)
+: file(path)
+, path(QFileInfo(file).absoluteFilePath()) {
+}
+
+void DownloadTarget::Mapped::sync(
+		int from,
+		int till,
+		const std::vector<uchar> &received) {
+	if (!data || syncFailed) {
+		return;
+	}
+
+	// The range starts from a part, so it is aligned to the page size.
+	if (from < till && !SyncMapped(file, data + from, till - from)) {
+		// Parts synced later must not be marked with the ones that failed.
+		LOG(("Download Error: could not sync '%1'.").arg(path));
+		syncFailed = true;
+		return;
+	}
+	memcpy(storedReceived, received.data(), received.size());
+}
+
+void DownloadTarget::Mapped::close() {
+	if (data) {
+		file.unmap(base::take(data));
+		storedReceived = nullptr;
+	}
+	if (file.isOpen()) {
+		file.close();
+	}
+	if (registered) {
+		registered = false;
+		UnregisterOpenedTarget(path);
+	}
+}
+
+DownloadTarget::DownloadTarget(const QString &path)
+: _mapped(std::make_shared<Mapped>(path)) {
+}
+
+int DownloadTarget::partsCount() const {
+	return (_size + kPartSize - 1) / kPartSize;
+}
+
+bool DownloadTarget::received(int index) const {
+	return (_received[index / 8] & (1 << (index % 8))) != 0;
+}
+
+void DownloadTarget::markReceived(int index) {
+	if (!received(index)) {
+		_received[index / 8] |= (1 << (index % 8));
+		_receivedBytes += partBytes(index);
+		_notSyncedBytes += partBytes(index);
+		_notSyncedFrom = std::min(_notSyncedFrom, index * kPartSize);
+		_notSyncedTill = std::max(
+			_notSyncedTill,
+			index * kPartSize + partBytes(index));
+	}
+}
+
+int DownloadTarget::partBytes(int index) const {
+	return std::min(kPartSize, _size - index * kPartSize);
+}
+
+int DownloadTarget::bitmapSize() const {
+	return (partsCount() + 7) / 8;
+}
+
+qint64 DownloadTarget::fullSize() const {
+	return qint64(_size) + bitmapSize() + kTrailerSize;
+}
+
+bool DownloadTarget::open(int size) {
+	Expects(size > 0);
+	Expects(!_data);
+
+	_size = size;
+	_notSyncedFrom = _size;
+	auto &file = _mapped->file;
+	QDir().mkpath(QFileInfo(file).absolutePath());
+	TrimDownloadTargets();
+	if (!RegisterOpenedTarget(_mapped->path)) {
+		return false;
+	}
+	_mapped->registered = true;
+	if (!file.open(QIODevice::ReadWrite)) {
+		close();
+		return false;
+	}
+	const auto resumed = readReceived();
+	if (!resumed) {
+		if (!file.resize(0) || !file.resize(fullSize())) {
+			close();
+			return false;
+		}
+	}
+	_data = _mapped->data = file.map(0, fullSize());
+	if (!_data) {
+		close();
+		return false;
+	}
+	const auto storedReceived = _mapped->storedReceived = _data + _size;
+	_received.assign(storedReceived, storedReceived + bitmapSize());
+	if (resumed) {
+		for (auto i = 0, count = partsCount(); i != count; ++i) {
+			if (received(i)) {
+				_receivedBytes += partBytes(i);
+			}
+		}
+	} else {
+		auto trailer = Trailer();
+		trailer.magic = kTrailerMagic;
+		trailer.size = _size;
+		trailer.partSize = kPartSize;
+		memcpy(storedReceived + bitmapSize(), &trailer, kTrailerSize);
+	}
+
+	// Writing to a mapped sparse file crashes when the disk is full.
+	const auto storage = QStorageInfo(file.fileName());
+	if (storage.isValid()
+		&& storage.bytesAvailable() < qint64(_size - _receivedBytes)) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+bool DownloadTarget::readReceived() {
+	auto &file = _mapped->file;
+	if (file.size() != fullSize()
+		|| !file.seek(fullSize() - kTrailerSize)) {
+		return false;
+	}
+	auto trailer = Trailer();
+	const auto read = file.read(
+		reinterpret_cast<char*>(&trailer),
+		kTrailerSize);
+	return (read == kTrailerSize)
+		&& (trailer.magic == kTrailerMagic)
+		&& (trailer.size == _size)
+		&& (trailer.partSize == kPartSize);
+}
+
+int DownloadTarget::nextMissing(int offset) const {
+	Expects(_data != nullptr);
+
+	for (auto i = offset / kPartSize, count = partsCount(); i < count; ++i) {
+		if (!received(i)) {
+			return std::max(offset, i * kPartSize);
+		}
+	}
+	return _size;
+}
+
+bool DownloadTarget::receivedAny(int offset, int limit) const {
+	Expects(_data != nullptr);
+
+	const auto till = std::min(
+		(offset + limit + kPartSize - 1) / kPartSize,
+		partsCount());
+	for (auto i = offset / kPartSize; i < till; ++i) {
+		if (received(i)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool DownloadTarget::write(int offset, base::const_byte_span bytes) {
+	Expects(_data != nullptr);
+	Expects(offset >= 0 && (offset % kPartSize) == 0);
+
+	if (offset + bytes.size() > _size) {
+		return false;
+	}
+	memcpy(_data + offset, bytes.data(), bytes.size());
+
+	// Only fully written parts are marked, the last one may be shorter.
+	const auto till = offset + int(bytes.size());
+	for (auto i = offset / kPartSize; i * kPartSize < till; ++i) {
+		if ((i + 1) * kPartSize <= till || till == _size) {
+			markReceived(i);
+		}
+	}
+	if (_notSyncedBytes >= kSyncEachBytes) {
+		syncLater();
+	}
+	return true;
+}
+
+void DownloadTarget::syncLater() {
+	Expects(_data != nullptr);
+
+	// Only one sync is running, the parts received meanwhile are
+	// synced by the next one.
+	if (_mapped->syncing.exchange(true)) {
+		return;
+	}
+	const auto from = std::exchange(_notSyncedFrom, _size);
+	const auto till = std::exchange(_notSyncedTill, 0);
+	_notSyncedBytes = 0;
+	crl::async([=, mapped = _mapped, received = _received] {
+		QMutexLocker lock(&mapped->mutex);
+		mapped->sync(from, till, received);
+		mapped->syncing = false;
+	});
+}
+
+bool DownloadTarget::finish(const QString &destination) {
+	Expects(_data != nullptr);
+
+	// The data is not synced here, the file is complete now, so the
+	// bitmap is not needed anymore.
+	const auto mapped = base::take(_mapped);
+	QMutexLocker lock(&mapped->mutex);
+	auto &file = mapped->file;
+	file.unmap(base::take(mapped->data));
+	mapped->storedReceived = _data = nullptr;
+	if (!file.resize(_size)) {
+		mapped->close();
+		return false;
+	}
+
+	// Keep the file in the opened list until it is moved, so that it
+	// is not removed by ClearDownloadTargets() in the meantime.
+	file.close();
+	const auto result = (!QFile::exists(destination)
+		|| QFile::remove(destination))
+		&& file.rename(destination);
+	mapped->close();
+	return result;
+}
+
+void DownloadTarget::close() {
+	const auto mapped = base::take(_mapped);
+	if (!mapped) {
+		return;
+	} else if (!_data) {
+		QMutexLocker lock(&mapped->mutex);
+		mapped->close();
+		return;
+	}
+	_data = nullptr;
+
+	// The partial file stays registered as opened until it is closed,
+	// so a new download of the same file can't map it meanwhile.
+	const auto from = _notSyncedFrom;
+	const auto till = _notSyncedTill;
+	crl::async([=, received = base::take(_received)] {
+		QMutexLocker lock(&mapped->mutex);
+		mapped->sync(from, till, received);
+		mapped->close();
+	});
+}
+
+DownloadTarget::~DownloadTarget() {
+	close();
+}
+
+} // namespace Storage
@@ -0,0 +1,82 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+namespace Storage {
+
+// Received parts are tracked with this granularity.
+constexpr auto kDownloadTargetPartSize = 128 * 1024;
+
+// Directory with the partially downloaded files.
+QString DownloadTargetsPath();
+
+// Removes all the partial files that are not opened by a download.
+void ClearDownloadTargets();
+
+// Memory-mapped file for a large download with a bitmap of received
+// parts stored after the file data, so that a download interrupted by
+// cancel or by an app restart can continue from the received parts.
+class DownloadTarget {
+public:
+	explicit DownloadTarget(const QString &path);
+	DownloadTarget(const DownloadTarget &other) = delete;
+	DownloadTarget &operator=(const DownloadTarget &other) = delete;
+
+	// Fails if the partial file is opened by another download.
+	bool open(int size);
+
+	int size() const {
+		return _size;
+	}
+	int receivedBytes() const {
+		return _receivedBytes;
+	}
+	bool receivedAll() const {
+		return (_receivedBytes == _size);
+	}
+
+	// Offset of the first not received part starting from offset.
+	int nextMissing(int offset) const;
+	bool receivedAny(int offset, int limit) const;
+
+	bool write(int offset, base::const_byte_span bytes);
+
+	// Truncates the bitmap and moves the file to the destination.
+	bool finish(const QString &destination);
+
+	~DownloadTarget();
+
+private:
+	struct Mapped;
+
+	int partsCount() const;
+	int bitmapSize() const;
+	qint64 fullSize() const;
+	bool received(int index) const;
+	void markReceived(int index);
+	int partBytes(int index) const;
+	bool readReceived();
+	void syncLater();
+	void close();
+
+	// The mapping is synced and closed in the background.
+	std::shared_ptr<Mapped> _mapped;
+	int _size = 0;
+	uchar *_data = nullptr;
+
+	// The bitmap in the file is updated only after the data is synced,
+	// so that it never marks parts that are not on the disk yet.
+	std::vector<uchar> _received;
+	int _receivedBytes = 0;
+	int _notSyncedBytes = 0;
+	int _notSyncedFrom = 0;
+	int _notSyncedTill = 0;
+
+};
+
+} // namespace Storage
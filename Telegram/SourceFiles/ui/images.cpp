@@ -301,7 +301,34 @@ QImage prepareOpaque(QImage image) {
 	return image;
 }
 
+PrepareContext prepareContext(Images::Options options) {
+	auto result = PrepareContext();
+	result.outerBg = st::imageBg->c;
+	const auto radius = (options & Images::Option::RoundedLarge)
+		? ImageRoundRadius::Large
+		: (options & Images::Option::RoundedSmall)
+		? ImageRoundRadius::Small
+		: ImageRoundRadius::None;
+	if (radius != ImageRoundRadius::None) {
+		const auto masks = App::cornersMask(radius);
+		for (auto i = 0; i != 4; ++i) {
+			result.cornerMasks[i] = masks[i];
+		}
+	}
+	return result;
+}
+
 QImage prepare(QImage img, int w, int h, Images::Options options, int outerw, int outerh, const style::color *colored) {
+	auto result = prepare(std::move(img), w, h, options, outerw, outerh, prepareContext(options));
+	if (options & Images::Option::Colored) {
+		Assert(colored != nullptr);
+		result = prepareColored(*colored, std::move(result));
+		result.setDevicePixelRatio(cRetinaFactor());
+	}
+	return result;
+}
+
+QImage prepare(QImage img, int w, int h, Images::Options options, int outerw, int outerh, const PrepareContext &context) {
 	Assert(!img.isNull());
 	if (options & Images::Option::Blurred) {
 		img = prepareBlur(std::move(img));
@@ -328,7 +355,7 @@ QImage prepare(QImage img, int w, int h, Images::Options options, int outerw, in
 			{
 				QPainter p(&result);
 				if (w < outerw || h < outerh) {
-					p.fillRect(0, 0, result.width(), result.height(), st::imageBg);
+					p.fillRect(0, 0, result.width(), result.height(), context.outerBg);
 				}
 				p.drawImage((result.width() - img.width()) / (2 * cIntRetinaFactor()), (result.height() - img.height()) / (2 * cIntRetinaFactor()), img);
 			}
@@ -345,16 +372,16 @@ QImage prepare(QImage img, int w, int h, Images::Options options, int outerw, in
 	if (options & Images::Option::Circled) {
 		prepareCircle(img);
 		Assert(!img.isNull());
-	} else if (options & Images::Option::RoundedLarge) {
-		prepareRound(img, ImageRoundRadius::Large, corners(options));
-		Assert(!img.isNull());
-	} else if (options & Images::Option::RoundedSmall) {
-		prepareRound(img, ImageRoundRadius::Small, corners(options));
-		Assert(!img.isNull());
-	}
-	if (options & Images::Option::Colored) {
-		Assert(colored != nullptr);
-		img = prepareColored(*colored, std::move(img));
+	} else if (options & (Images::Option::RoundedLarge | Images::Option::RoundedSmall)) {
+		const auto parts = corners(options);
+		if (static_cast<int>(parts)) {
+			img.setDevicePixelRatio(cRetinaFactor());
+			img = std::move(img).convertToFormat(QImage::Format_ARGB32_Premultiplied);
+			Assert(!img.isNull());
+
+			auto masks = context.cornerMasks;
+			prepareRound(img, masks.data(), parts);
+		}
 	}
 	img.setDevicePixelRatio(cRetinaFactor());
 	return img;
@@ -390,6 +417,26 @@ WebFileImages webFileImages;
 
 int64 globalAcquiredSize = 0;
 
+// Prepared sizes of all images are limited together, the least recently
+// used ones are dropped when the limit is exceeded.
+constexpr auto kSizesCacheLimit = int64(64 * 1024 * 1024);
+constexpr auto kSizesCacheTrimTo = kSizesCacheLimit * 3 / 4;
+
+// Sizes of large images are prepared in the background.
+constexpr auto kPrepareAsyncMinPixels = int64(512 * 512);
+
+int64 sizesCacheSize = 0;
+uint64 sizesUseCounter = 0;
+bool sizesTrimScheduled = false;
+std::set<const Image*> imagesWithSizes;
+
+uint64 lastPrepareRequest = 0;
+std::map<uint64, std::pair<const Image*, uint64>> preparingSizes;
+
+int64 pixmapBytes(const QPixmap &pixmap) {
+	return int64(pixmap.width()) * pixmap.height() * 4;
+}
+
 uint64 PixKey(int width, int height, Images::Options options) {
 	return static_cast<uint64>(width) | (static_cast<uint64>(height) << 24) | (static_cast<uint64>(options) << 48);
 }
@@ -456,17 +503,7 @@ const QPixmap &Image::pix(int32 w, int32 h) const {
         h *= cIntRetinaFactor();
     }
 	auto options = Images::Option::Smooth | Images::Option::None;
-	auto k = PixKey(w, h, options);
-	auto i = _sizesCache.constFind(k);
-	if (i == _sizesCache.cend()) {
-		auto p = pixNoCache(w, h, options);
-        if (cRetina()) p.setDevicePixelRatio(cRetinaFactor());
-		i = _sizesCache.insert(k, p);
-		if (!p.isNull()) {
-			globalAcquiredSize += int64(p.width()) * p.height() * 4;
-		}
-	}
-	return i.value();
+	return pixCached(PixKey(w, h, options), w, h, options);
 }
 
 const QPixmap &Image::pixRounded(int32 w, int32 h, ImageRoundRadius radius, RectParts corners) const {
@@ -492,17 +529,7 @@ const QPixmap &Image::pixRounded(int32 w, int32 h, ImageRoundRadius radius, Rect
 	} else if (radius == ImageRoundRadius::Ellipse) {
 		options |= Images::Option::Circled | cornerOptions(corners);
 	}
-	auto k = PixKey(w, h, options);
-	auto i = _sizesCache.constFind(k);
-	if (i == _sizesCache.cend()) {
-		auto p = pixNoCache(w, h, options);
-		if (cRetina()) p.setDevicePixelRatio(cRetinaFactor());
-		i = _sizesCache.insert(k, p);
-		if (!p.isNull()) {
-			globalAcquiredSize += int64(p.width()) * p.height() * 4;
-		}
-	}
-	return i.value();
+	return pixCached(PixKey(w, h, options), w, h, options);
 }
 
 const QPixmap &Image::pixCircled(int32 w, int32 h) const {
@@ -515,17 +542,7 @@ const QPixmap &Image::pixCircled(int32 w, int32 h) const {
 		h *= cIntRetinaFactor();
 	}
 	auto options = Images::Option::Smooth | Images::Option::Circled;
-	auto k = PixKey(w, h, options);
-	auto i = _sizesCache.constFind(k);
-	if (i == _sizesCache.cend()) {
-		auto p = pixNoCache(w, h, options);
-		if (cRetina()) p.setDevicePixelRatio(cRetinaFactor());
-		i = _sizesCache.insert(k, p);
-		if (!p.isNull()) {
-			globalAcquiredSize += int64(p.width()) * p.height() * 4;
-		}
-	}
-	return i.value();
+	return pixCached(PixKey(w, h, options), w, h, options);
 }
 
 const QPixmap &Image::pixBlurredCircled(int32 w, int32 h) const {
@@ -538,17 +555,7 @@ const QPixmap &Image::pixBlurredCircled(int32 w, int32 h) const {
 		h *= cIntRetinaFactor();
 	}
 	auto options = Images::Option::Smooth | Images::Option::Circled | Images::Option::Blurred;
-	auto k = PixKey(w, h, options);
-	auto i = _sizesCache.constFind(k);
-	if (i == _sizesCache.cend()) {
-		auto p = pixNoCache(w, h, options);
-		if (cRetina()) p.setDevicePixelRatio(cRetinaFactor());
-		i = _sizesCache.insert(k, p);
-		if (!p.isNull()) {
-			globalAcquiredSize += int64(p.width()) * p.height() * 4;
-		}
-	}
-	return i.value();
+	return pixCached(PixKey(w, h, options), w, h, options);
 }
 
 const QPixmap &Image::pixBlurred(int32 w, int32 h) const {
@@ -561,17 +568,7 @@ const QPixmap &Image::pixBlurred(int32 w, int32 h) const {
 		h *= cIntRetinaFactor();
 	}
 	auto options = Images::Option::Smooth | Images::Option::Blurred;
-	auto k = PixKey(w, h, options);
-	auto i = _sizesCache.constFind(k);
-	if (i == _sizesCache.cend()) {
-		auto p = pixNoCache(w, h, options);
-		if (cRetina()) p.setDevicePixelRatio(cRetinaFactor());
-		i = _sizesCache.insert(k, p);
-		if (!p.isNull()) {
-			globalAcquiredSize += int64(p.width()) * p.height() * 4;
-		}
-	}
-	return i.value();
+	return pixCached(PixKey(w, h, options), w, h, options);
 }
 
 const QPixmap &Image::pixColored(style::color add, int32 w, int32 h) const {
@@ -585,16 +582,12 @@ const QPixmap &Image::pixColored(style::color add, int32 w, int32 h) const {
 	}
 	auto options = Images::Option::Smooth | Images::Option::Colored;
 	auto k = PixKey(w, h, options);
-	auto i = _sizesCache.constFind(k);
-	if (i == _sizesCache.cend()) {
-		auto p = pixColoredNoCache(add, w, h, true);
-		if (cRetina()) p.setDevicePixelRatio(cRetinaFactor());
-		i = _sizesCache.insert(k, p);
-		if (!p.isNull()) {
-			globalAcquiredSize += int64(p.width()) * p.height() * 4;
-		}
+	auto i = _sizesCache.find(k);
+	if (i == _sizesCache.end()) {
+		return storeSize(k, pixColoredNoCache(add, w, h, true));
 	}
-	return i.value();
+	i->used = ++sizesUseCounter;
+	return i->pixmap;
 }
 
 const QPixmap &Image::pixBlurredColored(style::color add, int32 w, int32 h) const {
@@ -608,16 +601,12 @@ const QPixmap &Image::pixBlurredColored(style::color add, int32 w, int32 h) cons
 	}
 	auto options = Images::Option::Blurred | Images::Option::Smooth | Images::Option::Colored;
 	auto k = PixKey(w, h, options);
-	auto i = _sizesCache.constFind(k);
-	if (i == _sizesCache.cend()) {
-		auto p = pixBlurredColoredNoCache(add, w, h);
-		if (cRetina()) p.setDevicePixelRatio(cRetinaFactor());
-		i = _sizesCache.insert(k, p);
-		if (!p.isNull()) {
-			globalAcquiredSize += int64(p.width()) * p.height() * 4;
-		}
+	auto i = _sizesCache.find(k);
+	if (i == _sizesCache.end()) {
+		return storeSize(k, pixBlurredColoredNoCache(add, w, h));
 	}
-	return i.value();
+	i->used = ++sizesUseCounter;
+	return i->pixmap;
 }
 
 const QPixmap &Image::pixSingle(int32 w, int32 h, int32 outerw, int32 outerh, ImageRoundRadius radius, RectParts corners, const style::color *colored) const {
@@ -648,20 +637,7 @@ const QPixmap &Image::pixSingle(int32 w, int32 h, int32 outerw, int32 outerh, Im
 		options |= Images::Option::Colored;
 	}
 
-	auto k = SinglePixKey(options);
-	auto i = _sizesCache.constFind(k);
-	if (i == _sizesCache.cend() || i->width() != (outerw * cIntRetinaFactor()) || i->height() != (outerh * cIntRetinaFactor())) {
-		if (i != _sizesCache.cend()) {
-			globalAcquiredSize -= int64(i->width()) * i->height() * 4;
-		}
-		auto p = pixNoCache(w, h, options, outerw, outerh, colored);
-		if (cRetina()) p.setDevicePixelRatio(cRetinaFactor());
-		i = _sizesCache.insert(k, p);
-		if (!p.isNull()) {
-			globalAcquiredSize += int64(p.width()) * p.height() * 4;
-		}
-	}
-	return i.value();
+	return pixCached(SinglePixKey(options), w, h, options, outerw, outerh, colored);
 }
 
 const QPixmap &Image::pixBlurredSingle(int w, int h, int32 outerw, int32 outerh, ImageRoundRadius radius, RectParts corners) const {
@@ -689,20 +665,132 @@ const QPixmap &Image::pixBlurredSingle(int w, int h, int32 outerw, int32 outerh,
 		options |= Images::Option::Circled | cornerOptions(corners);
 	}
 
-	auto k = SinglePixKey(options);
-	auto i = _sizesCache.constFind(k);
-	if (i == _sizesCache.cend() || i->width() != (outerw * cIntRetinaFactor()) || i->height() != (outerh * cIntRetinaFactor())) {
-		if (i != _sizesCache.cend()) {
-			globalAcquiredSize -= int64(i->width()) * i->height() * 4;
+	return pixCached(SinglePixKey(options), w, h, options, outerw, outerh);
+}
+
+const QPixmap &Image::pixCached(uint64 key, int w, int h, Images::Options options, int outerw, int outerh, const style::color *colored) const {
+	auto i = _sizesCache.find(key);
+	if (i != _sizesCache.end()) {
+		const auto &pixmap = i->pixmap;
+		if (outerw <= 0
+			|| (pixmap.width() == outerw * cIntRetinaFactor()
+				&& pixmap.height() == outerh * cIntRetinaFactor())) {
+			i->used = ++sizesUseCounter;
+			return pixmap;
 		}
-		auto p = pixNoCache(w, h, options, outerw, outerh);
-		if (cRetina()) p.setDevicePixelRatio(cRetinaFactor());
-		i = _sizesCache.insert(k, p);
-		if (!p.isNull()) {
-			globalAcquiredSize += int64(p.width()) * p.height() * 4;
+	}
+
+	if (!loading()) const_cast<Image*>(this)->load();
+	restore();
+	const auto async = !_data.isNull()
+		&& !isNull()
+		&& (options & Images::Option::Smooth)
+		&& !(options & (Images::Option::Circled | Images::Option::Colored))
+		&& int64(_data.width()) * _data.height() >= kPrepareAsyncMinPixels;
+	if (!async) {
+		return storeSize(key, pixNoCache(w, h, options, outerw, outerh, colored));
+	}
+
+	// Show a fast scaled placeholder until the background job is done.
+	const auto fast = options & ~(Images::Option::Smooth | Images::Option::Blurred);
+	const auto request = ++lastPrepareRequest;
+	const auto &result = storeSize(
+		key,
+		pixNoCache(w, h, fast, outerw, outerh),
+		request);
+	preparingSizes.emplace(request, std::make_pair(this, key));
+	crl::async([
+		=,
+		image = _data.toImage(),
+		context = Images::prepareContext(options)
+	]() mutable {
+		auto prepared = Images::prepare(
+			std::move(image),
+			w,
+			h,
+			options,
+			outerw,
+			outerh,
+			context);
+		crl::on_main([=, prepared = std::move(prepared)]() mutable {
+			ApplyPrepared(request, std::move(prepared));
+		});
+	});
+	return result;
+}
+
+const QPixmap &Image::storeSize(uint64 key, QPixmap &&pixmap, uint64 request) const {
+	auto i = _sizesCache.find(key);
+	if (i != _sizesCache.end()) {
+		removeSize(i);
+	}
+	if (cRetina()) pixmap.setDevicePixelRatio(cRetinaFactor());
+
+	auto size = Size();
+	size.pixmap = std::move(pixmap);
+	size.used = ++sizesUseCounter;
+	size.request = request;
+	const auto bytes = pixmapBytes(size.pixmap);
+	globalAcquiredSize += bytes;
+	sizesCacheSize += bytes;
+	imagesWithSizes.emplace(this);
+
+	if (sizesCacheSize > kSizesCacheLimit && !sizesTrimScheduled) {
+		// The returned reference must be valid until the caller uses it.
+		sizesTrimScheduled = true;
+		crl::on_main([] { TrimSizesCache(); });
+	}
+	return _sizesCache.insert(key, std::move(size))->pixmap;
+}
+
+void Image::removeSize(Sizes::iterator i) const {
+	const auto bytes = pixmapBytes(i->pixmap);
+	globalAcquiredSize -= bytes;
+	sizesCacheSize -= bytes;
+	if (i->request) {
+		preparingSizes.erase(i->request);
+	}
+	_sizesCache.erase(i);
+	if (_sizesCache.isEmpty()) {
+		imagesWithSizes.erase(this);
+	}
+}
+
+void Image::ApplyPrepared(uint64 request, QImage &&image) {
+	const auto i = preparingSizes.find(request);
+	if (i == preparingSizes.end()) {
+		return;
+	}
+	const auto [owner, key] = i->second;
+	owner->storeSize(key, App::pixmapFromImageInPlace(std::move(image)));
+	if (AuthSession::Exists()) {
+		Auth().downloaderTaskFinished().notify();
+	}
+}
+
+void Image::TrimSizesCache() {
+	sizesTrimScheduled = false;
+	if (sizesCacheSize <= kSizesCacheLimit) {
+		return;
+	}
+	struct Used {
+		uint64 used = 0;
+		const Image *image = nullptr;
+		uint64 key = 0;
+	};
+	auto all = std::vector<Used>();
+	for (const auto image : imagesWithSizes) {
+		for (auto i = image->_sizesCache.cbegin(), e = image->_sizesCache.cend(); i != e; ++i) {
+			all.push_back({ i->used, image, i.key() });
 		}
 	}
-	return i.value();
+	ranges::sort(all, std::less<>(), &Used::used);
+	for (const auto &entry : all) {
+		if (sizesCacheSize <= kSizesCacheTrimTo) {
+			break;
+		}
+		entry.image->removeSize(entry.image->_sizesCache.find(entry.key));
+	}
 }
 
 QPixmap Image::pixNoCache(int w, int h, Images::Options options, int outerw, int outerh, const style::color *colored) const {
@@ -827,12 +915,9 @@ void Image::restore() const {
 }
 
 void Image::invalidateSizeCache() const {
-	for (auto &pix : _sizesCache) {
-		if (!pix.isNull()) {
-			globalAcquiredSize -= int64(pix.width()) * pix.height() * 4;
-		}
+	while (!_sizesCache.isEmpty()) {
+		removeSize(_sizesCache.begin());
 	}
-	_sizesCache.clear();
 }
 
 Image::~Image() {
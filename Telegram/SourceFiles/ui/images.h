@@ -57,7 +57,16 @@ enum class Option {
 using Options = base::flags<Option>;
 inline constexpr auto is_flag_type(Option) { return true; };
 
+// Style colors and corner masks used by prepare(), captured on the main
+// thread so that an image can be prepared on a background thread.
+struct PrepareContext {
+	QColor outerBg;
+	std::array<QImage, 4> cornerMasks;
+};
+PrepareContext prepareContext(Options options);
+
 QImage prepare(QImage img, int w, int h, Options options, int outerw, int outerh, const style::color *colored = nullptr);
+QImage prepare(QImage img, int w, int h, Options options, int outerw, int outerh, const PrepareContext &context);
 
 inline QPixmap pixmap(QImage img, int w, int h, Options options, int outerw, int outerh, const style::color *colored = nullptr) {
 	return QPixmap::fromImage(prepare(img, w, h, options, outerw, outerh, colored), Qt::ColorOnly);
@@ -336,7 +345,19 @@ protected:
 	mutable QPixmap _data;
 
 private:
-	using Sizes = QMap<uint64, QPixmap>;
+	struct Size {
+		QPixmap pixmap;
+		uint64 used = 0; // Last access tick for the LRU eviction.
+		uint64 request = 0; // Not zero while pixmap is a placeholder.
+	};
+	using Sizes = QMap<uint64, Size>;
+
+	const QPixmap &pixCached(uint64 key, int w, int h, Images::Options options, int outerw = -1, int outerh = -1, const style::color *colored = nullptr) const;
+	const QPixmap &storeSize(uint64 key, QPixmap &&pixmap, uint64 request = 0) const;
+	void removeSize(Sizes::iterator i) const;
+	static void ApplyPrepared(uint64 request, QImage &&image);
+	static void TrimSizesCache();
+
 	mutable Sizes _sizesCache;
 
 };
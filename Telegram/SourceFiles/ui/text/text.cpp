@@ -2452,6 +2452,7 @@ Text &Text::operator=(const Text &other) {
 	for (int32 i = 0, l = _blocks.size(); i < l; ++i) {
 		_blocks[i] = other._blocks.at(i)->clone();
 	}
+	clearCountedLines();
 	return *this;
 }
 
@@ -2464,6 +2465,7 @@ Text &Text::operator=(Text &&other) {
 	_blocks = std::move(other._blocks);
 	_links = other._links;
 	_startDir = other._startDir;
+	clearCountedLines();
 	other.clearFields();
 	return *this;
 }
@@ -2478,6 +2480,8 @@ void Text::setText(const style::TextStyle &st, const QString &text, const TextPa
 }
 
 void Text::recountNaturalSize(bool initial, Qt::LayoutDirection optionsDir) {
+	clearCountedLines();
+
 	NewlineBlock *lastNewline = 0;
 
 	_maxWidth = _minHeight = 0;
@@ -2701,30 +2705,40 @@ int Text::countWidth(int width) const {
 		return _maxWidth.ceil().toInt();
 	}
 
-	QFixed maxLineWidth = 0;
-	enumerateLines(width, [&maxLineWidth](QFixed lineWidth, int lineHeight) {
-		if (lineWidth > maxLineWidth) {
-			maxLineWidth = lineWidth;
-		}
-	});
-	return maxLineWidth.ceil().toInt();
+	return countLines(width).maxLineWidth.ceil().toInt();
 }
 
 int Text::countHeight(int width) const {
 	if (QFixed(width) >= _maxWidth) {
 		return _minHeight;
 	}
-	int result = 0;
-	enumerateLines(width, [&result](QFixed lineWidth, int lineHeight) {
-		result += lineHeight;
-	});
-	return result;
+	return countLines(width).height;
 }
 
 void Text::countLineWidths(int width, QVector<int> *lineWidths) const {
-	enumerateLines(width, [lineWidths](QFixed lineWidth, int lineHeight) {
+	for (const auto lineWidth : countLines(width).lineWidths) {
 		lineWidths->push_back(lineWidth.ceil().toInt());
+	}
+}
+
+const Text::CountedLines &Text::countLines(int width) const {
+	for (const auto &counted : _countedLines) {
+		if (counted.width == width) {
+			return counted;
+		}
+	}
+	auto result = CountedLines();
+	result.width = width;
+	enumerateLines(width, [&result](QFixed lineWidth, int lineHeight) {
+		result.lineWidths.push_back(lineWidth);
+		if (lineWidth > result.maxLineWidth) {
+			result.maxLineWidth = lineWidth;
+		}
+		result.height += lineHeight;
 	});
+	_countedLines[1] = std::move(_countedLines[0]);
+	_countedLines[0] = std::move(result);
+	return _countedLines[0];
 }
 
 template <typename Callback>
@@ -3050,6 +3064,13 @@ void Text::clearFields() {
 	_links.clear();
 	_maxWidth = _minHeight = 0;
 	_startDir = Qt::LayoutDirectionAuto;
+	clearCountedLines();
+}
+
+void Text::clearCountedLines() const {
+	for (auto &counted : _countedLines) {
+		counted = CountedLines();
+	}
 }
 
 Text::~Text() = default;
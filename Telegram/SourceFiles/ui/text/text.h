@@ -213,10 +213,25 @@ private:
 	// it is also called from move constructor / assignment operator
 	void clearFields();
 
+	// Lines broken by enumerateLines() for some width.
+	struct CountedLines {
+		int width = -1;
+		QVector<QFixed> lineWidths;
+		QFixed maxLineWidth = 0;
+		int height = 0;
+	};
+	const CountedLines &countLines(int width) const;
+	void clearCountedLines() const;
+
 	QFixed _minResizeWidth;
 	QFixed _maxWidth = 0;
 	int32 _minHeight = 0;
 
+	// Lines for the last widths, shared by countWidth(), countHeight() and
+	// countLineWidths(). The text is broken into lines again only when
+	// it or its skip block changes. Painting lays out the lines itself.
+	mutable CountedLines _countedLines[2];
+
 	QString _text;
 	const style::TextStyle *_st = nullptr;
 
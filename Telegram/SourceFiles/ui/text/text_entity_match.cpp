@@ -0,0 +1,40 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "ui/text/text_entity_match.h"
+
+namespace TextUtilities {
+
+QString ExpressionDomain() {
+	// Matches any domain name, containing at least one '.', including "file.txt".
+	return QString::fromUtf8("(?<![\\w\\$\\-\\_%=\\.])(?:([a-zA-Z]+)://)?((?:[A-Za-z" "\xD0\x90-\xD0\xAF\xD0\x81" "\xD0\xB0-\xD1\x8F\xD1\x91" "0-9\\-\\_]+\\.){1,10}([A-Za-z" "\xD1\x80\xD1\x84" "\\-\\d]{2,22})(\\:\\d+)?)");
+}
+
+QString ExpressionDomainExplicit() {
+	// Matches any domain name, containing a protocol, including "test://localhost".
+	return QString::fromUtf8("(?<![\\w\\$\\-\\_%=\\.])(?:([a-zA-Z]+)://)((?:[A-Za-z" "\xD0\x90-\xD0\xAF\xD0\x81" "\xD0\xB0-\xD1\x8F\xD1\x91" "0-9\\-\\_]+\\.){0,10}([A-Za-z" "\xD1\x80\xD1\x84" "\\-\\d]{2,22})(\\:\\d+)?)");
+}
+
+QString ExpressionSeparators(const QString &additional) {
+	// UTF8 quotes
+	const auto quotes = QString::fromUtf8("\xC2\xAB\xC2\xBB\xE2\x80\x9C\xE2\x80\x9D\xE2\x80\x98\xE2\x80\x99");
+	return QStringLiteral("\\s\\.,:;<>|'\"\\[\\]\\{\\}\\~\\!\\?\\%\\^\\(\\)\\-\\+=\\x10") + quotes + additional;
+}
+
+QString ExpressionHashtag() {
+	return QStringLiteral("(^|[") + ExpressionSeparators(QStringLiteral("`\\*/")) + QStringLiteral("])#[\\w]{2,64}([\\W]|$)");
+}
+
+QString ExpressionMention() {
+	return QStringLiteral("(^|[") + ExpressionSeparators(QStringLiteral("`\\*/")) + QStringLiteral("])@[A-Za-z_0-9]{1,32}([\\W]|$)");
+}
+
+QString ExpressionBotCommand() {
+	return QStringLiteral("(^|[") + ExpressionSeparators(QStringLiteral("`\\*")) + QStringLiteral("])/[A-Za-z_0-9]{1,64}(@[A-Za-z_0-9]{5,32})?([\\W]|$)");
+}
+
+} // namespace TextUtilities
@@ -0,0 +1,50 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+#include <QtCore/QString>
+#include <QtCore/QRegularExpression>
+
+namespace TextUtilities {
+
+QString ExpressionDomain();
+QString ExpressionDomainExplicit();
+QString ExpressionSeparators(const QString &additional);
+QString ExpressionHashtag();
+QString ExpressionMention();
+QString ExpressionBotCommand();
+
+// The first match from some offset stays the first match from any later
+// offset up to its start, because the entity expressions don't depend on
+// the offset they are matched from. So the expression is matched again
+// only when the text up to the last match start was consumed or when the
+// offset goes back. All calls must be made with the same text.
+class CachedMatch {
+public:
+	explicit CachedMatch(const QRegularExpression &expression)
+	: _expression(expression) {
+	}
+
+	QRegularExpressionMatch match(const QString &text, int from) {
+		if (_from < 0
+			|| _from > from
+			|| (_match.hasMatch() && _match.capturedStart() < from)) {
+			_match = _expression.match(text, from);
+			_from = from;
+		}
+		return _match;
+	}
+
+private:
+	const QRegularExpression &_expression;
+	QRegularExpressionMatch _match;
+	int _from = -1;
+
+};
+
+} // namespace TextUtilities
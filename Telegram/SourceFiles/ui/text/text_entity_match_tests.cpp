@@ -0,0 +1,229 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "catch.hpp"
+
+#include "ui/text/text_entity_match.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace {
+
+using namespace TextUtilities;
+
+std::vector<QRegularExpression> Expressions() {
+	const auto create = [](const QString &expression) {
+		return QRegularExpression(
+			expression,
+			QRegularExpression::UseUnicodePropertiesOption);
+	};
+	return {
+		create(ExpressionDomain()),
+		create(ExpressionDomainExplicit()),
+		create(ExpressionHashtag()),
+		create(ExpressionMention()),
+		create(ExpressionBotCommand()),
+	};
+}
+
+std::vector<QString> Corpus() {
+	auto result = std::vector<QString>{
+		QString(),
+		QStringLiteral("a"),
+		QStringLiteral("hello world, nothing to see here"),
+		QStringLiteral("see https://telegram.org/blog and t.me/durov"),
+		QStringLiteral("mail me at someone.else@gmail.com, or not"),
+		QStringLiteral("#tag #t #longer_tag_with_digits_123 #"),
+		QStringLiteral("@user @u @_under @name_that_is_way_too_long_for_a_username_field"),
+		QStringLiteral("/start /help@some_bot /x@bot /cmd@"),
+		QStringLiteral("file.txt readme.md archive.tar.gz"),
+		QStringLiteral("test://localhost:8080/path?query=1#frag"),
+		QStringLiteral("(http://example.com/path_(with)_parens) [x.com]"),
+		QStringLiteral("\"quoted @mention\" 'and #hashtag' `/command`"),
+		QStringLiteral("@mention.@other,#tag.#other;/cmd./other"),
+		QStringLiteral("a@b.c @1abc @abc1 @a_b_c_ @@double ##double //double"),
+		QStringLiteral("line\n#first\n@second\n/third\nfourth.com\n"),
+		QStringLiteral("mixed.domain:123 wrong:domain ::1 127.0.0.1:80"),
+	};
+	result.push_back(QString::fromUtf8(
+		"\xD0\xBF\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82.\xD1\x80\xD1\x84 "
+		"#\xD1\x82\xD0\xB5\xD0\xB3 @\xD0\xB8\xD0\xBC\xD1\x8F "
+		"\xC2\xAB#quoted\xC2\xBB \xE2\x80\x9C@quoted\xE2\x80\x9D"));
+
+	auto random = std::mt19937(42);
+	const auto pieces = std::vector<QString>{
+		QStringLiteral(" "),
+		QStringLiteral("\n"),
+		QStringLiteral("."),
+		QStringLiteral(","),
+		QStringLiteral("@"),
+		QStringLiteral("#"),
+		QStringLiteral("/"),
+		QStringLiteral(":"),
+		QStringLiteral("word"),
+		QStringLiteral("telegram"),
+		QStringLiteral("org"),
+		QStringLiteral("com"),
+		QStringLiteral("http://"),
+		QStringLiteral("_bot"),
+		QStringLiteral("123"),
+		QString::fromUtf8("\xD1\x80\xD1\x84"),
+		QString::fromUtf8("\xC2\xAB"),
+	};
+	auto piece = std::uniform_int_distribution<int>(0, pieces.size() - 1);
+	for (auto i = 0; i != 200; ++i) {
+		auto text = QString();
+		for (auto j = 0; j != 40; ++j) {
+			text += pieces[piece(random)];
+		}
+		result.push_back(text);
+	}
+	return result;
+}
+
+void RequireSame(
+		const QRegularExpressionMatch &cached,
+		const QRegularExpressionMatch &direct) {
+	REQUIRE(cached.hasMatch() == direct.hasMatch());
+	if (!direct.hasMatch()) {
+		return;
+	}
+	REQUIRE(cached.lastCapturedIndex() == direct.lastCapturedIndex());
+	for (auto i = 0; i <= direct.lastCapturedIndex(); ++i) {
+		REQUIRE(cached.capturedStart(i) == direct.capturedStart(i));
+		REQUIRE(cached.capturedEnd(i) == direct.capturedEnd(i));
+		REQUIRE(cached.captured(i) == direct.captured(i));
+	}
+}
+
+} // namespace
+
+TEST_CASE("cached entity matches are the same as direct matches", "[text_entity]") {
+	const auto expressions = Expressions();
+	const auto corpus = Corpus();
+
+	SECTION("matching from each offset in order") {
+		for (const auto &text : corpus) {
+			for (const auto &expression : expressions) {
+				auto cached = CachedMatch(expression);
+				for (auto from = 0; from <= text.size(); ++from) {
+					RequireSame(
+						cached.match(text, from),
+						expression.match(text, from));
+				}
+			}
+		}
+	}
+
+	SECTION("matching from the end of each previous match") {
+		for (const auto &text : corpus) {
+			for (const auto &expression : expressions) {
+				auto cached = CachedMatch(expression);
+				for (auto from = 0; from <= text.size();) {
+					const auto match = cached.match(text, from);
+					RequireSame(match, expression.match(text, from));
+					if (!match.hasMatch()) {
+						break;
+					}
+					from = std::max(match.capturedEnd(), from + 1);
+				}
+			}
+		}
+	}
+
+	SECTION("matching from random offsets, going back sometimes") {
+		auto random = std::mt19937(7);
+		auto step = std::uniform_int_distribution<int>(-3, 8);
+		for (const auto &text : corpus) {
+			for (const auto &expression : expressions) {
+				auto cached = CachedMatch(expression);
+				for (auto from = 0; from <= text.size();) {
+					RequireSame(
+						cached.match(text, from),
+						expression.match(text, from));
+					from = std::max(from + step(random), 0);
+				}
+			}
+		}
+	}
+}
+
+TEST_CASE("cached entity matches benchmark", "[.][benchmark][text_entity]") {
+	const auto expressions = Expressions();
+	const auto corpus = Corpus();
+	const auto measure = [&](auto &&method) {
+		const auto started = std::chrono::steady_clock::now();
+		auto matches = 0;
+		for (auto i = 0; i != 10; ++i) {
+			for (const auto &text : corpus) {
+				matches += method(text);
+			}
+		}
+		const auto finished = std::chrono::steady_clock::now();
+		std::cout
+			<< std::chrono::duration_cast<std::chrono::microseconds>(
+				finished - started).count()
+			<< "us for " << matches << " matches" << std::endl;
+		return matches;
+	};
+
+	// Both walk each text the way ParseEntities does: from the end of
+	// the nearest match of all the expressions, matching each of them.
+	const auto direct = measure([&](const QString &text) {
+		auto result = 0;
+		for (auto from = 0; from < text.size();) {
+			auto nearestStart = -1;
+			auto nearestEnd = -1;
+			for (const auto &expression : expressions) {
+				const auto match = expression.match(text, from);
+				if (match.hasMatch()
+					&& (nearestStart < 0
+						|| match.capturedStart() < nearestStart)) {
+					nearestStart = match.capturedStart();
+					nearestEnd = match.capturedEnd();
+				}
+			}
+			if (nearestStart < 0) {
+				break;
+			}
+			++result;
+			from = std::max(nearestEnd, from + 1);
+		}
+		return result;
+	});
+	const auto cached = measure([&](const QString &text) {
+		auto matchers = std::vector<CachedMatch>();
+		for (const auto &expression : expressions) {
+			matchers.emplace_back(expression);
+		}
+		auto result = 0;
+		for (auto from = 0; from < text.size();) {
+			auto nearestStart = -1;
+			auto nearestEnd = -1;
+			for (auto &matcher : matchers) {
+				const auto match = matcher.match(text, from);
+				if (match.hasMatch()
+					&& (nearestStart < 0
+						|| match.capturedStart() < nearestStart)) {
+					nearestStart = match.capturedStart();
+					nearestEnd = match.capturedEnd();
+				}
+			}
+			if (nearestStart < 0) {
+				break;
+			}
+			++result;
+			from = std::max(nearestEnd, from + 1);
+		}
+		return result;
+	});
+	REQUIRE(direct == cached);
+}
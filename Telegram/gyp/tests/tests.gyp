@@ -51,6 +51,16 @@
       '<(src_loc)/base/algorithm.h',
       '<(src_loc)/base/algorithm_tests.cpp',
     ],
+  }, {
+    'target_name': 'tests_dialogs_words_index',
+    'includes': [
+      'common_test.gypi',
+    ],
+    'sources': [
+      '<(src_loc)/dialogs/dialogs_words_index.cpp',
+      '<(src_loc)/dialogs/dialogs_words_index.h',
+      '<(src_loc)/dialogs/dialogs_words_index_tests.cpp',
+    ],
   }, {
     'target_name': 'tests_flags',
     'includes': [
@@ -78,6 +88,35 @@
       '<(src_loc)/base/flat_set.h',
       '<(src_loc)/base/flat_set_tests.cpp',
     ],
+  }, {
+    'target_name': 'tests_flat_hash_map',
+    'includes': [
+      'common_test.gypi',
+    ],
+    'sources': [
+      '<(src_loc)/base/flat_hash_map.h',
+      '<(src_loc)/base/flat_hash_map_tests.cpp',
+    ],
+  }, {
+    'target_name': 'tests_text_entity_match',
+    'includes': [
+      'common_test.gypi',
+    ],
+    'sources': [
+      '<(src_loc)/ui/text/text_entity_match.cpp',
+      '<(src_loc)/ui/text/text_entity_match.h',
+      '<(src_loc)/ui/text/text_entity_match_tests.cpp',
+    ],
+  }, {
+    'target_name': 'tests_media_clip_frame_pool',
+    'includes': [
+      'common_test.gypi',
+    ],
+    'sources': [
+      '<(src_loc)/media/media_clip_frame_pool.cpp',
+      '<(src_loc)/media/media_clip_frame_pool.h',
+      '<(src_loc)/media/media_clip_frame_pool_tests.cpp',
+    ],
   }, {
     'target_name': 'tests_rpl',
     'includes': [